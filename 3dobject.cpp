@@ -2,111 +2,126 @@
 
 #include "gear.h"
 #include "glad.h"
-#include <glm/glm.hpp>
-#include <glm/gtc/matrix_transform.hpp>
-#include <glm/gtc/type_ptr.hpp>
-
-// Offsets of each attribute, in bytes
-const void* ThreeDimensionalObject::posOffset = 0;
-const void* ThreeDimensionalObject::nrmOffset = (void*)(3 * sizeof(float));
-const void* ThreeDimensionalObject::colOffset = (void*)(6 * sizeof(float));
-
-extern GLfloat angle;
-extern GLuint uniformModel, uniformColour;
+#include <algorithm>
+#include <cmath>
+#include <random>
 
 void ThreeDimensionalObject::draw() const {
-    glm::mat4 model(1.0);
-    model = glm::translate(
-        model,
-        glm::vec3(position.x, position.y, position.z)
-    );
-    model = glm::rotate(
-        model,
-        glm::radians(angleMultiply * angle + angleAdd),
-        glm::vec3(0.0, 0.0, 1.0)
+    // The geometry arena's vertex array, and this object's uniform block, are
+    // expected to be bound already
+    glDrawElementsBaseVertex(
+        GL_TRIANGLES, mesh->indexCount, GL_UNSIGNED_INT, mesh->indexOffset(),
+        mesh->baseVertex
     );
+}
 
-    glUniformMatrix4fv(uniformModel, 1, GL_FALSE, glm::value_ptr(model));
-    glUniform3f(uniformColour, colour.x, colour.y, colour.z);
-
-    // glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
-    // glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBindVertexArray(vao);
+void ThreeDimensionalObject::setupForDrawing(GearBlueprint bp, MeshCache& meshes) {
+    mesh = meshes.get(bp);
+    scale = bp.scale();
+}
 
-    glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, nullptr);
+bool ThreeDimensionalObject::setupForDrawing(GearBlueprint bp, MeshCache& meshes, MeshLoader& loader) {
+    mesh = meshes.request(bp, loader);
+    scale = bp.scale();
+    return mesh != nullptr;
 }
 
-void ThreeDimensionalObject::setupForDrawing(GearBlueprint bp) {
-    GearBuffersSeparate gearBuffers = gear(bp);
-    indexCount = gearBuffers.indices.size();
+// A few shapes; differently sized copies of these share the same meshes
+static const GearBlueprint fieldShapes[] = {
+    {1., 4., 1., 20, 0.7},
+    {0.5, 2., 2., 10, 0.7},
+    {1.3, 2., 0.5, 10, 0.7},
+    {0.4, 1.5, 1., 12, 0.4},
+};
+static const int fieldShapeCount = sizeof(fieldShapes) / sizeof(fieldShapes[0]);
+// Distance between neighbouring gears of the field
+static const float fieldSpacing = 4.5;
+// Fewest gears in a row added by addGearRow()
+#define MIN_ROW_GEARS 8
 
-    if (vao) glDeleteVertexArrays(1, &vao);
-    if (vbo) glDeleteBuffers(1, &vbo);
-    if (ibo) glDeleteBuffers(1, &ibo);
+// Most teeth of the field's shapes
+static int fieldTeeth()
+{
+    int teeth = 0;
+    for (const GearBlueprint& shape : fieldShapes) {
+        teeth = std::max(teeth, shape.teeth);
+    }
+    return teeth;
+}
 
-    // Set up buffer and vertex array
-    glGenBuffers(1, &vbo);
-    glGenBuffers(1, &ibo);
-    glGenVertexArrays(1, &vao);
-    // Set up vertex array
-    glBindVertexArray(vao);
-    // Upload index buffer
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
-    glBufferData(
-        GL_ELEMENT_ARRAY_BUFFER,
-        gearBuffers.indices.size() * sizeof(unsigned int),
-        gearBuffers.indices.data(),
-        GL_STATIC_DRAW
-    );
-    // Upload vertex buffer
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(
-        GL_ARRAY_BUFFER,
-        gearBuffers.totalSize(),
-        nullptr,
-        GL_STATIC_DRAW
-    );
-    glBufferSubData(
-        GL_ARRAY_BUFFER,
-        0,
-        gearBuffers.pos.size() * sizeof(vec3_t),
-        gearBuffers.pos.data()
-    );
-    glBufferSubData(
-        GL_ARRAY_BUFFER,
-        gearBuffers.pos.size() * sizeof(vec3_t),
-        gearBuffers.nrm.size() * sizeof(vec3_t),
-        gearBuffers.nrm.data()
-    );
-    glBufferSubData(
-        GL_ARRAY_BUFFER,
-        gearBuffers.pos.size() * sizeof(vec3_t) +
-        gearBuffers.nrm.size() * sizeof(vec3_t),
-        gearBuffers.bary.size() * sizeof(vec2_t),
-        gearBuffers.bary.data()
-    );
-    // Set up vertex attributes
-    {
-        size_t offset = 0;
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3_t), (void*) offset);
-        glEnableVertexAttribArray(0);
+// Give a gear the given number of teeth, with its depth scaled to keep it in
+// proportion, and a random size with an outer radius between 1 and 2, so
+// that neighbours don't overlap
+static GearBlueprint fieldGear(GearBlueprint bp, int teeth, float random)
+{
+    if (teeth > 0) {
+        bp.tooth_depth *= (float) bp.teeth / teeth;
+        bp.teeth = teeth;
     }
-    {
-        size_t offset = gearBuffers.pos.size() * sizeof(vec3_t);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vec3_t), (void*) offset);
-        glEnableVertexAttribArray(1);
+    float size = (1.f + random) / bp.outer_radius;
+    bp.inner_radius *= size;
+    bp.outer_radius *= size;
+    bp.tooth_depth *= size;
+    return bp;
+}
+
+void addGearField(std::vector<ThreeDimensionalObject> &objects, MeshCache &meshes, int count, int teeth)
+{
+    const float spacing = fieldSpacing;
+    int side = (int) ceil(sqrt((double) count));
+    // Fixed seed, so that every run looks the same
+    std::minstd_rand random(1);
+    std::uniform_real_distribution<float> unit(0., 1.);
+
+    objects.reserve(objects.size() + count);
+    for (int i = 0; i < count; i++) {
+        float x = (i % side - side / 2) * spacing;
+        float y = (i / side) * spacing;
+        // Draw the random numbers in a fixed order; the order in which
+        // function arguments are evaluated is unspecified.
+        vec3_t colour;
+        colour.x = unit(random);
+        colour.y = unit(random);
+        colour.z = unit(random);
+        float angleMultiply = (unit(random) - .5f) * 4.f;
+        float angleAdd = unit(random) * 360.f;
+        objects.emplace_back(
+            colour,
+            vec3_t {{x, y, -4.0f}}, // position
+            angleMultiply, angleAdd
+        );
+        GearBlueprint bp = fieldGear(fieldShapes[i % fieldShapeCount], teeth, unit(random));
+        objects.back().setupForDrawing(bp, meshes);
     }
-    {
-        size_t offset =
-            gearBuffers.pos.size() * sizeof(vec3_t) +
-            gearBuffers.nrm.size() * sizeof(vec3_t);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(vec2_t), (void*) offset);
-        glEnableVertexAttribArray(2);
+}
+
+void addGearRow(std::vector<ThreeDimensionalObject>& objects, std::vector<GearBlueprint>& blueprints,
+    int row, int fieldGears)
+{
+    int side = (int) ceil(sqrt((double) fieldGears));
+    int fieldRows = side > 0 ? (fieldGears + side - 1) / side : 0;
+    int count = std::max(side, MIN_ROW_GEARS);
+    // The field's shapes, with more teeth than any of the field's, and a
+    // number no other row has
+    int teeth = fieldTeeth() + 1 + row;
+    float y = (fieldRows + row) * fieldSpacing;
+    // A seed of its own, so that every run looks the same
+    std::minstd_rand random(row + 2);
+    std::uniform_real_distribution<float> unit(0., 1.);
+
+    for (int i = 0; i < count; i++) {
+        float x = (i - count / 2) * fieldSpacing;
+        vec3_t colour;
+        colour.x = unit(random);
+        colour.y = unit(random);
+        colour.z = unit(random);
+        float angleMultiply = (unit(random) - .5f) * 4.f;
+        float angleAdd = unit(random) * 360.f;
+        objects.emplace_back(
+            colour,
+            vec3_t {{x, y, -4.0f}}, // position
+            angleMultiply, angleAdd
+        );
+        blueprints.push_back(fieldGear(fieldShapes[i % fieldShapeCount], teeth, unit(random)));
     }
-    // Release bindings
-    glBindVertexArray(0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    // Free buffer, since it has been uploaded already
-    // delete[] gearBuffer;
 }
@@ -3,30 +3,24 @@
 #include "glad.h"
 #include "vector.h"
 #include "gear.h"
+#include "mesh.h"
+#include <vector>
 
 struct ThreeDimensionalObject {
     private:
-    // OpenGL resource handles
-    GLuint ibo;
-    GLuint vbo;
-    GLuint vao;
-    // Used for rendering a complete object
-    GLuint indexCount;
+    // Shared geometry, owned by a MeshCache
+    const Mesh* mesh;
 
     public:
 
-    // Prevent copying! See: https://www.khronos.org/opengl/wiki/Common_Mistakes#RAII_and_hidden_destructor_calls
-    // Also, this class needs a move constructor and a move assignment operator
-    // since this class also has a destructor
-    ThreeDimensionalObject(ThreeDimensionalObject& other) = delete;
-    ThreeDimensionalObject& operator= (ThreeDimensionalObject& other) = delete;
-
     // Default values for angleMultiply and angleAdd
     ThreeDimensionalObject(
         vec3_t colour,
         vec3_t position
-    ) : colour(colour),
+    ) : mesh(nullptr),
+        colour(colour),
         position(position),
+        scale {{1.0, 1.0, 1.0}},
         angleMultiply(1.0),
         angleAdd(0.0) {}
 
@@ -36,53 +30,41 @@ struct ThreeDimensionalObject {
         vec3_t position,
         float angleMultiply,
         float angleAdd
-    ) : colour(colour),
+    ) : mesh(nullptr),
+        colour(colour),
         position(position),
+        scale {{1.0, 1.0, 1.0}},
         angleMultiply(angleMultiply),
         angleAdd(angleAdd) {}
 
-    ThreeDimensionalObject(ThreeDimensionalObject&& other) : ibo(other.ibo),
-        vbo(other.vbo), vao(other.vao),
-        indexCount(other.indexCount), colour(other.colour),
-        position(other.position), angleMultiply(other.angleMultiply),
-        angleAdd(other.angleAdd)
-    {
-        other.ibo = 0;
-        other.vbo = 0;
-        other.vao = 0;
-    }
-
-    ThreeDimensionalObject& operator= (ThreeDimensionalObject&& other) {
-        if (this != &other) {
-            ibo = other.ibo; other.ibo = 0;
-            vbo = other.vbo; other.vbo = 0;
-            vao = other.vao; other.vao = 0;
-            indexCount = other.indexCount; other.indexCount = 0;
-            colour = other.colour; other.colour = vec3_t {};
-            position = other.position; other.position = vec3_t {};
-            angleMultiply = other.angleMultiply; other.angleMultiply = 1.0;
-            angleAdd = other.angleAdd; other.angleAdd = 0.0;
-        }
-        return *this;
-    }
-
-    ~ThreeDimensionalObject() {
-        if (ibo) glDeleteBuffers(1, &ibo);
-        if (vbo) glDeleteBuffers(1, &vbo);
-        if (vao) glDeleteVertexArrays(1, &vao);
-    }
-
     // Uniforms
     vec3_t colour;
     vec3_t position;
+    // Size of the gear relative to its canonical shape; applied in the vertex
+    // shader, so that differently sized gears can share the same mesh.
+    vec3_t scale;
     // Angle offsets
     float angleMultiply;
     float angleAdd;
 
     void draw() const;
-    void setupForDrawing(GearBlueprint bp);
-
-    static const void* posOffset;
-    static const void* nrmOffset;
-    static const void* colOffset;
+    const Mesh* getMesh() const { return mesh; }
+    void setupForDrawing(GearBlueprint bp, MeshCache& meshes);
+    // The same, unless the mesh still has to be loaded, in which case it is
+    // queued on loader, and false is returned. Call again once the cache has
+    // received meshes from it.
+    bool setupForDrawing(GearBlueprint bp, MeshCache& meshes, MeshLoader& loader);
 };
+
+// Add count gears of assorted shapes, sizes and colours on a grid below the
+// three main gears. If teeth is given, every gear has that many, with their
+// depth scaled to keep them in proportion, so that the triangles get smaller
+// as it grows.
+void addGearField(std::vector<ThreeDimensionalObject>& objects, MeshCache& meshes, int count, int teeth = 0);
+
+// Add a row of gears behind the field of fieldGears gears added by
+// addGearField(), with their blueprints in the same order, without setting
+// them up for drawing. Each row has shapes of its own, so it needs meshes no
+// other gear has.
+void addGearRow(std::vector<ThreeDimensionalObject>& objects, std::vector<GearBlueprint>& blueprints,
+    int row, int fieldGears);
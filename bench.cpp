@@ -0,0 +1,297 @@
+#include "bench.h"
+
+#if defined(_MSC_VER)
+ // Make MS math.h define M_PI
+ #define _USE_MATH_DEFINES
+#endif
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include "glad.h"
+#include "3dobject.h"
+#include "extrude.h"
+#include "gear.h"
+#include "mesh.h"
+#include "triangulate.h"
+#include "vector.h"
+
+typedef std::chrono::steady_clock BenchClock;
+
+static double msSince(BenchClock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(BenchClock::now() - start).count();
+}
+
+// A circle of the given number of points, optionally with a wavy edge
+static std::vector<vec2_t> ring(
+    unsigned int points, float cx, float cy, float radius,
+    unsigned int waves = 0, float waveDepth = 0)
+{
+    std::vector<vec2_t> r;
+    r.reserve(points);
+    for (unsigned int i = 0; i < points; i++) {
+        float angle = i * 2.f * (float) M_PI / points;
+        float rad = radius + waveDepth * sinf(angle * waves);
+        r.push_back({{cx + rad * cosf(angle), cy + rad * sinf(angle)}});
+    }
+    return r;
+}
+
+void Bench::extrude()
+{
+    const int runs = 10;
+    // A sprocket-like outline with a central hole and four lightening holes
+    Profile profile;
+    profile.outer = ring(100000, 0, 0, 10, 500, .25);
+    profile.holes.push_back(ring(5000, 0, 0, 2));
+    for (int h = 0; h < 4; h++) {
+        float angle = h * (float) M_PI / 2;
+        profile.holes.push_back(ring(2000, 6 * cosf(angle), 6 * sinf(angle), 1.5));
+    }
+
+    std::vector<vec2_t> points(profile.outer);
+    std::vector<unsigned int> holeStarts;
+    for (const std::vector<vec2_t>& hole : profile.holes) {
+        holeStarts.push_back(points.size());
+        points.insert(points.end(), hole.begin(), hole.end());
+    }
+
+    double bestTriangulate = 1e30, bestExtrude = 1e30;
+    std::vector<unsigned int> triangles;
+    GearBuffersSeparate buffers;
+    for (int run = 0; run < runs; run++) {
+        BenchClock::time_point start = BenchClock::now();
+        triangles = triangulate(points, holeStarts);
+        bestTriangulate = std::fmin(bestTriangulate, msSince(start));
+
+        start = BenchClock::now();
+        buffers = ::extrude(profile, 1.f);
+        bestExtrude = std::fmin(bestExtrude, msSince(start));
+    }
+
+    // The triangles must cover exactly the area inside the outline and
+    // outside the holes
+    double coveredArea = 0;
+    for (std::size_t t = 0; t < triangles.size(); t += 3) {
+        const vec2_t& a = points[triangles[t]];
+        const vec2_t& b = points[triangles[t + 1]];
+        const vec2_t& c = points[triangles[t + 2]];
+        coveredArea += std::fabs(
+            (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x)) / 2.;
+    }
+    double profileArea = 0;
+    for (std::size_t r = 0; r <= profile.holes.size(); r++) {
+        const std::vector<vec2_t>& ringPoints = r == 0 ? profile.outer : profile.holes[r - 1];
+        double area = 0;
+        for (std::size_t i = 0, j = ringPoints.size() - 1; i < ringPoints.size(); j = i++) {
+            area += (ringPoints[j].x - ringPoints[i].x) * (ringPoints[i].y + ringPoints[j].y);
+        }
+        profileArea += (r == 0 ? 1 : -1) * std::fabs(area) / 2.;
+    }
+
+    printf("extrude: %zu points, %zu holes\n", points.size(), profile.holes.size());
+    printf("  triangulate: %zu triangles in %.2f ms (best of %d)\n",
+        triangles.size() / 3, bestTriangulate, runs);
+    printf("  extrude: %zu vertices, %zu triangles in %.2f ms (best of %d)\n",
+        buffers.pos.size(), buffers.indices.size() / 3, bestExtrude, runs);
+    printf("  area: profile %.4f, triangles %.4f (error %.2e)\n",
+        profileArea, coveredArea, std::fabs(profileArea - coveredArea) / profileArea);
+}
+
+void Bench::meshCreation()
+{
+    const int meshCount = 10000;
+    const int runs = 3;
+    // Generating 10k different gears would take far longer than uploading
+    // them, so a few shapes are generated up front and uploaded repeatedly,
+    // each copy as a mesh of its own.
+    const GearBlueprint shapes[] = {
+        {1., 4., 1., 20, 0.7},
+        {0.5, 2., 2., 10, 0.7},
+        {1.3, 2., 0.5, 10, 0.7},
+        {0.4, 1.5, 1., 12, 0.4},
+    };
+    std::vector<GearBuffersSeparate> buffers;
+    std::size_t vertices = 0, bytes = 0;
+    for (const GearBlueprint& shape : shapes) {
+        buffers.push_back(gear(shape));
+    }
+    for (int i = 0; i < meshCount; i++) {
+        const GearBuffersSeparate& mesh = buffers[i % buffers.size()];
+        vertices += mesh.pos.size();
+        bytes += mesh.totalSize() + mesh.indices.size() * sizeof(GLuint);
+    }
+    double megabytes = bytes / (1024. * 1024.);
+
+    printf("Creating %d meshes (%zu vertices, %.1f MB) in a new geometry arena (best of %d):\n",
+        meshCount, vertices, megabytes, runs);
+    for (int mode = 0; mode < 4; mode++) {
+        bool directStateAccess = mode & 1;
+        bool batch = mode & 2;
+        char name[64];
+        snprintf(name, sizeof(name), "%s%s",
+            directStateAccess ? "direct state access" : "bind to edit",
+            batch ? ", batched" : "");
+        if (directStateAccess && !GLAD_GL_ARB_direct_state_access) {
+            printf("  %-30s not supported\n", name);
+            continue;
+        }
+        double best = 1e30;
+        for (int run = 0; run < runs; run++) {
+            glFinish();
+            BenchClock::time_point start = BenchClock::now();
+            GeometryArena* arena = new GeometryArena(PLANAR_LAYOUT, directStateAccess);
+            if (batch) arena->beginBatch();
+            for (int i = 0; i < meshCount; i++) {
+                arena->add(buffers[i % buffers.size()]);
+            }
+            if (batch) arena->endBatch();
+            glFinish();
+            best = std::fmin(best, msSince(start));
+            delete arena;
+        }
+        printf("  %-30s %9.2f ms (%.2f us per mesh, %.2f ms per MB)\n",
+            name, best, best * 1e3 / meshCount, best / megabytes);
+        fflush(stdout);
+    }
+}
+
+void Bench::submission(
+    const char* const* pathNames, int pathCount,
+    PrepareFunction prepare, SubmitFunction submit)
+{
+    const int gearCounts[] = {1000, 10000, 100000};
+    const int warmupFrames = 3;
+    const int frames = 20;
+
+    printf("CPU time to submit one frame (average of %d frames):\n", frames);
+    for (int gears : gearCounts) {
+        MeshCache meshes;
+        std::vector<ThreeDimensionalObject> objects;
+        addGearField(objects, meshes, gears);
+
+        for (int path = 0; path < pathCount; path++) {
+            prepare(objects, path);
+            for (int i = 0; i < warmupFrames; i++) {
+                submit(objects, meshes, path);
+                glFinish();
+            }
+            double total = 0;
+            for (int i = 0; i < frames; i++) {
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                BenchClock::time_point start = BenchClock::now();
+                submit(objects, meshes, path);
+                total += msSince(start);
+                // Let the GPU catch up, so that it doesn't stall the next
+                // frame's submission
+                glFinish();
+            }
+            printf("  %6d gears, %-20s %9.3f ms (%6.1f ns per gear)\n",
+                gears, pathNames[path], total / frames,
+                total / frames * 1e6 / gears);
+            fflush(stdout);
+        }
+    }
+}
+
+void Bench::vertexLayouts(PrepareFunction prepare, SubmitFunction submit, int path)
+{
+    const VertexLayout* layouts[] = {&PLANAR_LAYOUT, &INTERLEAVED_LAYOUT, &MIXED_LAYOUT};
+    const int gears = 2000;
+    const int warmupFrames = 3;
+    const int frames = 20;
+
+    // Draw into a single pixel, so that the time is spent fetching and
+    // transforming vertices rather than shading fragments. Turning the
+    // rasterizer off instead lets some implementations skip the vertex
+    // shader altogether.
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glViewport(0, 0, 1, 1);
+
+    printf("Time to draw %d gears into one pixel (average of %d frames):\n",
+        gears, frames);
+    for (const VertexLayout* layout : layouts) {
+        MeshCache meshes(*layout);
+        std::vector<ThreeDimensionalObject> objects;
+        addGearField(objects, meshes, gears);
+        std::size_t vertices = 0;
+        for (const ThreeDimensionalObject& object : objects) {
+            vertices += object.getMesh()->indexCount;
+        }
+
+        prepare(objects, path);
+        for (int i = 0; i < warmupFrames; i++) {
+            submit(objects, meshes, path);
+        }
+        glFinish();
+        double total = 0;
+        for (int i = 0; i < frames; i++) {
+            // Timed up to glFinish, since software renderers don't count all
+            // of their work in timer queries
+            BenchClock::time_point start = BenchClock::now();
+            submit(objects, meshes, path);
+            glFinish();
+            total += msSince(start);
+        }
+        double ms = total / frames;
+        printf("  %-12s %2u streams, %9.3f ms (%7.1f M vertices/s, %7.1f MB/s)\n",
+            layout->name, layout->streamCount(), ms,
+            vertices / ms * 1e-3,
+            vertices * (double) layout->vertexSize() * 1e3 / ms / (1024. * 1024.));
+        fflush(stdout);
+    }
+
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+void Bench::visibilityBuffer(PrepareFunction prepare, SubmitFunction submit, int path,
+    ToggleFunction useVisibilityBuffer)
+{
+    const int teethCounts[] = {10, 40, 160, 640};
+    const int gears = 300;
+    const int warmupFrames = 3;
+    const int frames = 10;
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    printf("Time to draw %d gears at %dx%d, forward and with a visibility buffer (average of %d frames):\n",
+        gears, viewport[2], viewport[3], frames);
+    for (int teeth : teethCounts) {
+        MeshCache meshes;
+        std::vector<ThreeDimensionalObject> objects;
+        addGearField(objects, meshes, gears, teeth);
+        std::size_t triangles = 0;
+        for (const ThreeDimensionalObject& object : objects) {
+            triangles += object.getMesh()->indexCount / 3;
+        }
+
+        double ms[2];
+        for (int visibility = 0; visibility < 2; visibility++) {
+            useVisibilityBuffer(visibility);
+            prepare(objects, path);
+            for (int i = 0; i < warmupFrames; i++) {
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                submit(objects, meshes, path);
+            }
+            glFinish();
+            double total = 0;
+            for (int i = 0; i < frames; i++) {
+                // Timed up to glFinish, since software renderers don't count
+                // all of their work in timer queries
+                BenchClock::time_point start = BenchClock::now();
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                submit(objects, meshes, path);
+                glFinish();
+                total += msSince(start);
+            }
+            ms[visibility] = total / frames;
+        }
+        printf("  %4d teeth, %8zu triangles: forward %9.3f ms, visibility buffer %9.3f ms (%.2fx)\n",
+            teeth, triangles, ms[0], ms[1], ms[0] / ms[1]);
+        fflush(stdout);
+    }
+    useVisibilityBuffer(false);
+}
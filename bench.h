@@ -0,0 +1,44 @@
+#pragma once
+
+#include "3dobject.h"
+#include "mesh.h"
+#include <vector>
+
+// Benchmarks, selected with command-line options. Each one prints its
+// results to stdout.
+namespace Bench {
+    // Triangulate and extrude a profile with 100k+ points
+    void extrude();
+
+    // Time adding 10k meshes to a new geometry arena, one at a time and in one
+    // batch, with the GL 3.3 bind-to-edit path and, where supported, with
+    // direct state access. Needs a current OpenGL context.
+    void meshCreation();
+
+    // Called with a list of objects and the index of a render path
+    typedef void (*PrepareFunction)(
+        const std::vector<ThreeDimensionalObject>& objects, int path);
+    typedef void (*SubmitFunction)(
+        const std::vector<ThreeDimensionalObject>& objects,
+        const MeshCache& meshes, int path);
+    // Time the CPU side of submitting one frame with each render path, at 1k,
+    // 10k and 100k gears. prepare sets up a path for a list of objects, and
+    // is not timed; submit issues one frame's draw calls. Needs a current
+    // OpenGL context.
+    void submission(
+        const char* const* pathNames, int pathCount,
+        PrepareFunction prepare, SubmitFunction submit);
+    // Time vertex processing with each vertex layout, by drawing a field of
+    // gears into one pixel with the given render path. Needs a current OpenGL
+    // context.
+    void vertexLayouts(PrepareFunction prepare, SubmitFunction submit, int path);
+
+    // Switches the visibility buffer on or off for the following prepare
+    // and submit calls
+    typedef void (*ToggleFunction)(bool enabled);
+    // Time drawing a field of gears with ever more teeth, and so ever smaller
+    // triangles, with forward rendering and with a visibility buffer, with
+    // the given render path. Needs a current OpenGL context.
+    void visibilityBuffer(PrepareFunction prepare, SubmitFunction submit, int path,
+        ToggleFunction useVisibilityBuffer);
+}
@@ -0,0 +1,34 @@
+#version 330 core
+// Draws the box from boxMin to boxMax as 12 triangles, made from
+// gl_VertexID, so that no vertex buffer is needed. Used for occlusion
+// queries, with colour and depth writes turned off.
+
+// Laid out as the Frame block in default.vert
+layout(std140) uniform Frame {
+	mat4 projView;
+	vec3 lightPos;
+	float zoom;
+	float time;
+};
+
+uniform vec3 boxMin;
+uniform vec3 boxMax;
+
+// Corners of each face, counter-clockwise from outside. Bit 0 of a corner
+// picks x from boxMax instead of boxMin, bit 1 y, and bit 2 z.
+const int corners[36] = int[36](
+	4, 6, 2, 4, 2, 0,
+	1, 3, 7, 1, 7, 5,
+	0, 1, 5, 0, 5, 4,
+	6, 7, 3, 6, 3, 2,
+	2, 3, 1, 2, 1, 0,
+	4, 5, 7, 4, 7, 6
+);
+
+void main() {
+	int corner = corners[gl_VertexID];
+	vec3 select = vec3(corner & 1, (corner >> 1) & 1, (corner >> 2) & 1);
+	vec4 screenPos = projView * vec4(mix(boxMin, boxMax, select), 1.);
+	screenPos.w *= zoom;
+	gl_Position = screenPos;
+}
@@ -0,0 +1,213 @@
+#include "culling.h"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+// The AVX2 version is compiled for AVX2 on its own, and only used when the
+// CPU supports it, so the rest of the program doesn't have to require AVX2.
+#define CULL_AVX2
+#include <immintrin.h>
+#endif
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define CULL_SSE
+#include <xmmintrin.h>
+#endif
+
+// The arrays are padded to a multiple of this many spheres
+#define SPHERE_BLOCK 8
+
+Frustum Frustum::fromMatrix(const glm::mat4& m)
+{
+    // Gribb & Hartmann: each plane is the last row of the matrix plus or
+    // minus one of the others. glm matrices are indexed [column][row].
+    Frustum frustum;
+    for (int i = 0; i < 3; i++) {
+        for (int side = 0; side < 2; side++) {
+            float sign = side ? -1.f : 1.f;
+            float* plane = frustum.planes[i * 2 + side];
+            for (int column = 0; column < 4; column++) {
+                plane[column] = m[column][3] + sign * m[column][i];
+            }
+            float length = std::sqrt(
+                plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+            for (int column = 0; column < 4; column++) {
+                plane[column] /= length;
+            }
+        }
+    }
+    return frustum;
+}
+
+Frustum Frustum::everything()
+{
+    Frustum frustum;
+    for (float* plane : frustum.planes) {
+        plane[0] = plane[1] = plane[2] = 0.f;
+        plane[3] = 1.f;
+    }
+    return frustum;
+}
+
+float boundingRadius(const ThreeDimensionalObject& object)
+{
+    // The mesh is centred on the object's position, and only rotated about
+    // it, so the sphere around the scaled mesh holds every frame
+    const vec3_t& scale = object.scale;
+    float maxScale = std::fmax(std::fmax(std::fabs(scale.x), std::fabs(scale.y)), std::fabs(scale.z));
+    return object.getMesh()->radius * maxScale;
+}
+
+void BoundingSpheres::update(const std::vector<ThreeDimensionalObject>& objects, std::size_t first)
+{
+    count = objects.size();
+    std::size_t padded = (count + SPHERE_BLOCK - 1) / SPHERE_BLOCK * SPHERE_BLOCK;
+    x.resize(first);
+    y.resize(first);
+    z.resize(first);
+    radius.resize(first);
+    x.resize(padded, 0.f);
+    y.resize(padded, 0.f);
+    z.resize(padded, 0.f);
+    // A negative radius puts a sphere outside every plane
+    radius.resize(padded, -1e30f);
+    for (std::size_t i = first; i < count; i++) {
+        const ThreeDimensionalObject& object = objects[i];
+        x[i] = object.position.x;
+        y[i] = object.position.y;
+        z[i] = object.position.z;
+        radius[i] = boundingRadius(object);
+    }
+}
+
+// Each version tests blocks * SPHERE_BLOCK spheres, writing the indices of
+// the visible ones to out, and returns the new end of out.
+
+#ifndef CULL_SSE
+static GLuint* cullScalar(
+    const Frustum& frustum, const float* x, const float* y, const float* z, const float* radius,
+    std::size_t blocks, GLuint* out)
+{
+    for (std::size_t i = 0; i < blocks * SPHERE_BLOCK; i++) {
+        bool inside = true;
+        for (const float* plane : frustum.planes) {
+            float distance = plane[0] * x[i] + plane[1] * y[i] + plane[2] * z[i] + plane[3];
+            inside = inside && distance >= -radius[i];
+        }
+        *out = i;
+        out += inside;
+    }
+    return out;
+}
+#endif
+
+#ifdef CULL_SSE
+static GLuint* cullSSE(
+    const Frustum& frustum, const float* x, const float* y, const float* z, const float* radius,
+    std::size_t blocks, GLuint* out)
+{
+    __m128 planes[6][4];
+    for (int p = 0; p < 6; p++) {
+        for (int c = 0; c < 4; c++) {
+            planes[p][c] = _mm_set1_ps(frustum.planes[p][c]);
+        }
+    }
+    const __m128 zero = _mm_setzero_ps();
+    for (std::size_t i = 0; i < blocks * SPHERE_BLOCK; i += 4) {
+        __m128 sx = _mm_loadu_ps(x + i);
+        __m128 sy = _mm_loadu_ps(y + i);
+        __m128 sz = _mm_loadu_ps(z + i);
+        // -radius, so that distance >= -radius
+        __m128 negRadius = _mm_sub_ps(zero, _mm_loadu_ps(radius + i));
+        __m128 inside = _mm_cmpeq_ps(zero, zero);
+        for (int p = 0; p < 6; p++) {
+            __m128 distance = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(planes[p][0], sx), _mm_mul_ps(planes[p][1], sy)),
+                _mm_add_ps(_mm_mul_ps(planes[p][2], sz), planes[p][3]));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negRadius));
+        }
+        int mask = _mm_movemask_ps(inside);
+        for (int j = 0; j < 4; j++) {
+            *out = i + j;
+            out += (mask >> j) & 1;
+        }
+    }
+    return out;
+}
+#endif
+
+#ifdef CULL_AVX2
+__attribute__((target("avx2")))
+static GLuint* cullAVX2(
+    const Frustum& frustum, const float* x, const float* y, const float* z, const float* radius,
+    std::size_t blocks, GLuint* out)
+{
+    __m256 planes[6][4];
+    for (int p = 0; p < 6; p++) {
+        for (int c = 0; c < 4; c++) {
+            planes[p][c] = _mm256_set1_ps(frustum.planes[p][c]);
+        }
+    }
+    const __m256 zero = _mm256_setzero_ps();
+    for (std::size_t i = 0; i < blocks * SPHERE_BLOCK; i += 8) {
+        __m256 sx = _mm256_loadu_ps(x + i);
+        __m256 sy = _mm256_loadu_ps(y + i);
+        __m256 sz = _mm256_loadu_ps(z + i);
+        __m256 negRadius = _mm256_sub_ps(zero, _mm256_loadu_ps(radius + i));
+        __m256 inside = _mm256_cmp_ps(zero, zero, _CMP_EQ_OQ);
+        for (int p = 0; p < 6; p++) {
+            __m256 distance = _mm256_add_ps(
+                _mm256_add_ps(_mm256_mul_ps(planes[p][0], sx), _mm256_mul_ps(planes[p][1], sy)),
+                _mm256_add_ps(_mm256_mul_ps(planes[p][2], sz), planes[p][3]));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negRadius, _CMP_GE_OQ));
+        }
+        int mask = _mm256_movemask_ps(inside);
+        for (int j = 0; j < 8; j++) {
+            *out = i + j;
+            out += (mask >> j) & 1;
+        }
+    }
+    return out;
+}
+
+static bool hasAVX2()
+{
+    static bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+#endif
+
+void BoundingSpheres::cull(const Frustum& frustum, std::vector<GLuint>& visible) const
+{
+    // Every index is written, and only the visible ones kept, so there has
+    // to be room for all of them
+    visible.resize(x.size());
+    if (x.empty()) return;
+    GLuint* out = visible.data();
+    std::size_t blocks = x.size() / SPHERE_BLOCK;
+#if defined(CULL_AVX2)
+    if (hasAVX2()) {
+        out = cullAVX2(frustum, x.data(), y.data(), z.data(), radius.data(), blocks, out);
+    } else
+#endif
+    {
+#if defined(CULL_SSE)
+        out = cullSSE(frustum, x.data(), y.data(), z.data(), radius.data(), blocks, out);
+#else
+        out = cullScalar(frustum, x.data(), y.data(), z.data(), radius.data(), blocks, out);
+#endif
+    }
+    visible.resize(out - visible.data());
+}
+
+const char* BoundingSpheres::instructionSet()
+{
+#if defined(CULL_AVX2)
+    if (hasAVX2()) return "AVX2";
+#endif
+#if defined(CULL_SSE)
+    return "SSE";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "glad.h"
+#include "3dobject.h"
+#include <glm/glm.hpp>
+#include <vector>
+
+// The six planes of a view frustum, as (a, b, c, d), with a point (x, y, z)
+// inside a plane when ax + by + cz + d >= 0. The normals are unit length, so
+// that the result is the distance from the plane.
+struct Frustum {
+    float planes[6][4];
+
+    // Extract the planes from a projection * view matrix
+    static Frustum fromMatrix(const glm::mat4& projView);
+    // A frustum which everything is inside
+    static Frustum everything();
+};
+
+// Radius of a sphere around an object's position which holds its mesh,
+// however far the mesh has turned
+float boundingRadius(const ThreeDimensionalObject& object);
+
+// World space bounding spheres of a list of objects, stored as a structure
+// of arrays so that they can be tested against the frustum several at a
+// time. Uses AVX2 to test 8 at a time where the CPU has it, otherwise SSE to
+// test 4 at a time, or plain C++ on other architectures.
+class BoundingSpheres {
+    private:
+    // Padded to a multiple of 8 with spheres which are never visible
+    std::vector<float> x, y, z, radius;
+    std::size_t count;
+
+    public:
+    BoundingSpheres() : count(0) {}
+
+    // Calculate the bounding spheres of the objects from first on. Only needs
+    // to be called again when objects are added, removed or moved; when they
+    // are only added, first can skip the ones calculated before.
+    void update(const std::vector<ThreeDimensionalObject>& objects, std::size_t first = 0);
+    // Set visible to the indices, in order, of the objects whose spheres are
+    // at least partly inside the frustum
+    void cull(const Frustum& frustum, std::vector<GLuint>& visible) const;
+
+    std::size_t size() const { return count; }
+    // Name of the instruction set cull() uses
+    static const char* instructionSet();
+};
@@ -1,13 +1,22 @@
 #version 330 core
+// With DEPTH_ONLY defined, nothing is written but depth, or, with
+// VISIBILITY_BUFFER as well, what resolve.frag needs to find the triangle
+// again. Otherwise, the objects are shaded grey, or lit with LIT, or show
+// their triangles with WIREFRAME. With CLUSTERED_LIGHTS, lit fragments are
+// also lit by the point lights of their cluster.
 
-uniform bool lit;
-uniform bool wireframe;
+#if defined(VISIBILITY_BUFFER)
+flat in int vInstance;
 
-// Calculated in the vertex shader
-in vec4 lightColour;
-in vec4 diffuse;
+// The instance plus one, so that 0 is left for pixels nothing covers, and
+// the triangle within its mesh
+out uvec2 FragIds;
+
+void main() {
+	FragIds = uvec2(uint(vInstance) + 1u, uint(gl_PrimitiveID));
+}
+#elif defined(WIREFRAME)
 in vec2 vBary;
-in float distanceFromCamera;
 
 out vec4 FragColor;
 
@@ -22,11 +31,75 @@ float gridFactor (vec2 vBC, float width, float feather) {
 }
 
 void main() {
-	vec4 grayShade = vec4(vec3(distanceFromCamera / 50.) + .25, 1.);
-	if (!wireframe) {
-		FragColor = mix(grayShade, lightColour, float(lit)) * diffuse;
-	} else {
-		FragColor.rg = vBary * step(0.75, max(vBary.x, vBary.y));
-		FragColor.rgb += (1.0 - gridFactor(vBary, 0.5, 0.5)) * float(wireframe);
+	// Blue is only ever added to, so it has to start from something
+	FragColor = vec4(0.);
+	FragColor.rg = vBary * step(0.75, max(vBary.x, vBary.y));
+	FragColor.rgb += 1.0 - gridFactor(vBary, 0.5, 0.5);
+}
+#elif defined(LIT)
+// Calculated in the vertex shader
+in vec4 lightColour;
+in vec4 diffuse;
+
+out vec4 FragColor;
+
+#ifdef CLUSTERED_LIGHTS
+// Laid out as LightUniforms in lights.h
+layout(std140) uniform Lights {
+	// Clusters per pixel across and down, and the scale and bias which turn
+	// the log of view depth into a slice
+	vec4 clusterScale;
+	ivec4 clusterCount;
+};
+// Two texels per light: position and radius, then colour
+uniform samplerBuffer lightData;
+// Offset and length of each cluster's list in lightIndices
+uniform usamplerBuffer clusters;
+uniform usamplerBuffer lightIndices;
+
+in vec3 vPosition;
+in vec3 vNormal;
+
+// Light from the point lights of the cluster this fragment is in
+vec3 pointLights() {
+	// gl_FragCoord.w is 1 / w, which is the view depth
+	vec3 coord = vec3(gl_FragCoord.xy * clusterScale.xy, log(1. / gl_FragCoord.w) * clusterScale.z + clusterScale.w);
+	ivec3 cluster = clamp(ivec3(coord), ivec3(0), clusterCount.xyz - 1);
+	uvec2 list = texelFetch(clusters, (cluster.z * clusterCount.y + cluster.y) * clusterCount.x + cluster.x).xy;
+	vec3 normal = normalize(vNormal);
+	vec3 total = vec3(0.);
+	for (uint i = 0u; i < list.y; i++) {
+		int light = int(texelFetch(lightIndices, int(list.x + i)).r);
+		vec4 positionRadius = texelFetch(lightData, light * 2);
+		vec3 toLight = positionRadius.xyz - vPosition;
+		float distance = length(toLight);
+		// Fades out smoothly to nothing at the radius
+		float falloff = clamp(1. - distance / positionRadius.w, 0., 1.);
+		float intensity = max(0., dot(normal, toLight / distance)) * falloff * falloff;
+		total += texelFetch(lightData, light * 2 + 1).rgb * intensity;
 	}
-}
\ No newline at end of file
+	return total;
+}
+#endif
+
+void main() {
+#ifdef CLUSTERED_LIGHTS
+	FragColor = (lightColour + vec4(pointLights(), 0.)) * diffuse;
+#else
+	FragColor = lightColour * diffuse;
+#endif
+}
+#elif !defined(DEPTH_ONLY)
+in vec4 diffuse;
+in float distanceFromCamera;
+
+out vec4 FragColor;
+
+void main() {
+	vec4 grayShade = vec4(vec3(distanceFromCamera / 50.) + .25, 1.);
+	FragColor = grayShade * diffuse;
+}
+#else
+void main() {
+}
+#endif
\ No newline at end of file
@@ -1,36 +1,168 @@
 #version 330 core
+// INSTANCED, INSTANCES_SSBO, INSTANCE_INDICES, MULTIDRAW, DRAW_PARAMETERS, DEPTH_ONLY,
+// VISIBILITY_BUFFER and CLUSTERED_LIGHTS may be defined by the program when
+// it loads this shader. VISIBILITY_BUFFER comes with DEPTH_ONLY and
+// INSTANCED. Without DEPTH_ONLY, one of LIT or WIREFRAME may be defined as
+// well, to shade the objects lit, or show their triangles, instead of grey.
+#ifdef INSTANCES_SSBO
+#extension GL_ARB_shader_storage_buffer_object : require
+#endif
+#ifdef DRAW_PARAMETERS
+#extension GL_ARB_shader_draw_parameters : require
+#endif
 
-uniform vec3 lightPos;
-uniform vec3 colour;
-uniform mat4 projView;
-uniform mat4 model;
-uniform float zoom;
+// Uniform blocks are laid out as the structs in uniforms.h, and bound at the
+// same binding points in every program.
+layout(std140) uniform Frame {
+	mat4 projView;
+	vec3 lightPos;
+	float zoom;
+	// Seconds of animation; each gear turns at angleMultiply * 100 degrees/second
+	float time;
+};
+
+#ifdef INSTANCED
+// Index of the first instance of the current draw call
+uniform int instanceBase;
+#ifdef INSTANCE_INDICES
+// Indices of the instances drawn this frame; instanceBase and gl_InstanceID
+// index this list instead
+#ifdef INSTANCES_SSBO
+layout(std430) readonly buffer InstanceIndices {
+	uint instanceIndices[];
+};
+#else
+uniform usamplerBuffer instanceIndices;
+#endif
+#endif
+#ifdef INSTANCES_SSBO
+struct Instance {
+	vec4 positionAngleMultiply;
+	vec4 colourAngleAdd;
+	vec4 scale;
+};
+layout(std430) readonly buffer Instances {
+	Instance instances[];
+};
+#else
+// Three RGBA texels per instance, laid out like the Instance struct above
+uniform samplerBuffer instances;
+#endif
+#else
+// Same layout as InstanceData
+layout(std140) uniform Object {
+	vec4 positionAngleMultiply;
+	vec4 colourAngleAdd;
+	// Size relative to the canonical (unit) gear shape the mesh was built from
+	vec4 scale;
+} object;
+#endif
 
 layout(location = 0) in vec3 aPos;
+#ifndef DEPTH_ONLY
 layout(location = 1) in vec3 aNrm;
 layout(location = 2) in vec2 aBary;
+#endif
+#if defined(MULTIDRAW) && !defined(DRAW_PARAMETERS)
+// Per-instance attribute holding 0, 1, 2..., so that it gives each draw's
+// base instance, which is the index of its object
+layout(location = 3) in uint aDrawID;
+#endif
 
+#if defined(WIREFRAME)
+out vec2 vBary;
+#elif defined(LIT)
 out vec4 diffuse;
 out vec4 lightColour;
-out vec2 vBary;
+#ifdef CLUSTERED_LIGHTS
+// World space, for lighting each fragment by the lights of its cluster
+out vec3 vPosition;
+out vec3 vNormal;
+#endif
+#elif !defined(DEPTH_ONLY)
+out vec4 diffuse;
 out float distanceFromCamera;
+#endif
+#ifdef VISIBILITY_BUFFER
+// Identifies the object to the resolve pass, through the instance data
+flat out int vInstance;
+#endif
 // out vec4 gl_Position;
+// The colour pass after a depth-only pass tests for equal depth, so both
+// must compute exactly the same positions
+invariant gl_Position;
 
 void main() {
+#ifdef INSTANCED
+#if defined(MULTIDRAW) && defined(DRAW_PARAMETERS)
+	int instance = gl_BaseInstanceARB;
+#elif defined(MULTIDRAW)
+	int instance = int(aDrawID);
+#elif defined(INSTANCE_INDICES) && defined(INSTANCES_SSBO)
+	int instance = int(instanceIndices[instanceBase + gl_InstanceID]);
+#elif defined(INSTANCE_INDICES)
+	int instance = int(texelFetch(instanceIndices, instanceBase + gl_InstanceID).r);
+#else
+	int instance = instanceBase + gl_InstanceID;
+#endif
+#ifdef VISIBILITY_BUFFER
+	vInstance = instance;
+#endif
+#ifdef INSTANCES_SSBO
+	vec4 positionAngleMultiply = instances[instance].positionAngleMultiply;
+	vec4 colourAngleAdd = instances[instance].colourAngleAdd;
+	vec3 scale = instances[instance].scale.xyz;
+#else
+	vec4 positionAngleMultiply = texelFetch(instances, instance * 3);
+	vec4 colourAngleAdd = texelFetch(instances, instance * 3 + 1);
+	vec3 scale = texelFetch(instances, instance * 3 + 2).xyz;
+#endif
+#else
+	vec4 positionAngleMultiply = object.positionAngleMultiply;
+	vec4 colourAngleAdd = object.colourAngleAdd;
+	vec3 scale = object.scale.xyz;
+#endif
+	vec3 position = positionAngleMultiply.xyz;
+	float angleMultiply = positionAngleMultiply.w;
+	vec3 colour = colourAngleAdd.rgb;
+	float angleAdd = colourAngleAdd.w;
+	// translate(position) * rotate(angle, Z)
+	float angle = radians(angleMultiply * time * 100. + angleAdd);
+	float c = cos(angle), s = sin(angle);
+	mat4 model = mat4(
+		c, s, 0., 0.,
+		-s, c, 0., 0.,
+		0., 0., 1., 0.,
+		position, 1.);
 	// NOTE: This is per-vertex lighting. It's faster, but doesn't look as good
 	// as per-pixel lighting. However, since the gears have no smooth faces,
 	// per-pixel lighting is really not necessary.
-	vec3 vPos = (model * vec4(aPos, 1.)).xyz;
+	vec4 scaledPos = vec4(aPos * scale, 1.);
+#if !defined(DEPTH_ONLY) && !defined(WIREFRAME)
+	diffuse = vec4(colour, 1.);
+#endif
+#ifdef LIT
+	vec3 vPos = (model * scaledPos).xyz;
 	vec3 lightDiff = normalize(lightPos - vPos);
 	mat3 rotation = mat3(model[0][0], model[0][1], model[0][2], model[1][0], model[1][1], model[1][2], model[2][0], model[2][1], model[2][2]);
 	// vNrm = rotation * aNrm;
-	vec3 vNrm = rotation * aNrm;
+	// Normals are transformed by the inverse transpose of the scale, since the
+	// scale may be non-uniform. The inverse transpose of a diagonal matrix is
+	// just its reciprocal.
+	vec3 vNrm = normalize(rotation * (aNrm / scale));
 	float lightIntensity = max(0, dot(lightDiff, vNrm));
-	diffuse = vec4(colour, 1.);
 	lightColour = vec4(vec3(lightIntensity), 1.);
-	vec4 screenPos = projView * model * vec4(aPos, 1.);
-	distanceFromCamera = screenPos.z;
+#ifdef CLUSTERED_LIGHTS
+	vPosition = vPos;
+	vNormal = vNrm;
+#endif
+#endif
+	vec4 screenPos = projView * model * scaledPos;
+#if defined(WIREFRAME)
 	vBary = aBary;
+#elif !defined(LIT) && !defined(DEPTH_ONLY)
+	distanceFromCamera = screenPos.z;
+#endif
 	screenPos.w *= zoom;
 	gl_Position = screenPos;
 	// gl_Position = vec4(aPos, zoom);
@@ -0,0 +1,120 @@
+#include "depthprepass.h"
+
+#include "glad.h"
+
+// Overdraw above which automatic mode starts drawing a depth-only pass, and
+// below which it stops again. The gap between them keeps it from switching
+// back and forth every frame. The pass costs a second trip through the
+// vertex shader for every gear, which on llvmpipe still outweighed the
+// shading saved at an overdraw of 1.6, even at 4K.
+#define ENABLE_OVERDRAW 2.f
+#define DISABLE_OVERDRAW 1.6f
+// Without a depth-only pass, one is drawn every this many frames anyway, to
+// measure the pixels covered again
+#define PROBE_INTERVAL 30
+
+DepthPrepass::DepthPrepass(PrepassMode mode) :
+    current(nullptr), next(0), mode(mode), enabled(mode == PREPASS_ALWAYS),
+    pixelsCovered(0), framesSinceProbe(PROBE_INTERVAL), stats()
+{
+    for (Measurement& measurement : measurements) {
+        glGenQueries(1, &measurement.depthQuery);
+        glGenQueries(1, &measurement.colourQuery);
+        measurement.prepass = false;
+        measurement.pending = false;
+    }
+}
+
+DepthPrepass::~DepthPrepass()
+{
+    for (Measurement& measurement : measurements) {
+        glDeleteQueries(1, &measurement.depthQuery);
+        glDeleteQueries(1, &measurement.colourQuery);
+    }
+}
+
+void DepthPrepass::collect()
+{
+    // Oldest first, since the GPU finishes them in order
+    for (int i = 0; i < PREPASS_MEASUREMENT_FRAMES; i++) {
+        Measurement& measurement = measurements[(next + i) % PREPASS_MEASUREMENT_FRAMES];
+        if (!measurement.pending) continue;
+        // The colour pass ends each frame, so its query is the last to finish
+        GLuint available = 0;
+        glGetQueryObjectuiv(measurement.colourQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) break;
+        measurement.pending = false;
+
+        GLuint colourSamples, fragments;
+        glGetQueryObjectuiv(measurement.colourQuery, GL_QUERY_RESULT, &colourSamples);
+        if (measurement.prepass) {
+            // The depth-only pass lets through the fragments which the colour
+            // pass would have shaded on its own
+            glGetQueryObjectuiv(measurement.depthQuery, GL_QUERY_RESULT, &fragments);
+            pixelsCovered = colourSamples;
+        } else {
+            fragments = colourSamples;
+        }
+        stats.fragmentsShaded = colourSamples;
+        stats.overdraw = pixelsCovered ? (float) fragments / pixelsCovered : 0.f;
+    }
+}
+
+bool DepthPrepass::beginFrame()
+{
+    collect();
+    if (mode == PREPASS_AUTO) {
+        if (enabled && stats.overdraw < DISABLE_OVERDRAW) {
+            enabled = false;
+        } else if (!enabled && stats.overdraw > ENABLE_OVERDRAW) {
+            enabled = true;
+        }
+    }
+
+    // Measure this frame, unless every query is still waiting for the GPU
+    Measurement& measurement = measurements[next];
+    current = measurement.pending ? nullptr : &measurement;
+    bool prepass = enabled;
+    if (current) {
+        if (mode == PREPASS_AUTO && !enabled && framesSinceProbe >= PROBE_INTERVAL) {
+            prepass = true;
+        }
+        current->prepass = prepass;
+        next = (next + 1) % PREPASS_MEASUREMENT_FRAMES;
+    }
+    framesSinceProbe = prepass ? 0 : framesSinceProbe + 1;
+    stats.enabled = prepass;
+    return prepass;
+}
+
+void DepthPrepass::beginDepthPass()
+{
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    if (current) glBeginQuery(GL_SAMPLES_PASSED, current->depthQuery);
+}
+
+void DepthPrepass::beginColourPass()
+{
+    if (stats.enabled) {
+        if (current) glEndQuery(GL_SAMPLES_PASSED);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        // Only the nearest fragment of each pixel is left to shade, and the
+        // depth buffer already holds everything
+        glDepthFunc(GL_EQUAL);
+        glDepthMask(GL_FALSE);
+    }
+    if (current) glBeginQuery(GL_SAMPLES_PASSED, current->colourQuery);
+}
+
+void DepthPrepass::endFrame()
+{
+    if (current) {
+        glEndQuery(GL_SAMPLES_PASSED);
+        current->pending = true;
+        current = nullptr;
+    }
+    if (stats.enabled) {
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+    }
+}
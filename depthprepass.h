@@ -0,0 +1,81 @@
+#pragma once
+
+#include "glad.h"
+
+// Frames of measurements which can be waiting for the GPU at once. Frames
+// beyond that go unmeasured.
+#define PREPASS_MEASUREMENT_FRAMES 4
+
+// When the scene's depth is drawn before its colour
+enum PrepassMode {
+    PREPASS_NEVER,
+    // Whenever the measured overdraw is high enough to pay for it
+    PREPASS_AUTO,
+    PREPASS_ALWAYS
+};
+
+struct DepthPrepassStats {
+    // Whether the last frame had a depth-only pass
+    bool enabled;
+    // Fragments which pass the depth test without a depth-only pass, per
+    // pixel covered, as last measured. 0 until the first measurement.
+    float overdraw;
+    // Fragments shaded by the last measured colour pass
+    unsigned int fragmentsShaded;
+};
+
+// Draws the depth of the scene in a pass of its own, with a shader which
+// only transforms positions, so that the colour pass after it can test for
+// equal depth, and shade each pixel once.
+//
+// Whether that pays off depends on the overdraw, which is measured with
+// GL_SAMPLES_PASSED queries. A colour pass on its own counts the fragments
+// shaded; after a depth-only pass, that pass counts them instead, and the
+// colour pass counts the pixels covered. The results are collected once the
+// GPU has them, so the CPU never waits. In automatic mode, frames without a
+// depth-only pass have one every so often, to measure the pixels covered.
+class DepthPrepass {
+    private:
+    // The queries of one frame
+    struct Measurement {
+        GLuint depthQuery;
+        GLuint colourQuery;
+        bool prepass;
+        bool pending;
+    };
+    Measurement measurements[PREPASS_MEASUREMENT_FRAMES];
+    // The measurement being made this frame, or nullptr
+    Measurement* current;
+    // Oldest measurement, and the next one to start
+    int next;
+    PrepassMode mode;
+    bool enabled;
+    // Pixels covered, as last measured
+    unsigned int pixelsCovered;
+    unsigned int framesSinceProbe;
+    DepthPrepassStats stats;
+
+    void collect();
+
+    public:
+    DepthPrepass(PrepassMode mode);
+
+    // Prevent copying! See: https://www.khronos.org/opengl/wiki/Common_Mistakes#RAII_and_hidden_destructor_calls
+    DepthPrepass(DepthPrepass& other) = delete;
+    DepthPrepass& operator= (DepthPrepass& other) = delete;
+
+    ~DepthPrepass();
+
+    // Collect the measurements which are ready, and decide whether this
+    // frame has a depth-only pass. If it does, draw it between
+    // beginDepthPass() and beginColourPass(). Either way, draw the colour
+    // pass between beginColourPass() and endFrame().
+    bool beginFrame();
+    void beginDepthPass();
+    void beginColourPass();
+    // Put the depth test back to normal
+    void endFrame();
+
+    const DepthPrepassStats& lastFrame() const { return stats; }
+    PrepassMode getMode() const { return mode; }
+};
@@ -0,0 +1,152 @@
+#include "dynamicresolution.h"
+
+#include "glad.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+// Lowest fraction of the window's width and height rendered at
+#define MIN_SCALE .25f
+// Frames are aimed at this fraction of the budget, and the scale only
+// changes when one takes more than the budget, or less than LOWER_BAND of
+// it, so that small changes in frame time leave it alone
+#define TARGET_FRACTION .9
+#define LOWER_BAND .75
+// Fraction of the way to the scale a measurement asks for which is moved
+// at once. The measurements lag a few frames behind, so going all the way
+// would overshoot.
+#define DAMPING .5f
+
+DynamicResolution::DynamicResolution(double budgetMilliseconds) :
+    current(nullptr), next(0), windowWidth(0), windowHeight(0),
+    budget(budgetMilliseconds), scale(1.f), frameScale(0.f), stats()
+{
+    const char* renderer = (const char*) glGetString(GL_RENDERER);
+    cpuTiming = renderer && (strstr(renderer, "llvmpipe") || strstr(renderer, "softpipe") ||
+        strstr(renderer, "SwiftShader"));
+    for (Measurement& measurement : measurements) {
+        glGenQueries(1, &measurement.query);
+        measurement.scale = 1.f;
+        measurement.pending = false;
+    }
+    glGenFramebuffers(1, &framebuffer);
+    glGenRenderbuffers(1, &colourBuffer);
+    glGenRenderbuffers(1, &depthBuffer);
+    stats.scale = scale;
+}
+
+DynamicResolution::~DynamicResolution()
+{
+    for (Measurement& measurement : measurements) {
+        glDeleteQueries(1, &measurement.query);
+    }
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteRenderbuffers(1, &colourBuffer);
+    glDeleteRenderbuffers(1, &depthBuffer);
+}
+
+void DynamicResolution::collect()
+{
+    // Oldest first, since the GPU finishes them in order
+    for (int i = 0; i < RESOLUTION_MEASUREMENT_FRAMES; i++) {
+        Measurement& measurement = measurements[(next + i) % RESOLUTION_MEASUREMENT_FRAMES];
+        if (!measurement.pending) continue;
+        GLuint available = 0;
+        glGetQueryObjectuiv(measurement.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) break;
+        measurement.pending = false;
+
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(measurement.query, GL_QUERY_RESULT, &nanoseconds);
+        adjust(nanoseconds * 1e-6, measurement.scale);
+    }
+}
+
+void DynamicResolution::adjust(double milliseconds, float measuredScale)
+{
+    stats.milliseconds = milliseconds;
+    if (milliseconds <= 0. || (milliseconds <= budget && milliseconds >= budget * LOWER_BAND)) {
+        return;
+    }
+    // Most of the time goes on pixels, which there are scale squared as many
+    // of
+    float wanted = measuredScale * (float) std::sqrt(budget * TARGET_FRACTION / milliseconds);
+    wanted = std::min(std::max(wanted, MIN_SCALE), 1.f);
+    scale += (wanted - scale) * DAMPING;
+}
+
+void DynamicResolution::resize(GLint width, GLint height)
+{
+    windowWidth = width;
+    windowHeight = height;
+    // The same depth precision as the default framebuffer, which is bound,
+    // so that the depth tests come out the same
+    GLint depthBits = 24;
+    glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_DEPTH,
+        GL_FRAMEBUFFER_ATTACHMENT_DEPTH_SIZE, &depthBits);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, colourBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, depthBits <= 16 ? GL_DEPTH_COMPONENT16 : GL_DEPTH_COMPONENT24,
+        width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colourBuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "Dynamic resolution framebuffer is incomplete: 0x%x\n", status);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void DynamicResolution::beginFrame(int& width, int& height)
+{
+    if (width != windowWidth || height != windowHeight) {
+        resize(width, height);
+    }
+    if (cpuTiming) {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (frameScale > 0.f) {
+            adjust(std::chrono::duration<double, std::milli>(now - frameStart).count(), frameScale);
+        }
+        frameStart = now;
+        frameScale = scale;
+    } else {
+        collect();
+        // Measure this frame, unless every query is still waiting for the GPU
+        Measurement& measurement = measurements[next];
+        current = measurement.pending ? nullptr : &measurement;
+        if (current) {
+            current->scale = scale;
+            next = (next + 1) % RESOLUTION_MEASUREMENT_FRAMES;
+            glBeginQuery(GL_TIME_ELAPSED, current->query);
+        }
+    }
+
+    width = std::max(1, (int) std::lround(windowWidth * scale));
+    height = std::max(1, (int) std::lround(windowHeight * scale));
+    stats.scale = scale;
+    stats.width = width;
+    stats.height = height;
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, width, height);
+}
+
+void DynamicResolution::endFrame()
+{
+    if (current) {
+        glEndQuery(GL_TIME_ELAPSED);
+        current->pending = true;
+        current = nullptr;
+    }
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, stats.width, stats.height, 0, 0, windowWidth, windowHeight,
+        GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, windowWidth, windowHeight);
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "glad.h"
+#include <chrono>
+
+// Frames of timer queries which can be waiting for the GPU at once. Frames
+// beyond that go unmeasured.
+#define RESOLUTION_MEASUREMENT_FRAMES 4
+
+struct DynamicResolutionStats {
+    // Fraction of the window's width and height rendered at, last frame
+    float scale;
+    int width, height;
+    // Time of the last measured frame, in milliseconds
+    double milliseconds;
+};
+
+// Renders the scene into an offscreen framebuffer at a fraction of the
+// window's resolution, and scales it up to the window. The fraction follows
+// the GPU time of each frame, measured with GL_TIME_ELAPSED queries, so that
+// frames stay within a budget when the scene gets more expensive, and go
+// back to full resolution when it gets cheaper again.
+//
+// Software renderers do most of their rasterizing when the frame is
+// flushed, outside of any query; llvmpipe counts a few percent of the
+// frame. There, the GPU is the CPU, so the time from one frame to the next
+// is measured instead.
+//
+// The framebuffer is allocated at the size of the window, and only the
+// bottom-left part of it is rendered into, so changing the scale costs
+// nothing. The query results are collected once the GPU has them, so the
+// CPU never waits, and each frame's time is judged against the scale it
+// was rendered at.
+class DynamicResolution {
+    private:
+    struct Measurement {
+        GLuint query;
+        float scale;
+        bool pending;
+    };
+    Measurement measurements[RESOLUTION_MEASUREMENT_FRAMES];
+    // The measurement being made this frame, or nullptr
+    Measurement* current;
+    // Oldest measurement, and the next one to start
+    int next;
+    GLuint framebuffer;
+    GLuint colourBuffer, depthBuffer;
+    // Size of the window, which the framebuffer is allocated at
+    GLint windowWidth, windowHeight;
+    // Milliseconds of GPU time a frame may take
+    double budget;
+    float scale;
+    // Whether frames are timed on the CPU, and the start and scale of the
+    // last one
+    bool cpuTiming;
+    std::chrono::steady_clock::time_point frameStart;
+    float frameScale;
+    DynamicResolutionStats stats;
+
+    void collect();
+    // Move the scale towards what the time of a frame rendered at
+    // measuredScale asks for
+    void adjust(double milliseconds, float measuredScale);
+    void resize(GLint width, GLint height);
+
+    public:
+    DynamicResolution(double budgetMilliseconds);
+
+    // Prevent copying! See: https://www.khronos.org/opengl/wiki/Common_Mistakes#RAII_and_hidden_destructor_calls
+    DynamicResolution(DynamicResolution& other) = delete;
+    DynamicResolution& operator= (DynamicResolution& other) = delete;
+
+    ~DynamicResolution();
+
+    // Collect the measurements which are ready, pick this frame's
+    // resolution, and bind the framebuffer with the viewport set to it.
+    // width and height are the size of the window, in pixels, and are set
+    // to the size rendered at.
+    void beginFrame(int& width, int& height);
+    // Scale the frame up into the default framebuffer, and put the viewport
+    // back
+    void endFrame();
+
+    const DynamicResolutionStats& lastFrame() const { return stats; }
+};
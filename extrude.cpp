@@ -0,0 +1,113 @@
+#include "extrude.h"
+
+#include "gear.h"
+#include "triangulate.h"
+#include "vector.h"
+#include <cmath>
+#include <vector>
+
+// Twice the signed area of a ring; positive if the ring is counter-clockwise
+static float ringArea(const std::vector<vec2_t>& ring)
+{
+    float sum = 0;
+    for (std::size_t i = 0, j = ring.size() - 1; i < ring.size(); j = i++) {
+        sum += (ring[j].x - ring[i].x) * (ring[i].y + ring[j].y);
+    }
+    return sum;
+}
+
+// Each cap triangle gets its own three vertices, since the barycentric
+// coordinates used for the wireframe differ per triangle.
+static void addCap(
+    GearBuffersSeparate& buff,
+    const std::vector<vec2_t>& points,
+    const std::vector<unsigned int>& triangles,
+    GLfloat z, bool front)
+{
+    const vec3_t normal = {{0., 0., front ? 1.f : -1.f}};
+    const vec2_t bary[3] = {{{1., 0.}}, {{0., 1.}}, {{0., 0.}}};
+    for (std::size_t t = 0; t < triangles.size(); t += 3) {
+        const vec2_t& a = points[triangles[t]];
+        const vec2_t& b = points[triangles[t + 1]];
+        const vec2_t& c = points[triangles[t + 2]];
+        // Front faces are counter-clockwise when seen from outside
+        bool ccw = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x) > 0;
+        const vec2_t* tri[3] = {&a, &b, &c};
+        if (ccw != front) std::swap(tri[1], tri[2]);
+        for (int v = 0; v < 3; v++) {
+            buff.indices.push_back(buff.pos.size());
+            buff.pos.push_back({{tri[v]->x, tri[v]->y, z}});
+            buff.nrm.push_back(normal);
+            buff.bary.push_back(bary[v]);
+        }
+    }
+}
+
+// Side walls of one ring. Material must be on the left of each edge, which
+// means outer rings are counter-clockwise and holes are clockwise.
+static void addWalls(
+    GearBuffersSeparate& buff,
+    const vec2_t* ring, std::size_t count, bool reverse,
+    GLfloat width)
+{
+    for (std::size_t e = 0; e < count; e++) {
+        std::size_t i = reverse ? count - 1 - e : e;
+        std::size_t j = reverse ? (i + count - 1) % count : (i + 1) % count;
+        vec2_t a = ring[i], b = ring[j];
+        GLfloat u = b.x - a.x;
+        GLfloat v = b.y - a.y;
+        GLfloat len = std::sqrt(u * u + v * v);
+        if (len == 0) continue;
+        vec3_t normal = {{v / len, -u / len, 0.}};
+
+        // Same vertex order and barycentric coordinates as addIndexedQuad in
+        // gear.cpp
+        unsigned int start = buff.pos.size();
+        buff.pos.push_back({{a.x, a.y, width * 0.5f}});
+        buff.pos.push_back({{a.x, a.y, -width * 0.5f}});
+        buff.pos.push_back({{b.x, b.y, width * 0.5f}});
+        buff.pos.push_back({{b.x, b.y, -width * 0.5f}});
+        for (int k = 0; k < 4; k++) buff.nrm.push_back(normal);
+        buff.bary.push_back({{1., 0.}});
+        buff.bary.push_back({{0., 1.}});
+        buff.bary.push_back({{0., 1.}});
+        buff.bary.push_back({{0., 0.}});
+        const unsigned int quad[6] = {0, 1, 3, 3, 2, 0};
+        for (unsigned int q : quad) buff.indices.push_back(start + q);
+    }
+}
+
+GearBuffersSeparate extrude(const Profile& profile, GLfloat width)
+{
+    GearBuffersSeparate buff {};
+    if (profile.outer.size() < 3) return buff;
+
+    // Flatten the rings into a single point list for the triangulator
+    std::vector<vec2_t> points(profile.outer);
+    std::vector<unsigned int> holeStarts;
+    for (const std::vector<vec2_t>& hole : profile.holes) {
+        if (hole.size() < 3) continue;
+        holeStarts.push_back(points.size());
+        points.insert(points.end(), hole.begin(), hole.end());
+    }
+    std::vector<unsigned int> triangles = triangulate(points, holeStarts);
+
+    std::size_t wallVertices = points.size() * 4;
+    std::size_t vertexCount = triangles.size() * 2 + wallVertices;
+    buff.pos.reserve(vertexCount);
+    buff.nrm.reserve(vertexCount);
+    buff.bary.reserve(vertexCount);
+    buff.indices.reserve(triangles.size() * 2 + points.size() * 6);
+
+    addCap(buff, points, triangles, width * 0.5f, true);
+    addCap(buff, points, triangles, -width * 0.5f, false);
+
+    addWalls(buff, profile.outer.data(), profile.outer.size(),
+        ringArea(profile.outer) < 0, width);
+    for (const std::vector<vec2_t>& hole : profile.holes) {
+        if (hole.size() < 3) continue;
+        addWalls(buff, hole.data(), hole.size(), ringArea(hole) > 0, width);
+    }
+
+    return buff;
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include "glad.h"
+#include "vector.h"
+#include "gear.h"
+#include <vector>
+
+// A closed 2D outline, such as the cross-section of a sprocket, spline,
+// ratchet or cam. The last point of each ring is implicitly connected to the
+// first one. Rings may be given in either winding.
+struct Profile {
+    std::vector<vec2_t> outer;
+    std::vector<std::vector<vec2_t>> holes;
+};
+
+/**
+    Extrude a 2D profile along the Z axis, centered on Z=0. The caps are
+    triangulated, and each edge of each ring becomes a flat-shaded side wall.
+    Returns buffers in the same layout as gear(), so the result can be
+    uploaded as a Mesh.
+
+    Input:  profile - outline to extrude
+            width - distance between the front and back caps
+ **/
+GearBuffersSeparate extrude(const Profile& profile, GLfloat width);
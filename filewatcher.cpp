@@ -0,0 +1,58 @@
+#include "filewatcher.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#ifdef __linux__
+ #include <sys/inotify.h>
+ #include <unistd.h>
+#endif
+
+FileWatcher::FileWatcher(const char* directory) :
+    inotify(-1), watch(-1)
+{
+#ifdef __linux__
+    inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify < 0) {
+        fprintf(stderr, "Files cannot be watched: %s\n", strerror(errno));
+        return;
+    }
+    watch = inotify_add_watch(inotify, directory, IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (watch < 0) {
+        fprintf(stderr, "%s cannot be watched: %s\n", directory, strerror(errno));
+    }
+#else
+    (void) directory;
+#endif
+}
+
+FileWatcher::~FileWatcher()
+{
+#ifdef __linux__
+    if (inotify >= 0) close(inotify);
+#endif
+}
+
+std::vector<std::string> FileWatcher::changes()
+{
+    std::vector<std::string> names;
+#ifdef __linux__
+    if (watch < 0) return names;
+    // Aligned as the events in it need to be
+    alignas(struct inotify_event) char buffer[4096];
+    ssize_t length;
+    while ((length = read(inotify, buffer, sizeof(buffer))) > 0) {
+        for (char* next = buffer; next < buffer + length;) {
+            const struct inotify_event* event = (const struct inotify_event*) next;
+            next += sizeof(struct inotify_event) + event->len;
+            if (event->len == 0) continue;
+            std::string name = event->name;
+            if (std::find(names.begin(), names.end(), name) == names.end()) {
+                names.push_back(name);
+            }
+        }
+    }
+#endif
+    return names;
+}
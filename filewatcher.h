@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Tells which files in a directory have been written to, so that shaders
+// can be reloaded as they are edited. Uses inotify, so it only works on
+// Linux; elsewhere, no file ever changes.
+//
+// Editors either write a file in place, or write another one and rename it
+// over the original, so both closing a file after writing and moving one
+// into the directory count.
+class FileWatcher {
+    private:
+    int inotify;
+    int watch;
+
+    public:
+    FileWatcher(const char* directory);
+
+    // Prevent copying! It would close the same descriptor twice
+    FileWatcher(FileWatcher& other) = delete;
+    FileWatcher& operator= (FileWatcher& other) = delete;
+
+    ~FileWatcher();
+
+    // Names of the files changed since the last call, each once. Never
+    // waits.
+    std::vector<std::string> changes();
+};
@@ -31,10 +31,60 @@
 #endif
 
 #include <cmath>
+#include <functional>
 #include "gear.h"
 #include "vector.h"
 #include <vector>
 
+// Ratios are rounded to this many steps per unit, so that floating point
+// error in the division doesn't give two otherwise identical gears different
+// canonical shapes.
+#define CANONICAL_STEPS 65536.f
+
+static GLfloat quantize(GLfloat v)
+{
+    return std::round(v * CANONICAL_STEPS) / CANONICAL_STEPS;
+}
+
+GearBlueprint GearBlueprint::canonical() const
+{
+    return GearBlueprint {
+        quantize(inner_radius / outer_radius), // inner_radius
+        1.f, // outer_radius
+        1.f, // width
+        teeth,
+        quantize(tooth_depth / outer_radius) // tooth_depth
+    };
+}
+
+vec3_t GearBlueprint::scale() const
+{
+    return vec3_t {{outer_radius, outer_radius, width}};
+}
+
+bool GearBlueprint::operator== (const GearBlueprint& other) const
+{
+    return
+        inner_radius == other.inner_radius &&
+        outer_radius == other.outer_radius &&
+        width == other.width &&
+        teeth == other.teeth &&
+        tooth_depth == other.tooth_depth;
+}
+
+std::size_t GearBlueprintHash::operator()(const GearBlueprint& bp) const
+{
+    // Combine the hashes of the fields, boost::hash_combine style
+    std::size_t h = std::hash<GLint>()(bp.teeth);
+    const GLfloat fields[] = {
+        bp.inner_radius, bp.outer_radius, bp.width, bp.tooth_depth
+    };
+    for (GLfloat f : fields) {
+        h ^= std::hash<GLfloat>()(f) + 0x9e3779b9 + (h << 6) + (h >> 2);
+    }
+    return h;
+}
+
 // Interleaved buffers - useful for checking for duplicates whilst constructing
 // the geometry.
 struct GearBuffersInterleaved {
@@ -402,6 +452,26 @@ GearBuffersSeparate gear(GearBlueprint bp)
     return buff2;
 }
 
+std::vector<vec3_t> gearOccluder(const GearBuffersSeparate& buffers)
+{
+    std::vector<vec3_t> occluder;
+    for (std::size_t i = 0; i + 2 < buffers.indices.size(); i += 3) {
+        // The bore faces inwards, so it would only ever cover the hole
+        // through the gear, which nothing is inside of
+        bool bore = true;
+        for (int corner = 0; corner < 3; corner++) {
+            const vec3_t& p = buffers.pos[buffers.indices[i + corner]];
+            const vec3_t& n = buffers.nrm[buffers.indices[i + corner]];
+            bore = bore && p.x * n.x + p.y * n.y < 0.f;
+        }
+        if (bore) continue;
+        for (int corner = 0; corner < 3; corner++) {
+            occluder.push_back(buffers.pos[buffers.indices[i + corner]]);
+        }
+    }
+    return occluder;
+}
+
 static void addIndexedQuad(std::vector<GearVertex>& geom,
                     std::vector<IndexTriangle>& index,
                     unsigned int indexStart,
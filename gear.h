@@ -26,6 +26,7 @@
 #pragma once
 #include "glad.h"
 #include "vector.h"
+#include <cstddef>
 #include <vector>
 
 struct GearVertex {
@@ -54,6 +55,19 @@ struct GearBlueprint {
     GLfloat width;
     GLint teeth;
     GLfloat tooth_depth;
+
+    // Canonical shape of this gear: outer radius and width are both 1, and
+    // the other radii are stored as (quantized) ratios of the outer radius.
+    // Gears which only differ by uniform scale or width share a canonical
+    // shape, and therefore a mesh.
+    GearBlueprint canonical() const;
+    // Per-object scale which turns the canonical shape back into this gear
+    vec3_t scale() const;
+    bool operator== (const GearBlueprint& other) const;
+};
+
+struct GearBlueprintHash {
+    std::size_t operator()(const GearBlueprint& bp) const;
 };
 
 struct GearBuffersSeparate {
@@ -61,7 +75,7 @@ struct GearBuffersSeparate {
     std::vector<vec3_t> nrm;
     std::vector<vec2_t> bary;
     std::vector<unsigned int> indices;
-    std::size_t totalSize() {
+    std::size_t totalSize() const {
         return
             sizeof(vec3_t) * pos.size() +
             sizeof(vec3_t) * nrm.size() +
@@ -70,3 +84,6 @@ struct GearBuffersSeparate {
 };
 
 GearBuffersSeparate gear(GearBlueprint bp);
+// The outside of a gear made by gear(), as triangles of three vertices each,
+// for software occlusion culling. Leaves out the bore.
+std::vector<vec3_t> gearOccluder(const GearBuffersSeparate& buffers);
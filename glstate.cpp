@@ -0,0 +1,398 @@
+#include "glstate.h"
+
+#include "glad.h"
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+
+// Stands for state which hasn't been set through the cache yet
+#define UNKNOWN_NAME 0xffffffffu
+
+// Limits on what is tracked; binding points and texture units past these are
+// passed straight through
+#define TRACKED_INDEXED_BINDINGS 16
+#define TRACKED_TEXTURE_UNITS 16
+
+// The real glad function pointers
+static struct {
+    PFNGLUSEPROGRAMPROC useProgram;
+    PFNGLDELETEPROGRAMPROC deleteProgram;
+    PFNGLLINKPROGRAMPROC linkProgram;
+    PFNGLPROGRAMBINARYPROC programBinary;
+    PFNGLUNIFORM1IPROC uniform1i;
+    PFNGLBINDVERTEXARRAYPROC bindVertexArray;
+    PFNGLDELETEVERTEXARRAYSPROC deleteVertexArrays;
+    PFNGLBINDBUFFERPROC bindBuffer;
+    PFNGLBINDBUFFERBASEPROC bindBufferBase;
+    PFNGLBINDBUFFERRANGEPROC bindBufferRange;
+    PFNGLDELETEBUFFERSPROC deleteBuffers;
+    PFNGLACTIVETEXTUREPROC activeTexture;
+    PFNGLBINDTEXTUREPROC bindTexture;
+    PFNGLDELETETEXTURESPROC deleteTextures;
+    PFNGLENABLEPROC enable;
+    PFNGLDISABLEPROC disable;
+} real;
+
+// Buffer targets which are tracked, and their slots in the cache
+static const GLenum bufferTargets[] = {
+    GL_ARRAY_BUFFER,
+    GL_COPY_READ_BUFFER,
+    GL_COPY_WRITE_BUFFER,
+    GL_DRAW_INDIRECT_BUFFER,
+    GL_UNIFORM_BUFFER,
+    GL_SHADER_STORAGE_BUFFER,
+    GL_TEXTURE_BUFFER,
+};
+static const int bufferTargetCount = sizeof(bufferTargets) / sizeof(bufferTargets[0]);
+
+// A buffer bound to an indexed binding point, with the range it covers.
+// glBindBufferBase has a size of -1.
+struct IndexedBinding {
+    GLuint buffer;
+    GLintptr offset;
+    GLsizeiptr size;
+};
+
+// Texture targets which are tracked
+static const GLenum textureTargets[] = {
+    GL_TEXTURE_2D,
+    GL_TEXTURE_BUFFER,
+};
+static const int textureTargetCount = sizeof(textureTargets) / sizeof(textureTargets[0]);
+
+static struct {
+    GLuint program;
+    GLuint vertexArray;
+    GLuint buffers[bufferTargetCount];
+    IndexedBinding uniformBuffers[TRACKED_INDEXED_BINDINGS];
+    IndexedBinding storageBuffers[TRACKED_INDEXED_BINDINGS];
+    GLuint activeTexture;
+    GLuint textures[TRACKED_TEXTURE_UNITS][textureTargetCount];
+    // Enabled capabilities; ones which aren't in here are unknown
+    std::unordered_map<GLenum, bool> caps;
+    // Values of integer uniforms, keyed by program and location
+    std::unordered_map<uint64_t, GLint> uniforms;
+} cache;
+
+static GLStateStats counting, finished;
+
+// Set on threads whose calls go to another context, which isn't tracked
+static thread_local bool untracked = false;
+
+// Pass a call from such a thread straight on to the driver
+#define PASS_UNTRACKED(wrapper, ...) \
+    if (untracked) { \
+        real.wrapper(__VA_ARGS__); \
+        return; \
+    }
+
+static void forgetAll()
+{
+    cache.program = UNKNOWN_NAME;
+    cache.vertexArray = UNKNOWN_NAME;
+    for (GLuint& buffer : cache.buffers) buffer = UNKNOWN_NAME;
+    for (int i = 0; i < TRACKED_INDEXED_BINDINGS; i++) {
+        cache.uniformBuffers[i].buffer = UNKNOWN_NAME;
+        cache.storageBuffers[i].buffer = UNKNOWN_NAME;
+    }
+    cache.activeTexture = UNKNOWN_NAME;
+    for (auto& unit : cache.textures) {
+        for (GLuint& texture : unit) texture = UNKNOWN_NAME;
+    }
+    cache.caps.clear();
+    cache.uniforms.clear();
+}
+
+static int bufferSlot(GLenum target)
+{
+    for (int i = 0; i < bufferTargetCount; i++) {
+        if (bufferTargets[i] == target) return i;
+    }
+    return -1;
+}
+
+static int textureSlot(GLenum target)
+{
+    for (int i = 0; i < textureTargetCount; i++) {
+        if (textureTargets[i] == target) return i;
+    }
+    return -1;
+}
+
+static IndexedBinding* indexedBinding(GLenum target, GLuint index)
+{
+    if (index >= TRACKED_INDEXED_BINDINGS) return nullptr;
+    if (target == GL_UNIFORM_BUFFER) return &cache.uniformBuffers[index];
+    if (target == GL_SHADER_STORAGE_BUFFER) return &cache.storageBuffers[index];
+    return nullptr;
+}
+
+static uint64_t uniformKey(GLuint program, GLint location)
+{
+    return (uint64_t) program << 32 | (uint32_t) location;
+}
+
+// Returns true, and counts the call as skipped, if value is already
+// current. Otherwise, records it and counts the call as issued.
+template <typename T>
+static bool redundant(T& current, T value)
+{
+    if (current == value) {
+        counting.skipped++;
+        return true;
+    }
+    current = value;
+    counting.issued++;
+    return false;
+}
+
+static void APIENTRY useProgram(GLuint program)
+{
+    PASS_UNTRACKED(useProgram, program)
+    if (!redundant(cache.program, program)) real.useProgram(program);
+}
+
+static void forgetUniforms(GLuint program)
+{
+    for (auto it = cache.uniforms.begin(); it != cache.uniforms.end();) {
+        if (it->first >> 32 == program) {
+            it = cache.uniforms.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+static void APIENTRY deleteProgram(GLuint program)
+{
+    PASS_UNTRACKED(deleteProgram, program)
+    // A deleted program stays in use until another one replaces it, but
+    // a new program may be given its name, and starts with its uniforms
+    // at their defaults
+    if (program && cache.program == program) cache.program = UNKNOWN_NAME;
+    forgetUniforms(program);
+    real.deleteProgram(program);
+}
+
+static void APIENTRY linkProgram(GLuint program)
+{
+    PASS_UNTRACKED(linkProgram, program)
+    // Linking resets every uniform to its default value
+    forgetUniforms(program);
+    real.linkProgram(program);
+}
+
+static void APIENTRY programBinary(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length)
+{
+    PASS_UNTRACKED(programBinary, program, binaryFormat, binary, length)
+    // As does loading a binary
+    forgetUniforms(program);
+    real.programBinary(program, binaryFormat, binary, length);
+}
+
+static void APIENTRY uniform1i(GLint location, GLint value)
+{
+    PASS_UNTRACKED(uniform1i, location, value)
+    if (location < 0 || cache.program == UNKNOWN_NAME) {
+        real.uniform1i(location, value);
+        return;
+    }
+    uint64_t key = uniformKey(cache.program, location);
+    auto found = cache.uniforms.find(key);
+    if (found == cache.uniforms.end()) {
+        cache.uniforms.emplace(key, value);
+        counting.issued++;
+        real.uniform1i(location, value);
+    } else if (!redundant(found->second, value)) {
+        real.uniform1i(location, value);
+    }
+}
+
+static void APIENTRY bindVertexArray(GLuint vertexArray)
+{
+    PASS_UNTRACKED(bindVertexArray, vertexArray)
+    if (!redundant(cache.vertexArray, vertexArray)) real.bindVertexArray(vertexArray);
+}
+
+static void APIENTRY deleteVertexArrays(GLsizei n, const GLuint* vertexArrays)
+{
+    PASS_UNTRACKED(deleteVertexArrays, n, vertexArrays)
+    for (GLsizei i = 0; i < n; i++) {
+        // Deleting the bound vertex array binds 0 instead
+        if (vertexArrays[i] && cache.vertexArray == vertexArrays[i]) cache.vertexArray = 0;
+    }
+    real.deleteVertexArrays(n, vertexArrays);
+}
+
+static void APIENTRY bindBuffer(GLenum target, GLuint buffer)
+{
+    PASS_UNTRACKED(bindBuffer, target, buffer)
+    int slot = bufferSlot(target);
+    if (slot < 0) {
+        real.bindBuffer(target, buffer);
+    } else if (!redundant(cache.buffers[slot], buffer)) {
+        real.bindBuffer(target, buffer);
+    }
+}
+
+static void APIENTRY bindBufferBase(GLenum target, GLuint index, GLuint buffer)
+{
+    PASS_UNTRACKED(bindBufferBase, target, index, buffer)
+    IndexedBinding* binding = indexedBinding(target, index);
+    if (binding && binding->buffer == buffer && binding->size == -1) {
+        counting.skipped++;
+        return;
+    }
+    // Also binds the buffer to the generic binding point, but only if the
+    // call is made
+    int slot = bufferSlot(target);
+    if (slot >= 0) cache.buffers[slot] = buffer;
+    if (!binding) {
+        real.bindBufferBase(target, index, buffer);
+        return;
+    }
+    *binding = {buffer, 0, -1};
+    counting.issued++;
+    real.bindBufferBase(target, index, buffer);
+}
+
+static void APIENTRY bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+    PASS_UNTRACKED(bindBufferRange, target, index, buffer, offset, size)
+    IndexedBinding* binding = indexedBinding(target, index);
+    if (binding && binding->buffer == buffer && binding->offset == offset && binding->size == size) {
+        counting.skipped++;
+        return;
+    }
+    int slot = bufferSlot(target);
+    if (slot >= 0) cache.buffers[slot] = buffer;
+    if (!binding) {
+        real.bindBufferRange(target, index, buffer, offset, size);
+        return;
+    }
+    *binding = {buffer, offset, size};
+    counting.issued++;
+    real.bindBufferRange(target, index, buffer, offset, size);
+}
+
+static void APIENTRY deleteBuffers(GLsizei n, const GLuint* buffers)
+{
+    PASS_UNTRACKED(deleteBuffers, n, buffers)
+    // Deleting a bound buffer unbinds it from every binding point of the
+    // context. Vertex arrays keep their own references, which aren't
+    // tracked.
+    for (GLsizei i = 0; i < n; i++) {
+        GLuint buffer = buffers[i];
+        if (!buffer) continue;
+        for (GLuint& bound : cache.buffers) {
+            if (bound == buffer) bound = 0;
+        }
+        for (int j = 0; j < TRACKED_INDEXED_BINDINGS; j++) {
+            if (cache.uniformBuffers[j].buffer == buffer) cache.uniformBuffers[j].buffer = UNKNOWN_NAME;
+            if (cache.storageBuffers[j].buffer == buffer) cache.storageBuffers[j].buffer = UNKNOWN_NAME;
+        }
+    }
+    real.deleteBuffers(n, buffers);
+}
+
+static void APIENTRY activeTexture(GLenum texture)
+{
+    PASS_UNTRACKED(activeTexture, texture)
+    if (!redundant<GLuint>(cache.activeTexture, texture)) real.activeTexture(texture);
+}
+
+static void APIENTRY bindTexture(GLenum target, GLuint texture)
+{
+    PASS_UNTRACKED(bindTexture, target, texture)
+    int slot = textureSlot(target);
+    GLuint unit = cache.activeTexture - GL_TEXTURE0;
+    if (slot < 0 || cache.activeTexture == UNKNOWN_NAME || unit >= TRACKED_TEXTURE_UNITS) {
+        real.bindTexture(target, texture);
+    } else if (!redundant(cache.textures[unit][slot], texture)) {
+        real.bindTexture(target, texture);
+    }
+}
+
+static void APIENTRY deleteTextures(GLsizei n, const GLuint* textures)
+{
+    PASS_UNTRACKED(deleteTextures, n, textures)
+    for (GLsizei i = 0; i < n; i++) {
+        if (!textures[i]) continue;
+        for (auto& unit : cache.textures) {
+            for (GLuint& bound : unit) {
+                if (bound == textures[i]) bound = 0;
+            }
+        }
+    }
+    real.deleteTextures(n, textures);
+}
+
+static void APIENTRY enable(GLenum cap)
+{
+    PASS_UNTRACKED(enable, cap)
+    auto found = cache.caps.find(cap);
+    if (found != cache.caps.end() && found->second) {
+        counting.skipped++;
+        return;
+    }
+    cache.caps[cap] = true;
+    counting.issued++;
+    real.enable(cap);
+}
+
+static void APIENTRY disable(GLenum cap)
+{
+    PASS_UNTRACKED(disable, cap)
+    auto found = cache.caps.find(cap);
+    if (found != cache.caps.end() && !found->second) {
+        counting.skipped++;
+        return;
+    }
+    cache.caps[cap] = false;
+    counting.issued++;
+    real.disable(cap);
+}
+
+// Replace a glad function pointer with a filtering one, keeping the original
+#define WRAP(name, wrapper) \
+    real.wrapper = glad_##name; \
+    glad_##name = wrapper;
+
+void GLState::install()
+{
+    // Installing twice would make the wrappers call themselves
+    if (real.useProgram) return;
+    forgetAll();
+    WRAP(glUseProgram, useProgram)
+    WRAP(glDeleteProgram, deleteProgram)
+    WRAP(glLinkProgram, linkProgram)
+    WRAP(glProgramBinary, programBinary)
+    WRAP(glUniform1i, uniform1i)
+    WRAP(glBindVertexArray, bindVertexArray)
+    WRAP(glDeleteVertexArrays, deleteVertexArrays)
+    WRAP(glBindBuffer, bindBuffer)
+    WRAP(glBindBufferBase, bindBufferBase)
+    WRAP(glBindBufferRange, bindBufferRange)
+    WRAP(glDeleteBuffers, deleteBuffers)
+    WRAP(glActiveTexture, activeTexture)
+    WRAP(glBindTexture, bindTexture)
+    WRAP(glDeleteTextures, deleteTextures)
+    WRAP(glEnable, enable)
+    WRAP(glDisable, disable)
+}
+
+void GLState::untrackThisThread()
+{
+    untracked = true;
+}
+
+void GLState::endFrame()
+{
+    finished = counting;
+    memset(&counting, 0, sizeof(counting));
+}
+
+const GLStateStats& GLState::lastFrame()
+{
+    return finished;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "glad.h"
+
+// Counts of the state changing calls which went through the cache
+struct GLStateStats {
+    // Calls passed on to the driver
+    unsigned int issued;
+    // Calls dropped, because they would not have changed anything
+    unsigned int skipped;
+};
+
+// Tracks the bound program, vertex array, buffers and textures, the enabled
+// capabilities, and the values of integer uniforms, and drops calls which
+// would set them to what they already are.
+//
+// install() swaps glad's function pointers for filtering versions, so every
+// gl* call in the program goes through the cache without having to be
+// rewritten. Calls which delete objects or link programs are wrapped too, so
+// that the cache forgets what they invalidate.
+//
+// GL_ELEMENT_ARRAY_BUFFER is part of the vertex array's state, so binds to it
+// are passed straight through.
+//
+// Only the main thread's context is tracked. Other threads with contexts of
+// their own have to call untrackThisThread() first.
+namespace GLState {
+    // Call once, after loading the OpenGL functions. Everything starts out
+    // unknown, so the first call to set each piece of state is never skipped.
+    void install();
+    // Pass every call made on this thread straight on, for a thread with a
+    // context of its own, whose state the cache doesn't follow
+    void untrackThisThread();
+    // Finish counting this frame's calls
+    void endFrame();
+    const GLStateStats& lastFrame();
+}
@@ -0,0 +1,130 @@
+#include "gpuculling.h"
+
+#include "glad.h"
+#include "indirect.h"
+
+// Work group size of cull.comp
+#define CULL_GROUP_SIZE 64
+
+// Shader storage binding points of cull.comp's blocks. 0 is left to the
+// instance buffer.
+enum CullBinding {
+    CULL_OBJECTS_BINDING = 1,
+    CULL_COMMANDS_BINDING = 2,
+    CULL_COUNT_BINDING = 3
+};
+
+bool GPUCulling::supported()
+{
+    return GLAD_GL_ARB_compute_shader && GLAD_GL_ARB_shader_storage_buffer_object &&
+        GLAD_GL_ARB_shader_image_load_store && GLAD_GL_ARB_program_interface_query &&
+        GLAD_GL_ARB_draw_indirect && GLAD_GL_ARB_multi_draw_indirect && GLAD_GL_ARB_base_instance &&
+        (GLAD_GL_ARB_indirect_parameters || GLAD_GL_ARB_clear_buffer_object);
+}
+
+GPUCulling::GPUCulling() :
+    program(0), planesLocation(-1), objectCountLocation(-1),
+    commandBuffer(GL_DYNAMIC_COPY), countBuffer(0), objectCount(0)
+{
+    countParameter = GLAD_GL_ARB_indirect_parameters;
+    glGenBuffers(1, &countBuffer);
+    GLuint zero = 0;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, countBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), &zero, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+GPUCulling::~GPUCulling()
+{
+    if (countBuffer) glDeleteBuffers(1, &countBuffer);
+    if (program) glDeleteProgram(program);
+}
+
+void GPUCulling::setProgram(GLuint newProgram)
+{
+    if (program) glDeleteProgram(program);
+    program = newProgram;
+    planesLocation = glGetUniformLocation(program, "planes");
+    objectCountLocation = glGetUniformLocation(program, "objectCount");
+    const struct {
+        const char* name;
+        CullBinding binding;
+    } blocks[] = {
+        {"Objects", CULL_OBJECTS_BINDING},
+        {"Commands", CULL_COMMANDS_BINDING},
+        {"Count", CULL_COUNT_BINDING},
+    };
+    for (const auto& block : blocks) {
+        GLuint index = glGetProgramResourceIndex(program, GL_SHADER_STORAGE_BLOCK, block.name);
+        glShaderStorageBlockBinding(program, index, block.binding);
+    }
+}
+
+void GPUCulling::update(const std::vector<ThreeDimensionalObject>& objects, std::size_t first)
+{
+    objectCount = objects.size();
+    std::vector<CullObject> data;
+    data.reserve(objects.size() - first);
+    for (std::size_t i = first; i < objects.size(); i++) {
+        const ThreeDimensionalObject& obj = objects[i];
+        const Mesh* mesh = obj.getMesh();
+        data.push_back({
+            {obj.position.x, obj.position.y, obj.position.z, boundingRadius(obj)},
+            mesh->indexCount, mesh->firstIndex, mesh->baseVertex, 0
+        });
+    }
+    objectBuffer.write(first * sizeof(CullObject), data.size() * sizeof(CullObject), data.data());
+    // The commands are written again every frame, so none are kept
+    commandBuffer.reserve(objects.size() * sizeof(DrawElementsIndirectCommand), 0);
+}
+
+void GPUCulling::cull(const Frustum& frustum)
+{
+    if (!objectCount || !program) return;
+    GLuint zero = 0;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, countBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &zero);
+    if (!countParameter) {
+        // Every command is drawn, so the ones left over from the last frame
+        // have to be emptied
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer.getBuffer());
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glUseProgram(program);
+    glUniform4fv(planesLocation, 6, &frustum.planes[0][0]);
+    glUniform1ui(objectCountLocation, objectCount);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_OBJECTS_BINDING, objectBuffer.getBuffer());
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_COMMANDS_BINDING, commandBuffer.getBuffer());
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_COUNT_BINDING, countBuffer);
+    glDispatchCompute((objectCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+    // The commands and their count are read by the draw call
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+}
+
+void GPUCulling::draw() const
+{
+    if (!objectCount || !program) return;
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer.getBuffer());
+    if (countParameter) {
+        glBindBuffer(GL_PARAMETER_BUFFER_ARB, countBuffer);
+        glMultiDrawElementsIndirectCountARB(
+            GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, 0, objectCount, 0);
+        glBindBuffer(GL_PARAMETER_BUFFER_ARB, 0);
+    } else {
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, objectCount, 0);
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+GLuint GPUCulling::visibleCount() const
+{
+    GLuint count = 0;
+    if (!objectCount) return count;
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, countBuffer);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &count);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return count;
+}
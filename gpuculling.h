@@ -0,0 +1,68 @@
+#pragma once
+
+#include "glad.h"
+#include "3dobject.h"
+#include "culling.h"
+#include "instances.h"
+#include <vector>
+
+// Layout of one object in the buffer read by cull.comp
+struct CullObject {
+    GLfloat sphere[4];
+    // Where the object's mesh is in the geometry arena
+    GLuint count;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint padding;
+};
+
+// Frustum culling on the GPU. A compute shader tests every object's bounding
+// sphere, and writes a draw command for each one which is visible, so that
+// the CPU does the same amount of work however many objects there are.
+//
+// With ARB_indirect_parameters, the number of commands is read by the draw
+// call from the buffer the shader counts them in. Otherwise, the command
+// buffer is cleared before culling, and every command in it is drawn; the
+// empty ones draw nothing.
+class GPUCulling {
+    private:
+    GLuint program;
+    GLint planesLocation;
+    GLint objectCountLocation;
+    GrowableBuffer objectBuffer;
+    // Room for a command for every object
+    GrowableBuffer commandBuffer;
+    GLuint countBuffer;
+    GLuint objectCount;
+    bool countParameter;
+
+    public:
+    // Whether the context has everything this, and drawing its commands,
+    // needs
+    static bool supported();
+
+    // Culls and draws nothing until it is given a program
+    GPUCulling();
+
+    // Prevent copying! See: https://www.khronos.org/opengl/wiki/Common_Mistakes#RAII_and_hidden_destructor_calls
+    GPUCulling(GPUCulling& other) = delete;
+    GPUCulling& operator= (GPUCulling& other) = delete;
+
+    ~GPUCulling();
+
+    // Cull with program, which is cull.comp, linked, from now on. Deletes
+    // the program before it.
+    void setProgram(GLuint program);
+    // Upload the bounding spheres and meshes of the objects from first on.
+    // Only needs to be called again when objects are added, removed or
+    // modified; when they are only added, first can skip the ones uploaded
+    // before.
+    void update(const std::vector<ThreeDimensionalObject>& objects, std::size_t first = 0);
+    // Run the compute shader, writing this frame's draw commands
+    void cull(const Frustum& frustum);
+    // Draw the commands, with the program and vertex array which are bound
+    void draw() const;
+    // Number of commands written by the last cull(). Waits for the GPU, so
+    // it is only meant for statistics.
+    GLuint visibleCount() const;
+};
@@ -0,0 +1,87 @@
+#version 330 core
+// CLUSTERED_LIGHTS and BAKE, or one of LIT or WIREFRAME, may be defined by
+// the program when it loads this shader, as for default.frag.
+
+out vec4 FragColor;
+
+#ifdef BAKE
+in vec3 vNormal;
+
+// The canonical shape's normal, from 0 to 1, with coverage in alpha. The
+// cells are cleared to 0, so the mipmaps come out premultiplied by coverage.
+void main() {
+	FragColor = vec4(normalize(vNormal) * .5 + .5, 1.);
+}
+#else
+// Laid out as the structs in uniforms.h
+layout(std140) uniform Frame {
+	mat4 projView;
+	vec3 lightPos;
+	float zoom;
+	float time;
+};
+
+uniform sampler2DArray atlas;
+
+in vec3 vAtlas;
+in vec2 vCorner;
+flat in mat3 vNormalMatrix;
+in vec3 vPosition;
+in vec4 diffuse;
+in float distanceFromCamera;
+
+#if defined(LIT) && defined(CLUSTERED_LIGHTS)
+// As in resolve.frag
+layout(std140) uniform Lights {
+	vec4 clusterScale;
+	ivec4 clusterCount;
+};
+uniform samplerBuffer lightData;
+uniform usamplerBuffer clusters;
+uniform usamplerBuffer lightIndices;
+
+in float vViewDepth;
+
+vec3 pointLights(vec3 position, vec3 normal, float viewDepth) {
+	vec3 coord = vec3(gl_FragCoord.xy * clusterScale.xy, log(viewDepth) * clusterScale.z + clusterScale.w);
+	ivec3 cluster = clamp(ivec3(coord), ivec3(0), clusterCount.xyz - 1);
+	uvec2 list = texelFetch(clusters, (cluster.z * clusterCount.y + cluster.y) * clusterCount.x + cluster.x).xy;
+	vec3 total = vec3(0.);
+	for (uint i = 0u; i < list.y; i++) {
+		int light = int(texelFetch(lightIndices, int(list.x + i)).r);
+		vec4 positionRadius = texelFetch(lightData, light * 2);
+		vec3 toLight = positionRadius.xyz - position;
+		float distance = length(toLight);
+		float falloff = clamp(1. - distance / positionRadius.w, 0., 1.);
+		float intensity = max(0., dot(normal, toLight / distance)) * falloff * falloff;
+		total += texelFetch(lightData, light * 2 + 1).rgb * intensity;
+	}
+	return total;
+}
+#endif
+
+void main() {
+	vec4 texel = texture(atlas, vAtlas);
+#if defined(WIREFRAME)
+	// The outline of the quad, so that impostors stand out from meshes
+	vec2 edge = abs(vCorner);
+	vec2 d = fwidth(vCorner);
+	float outline = step(1. - d.x, edge.x) + step(1. - d.y, edge.y);
+	if (outline == 0. && texel.a < .5) discard;
+	FragColor = vec4(vec3(min(outline, 1.)), 1.);
+#elif defined(LIT)
+	if (texel.a < .5) discard;
+	vec3 normal = normalize(vNormalMatrix * (texel.rgb / texel.a * 2. - 1.));
+	// Lit per pixel, with what default.vert lights per vertex
+	vec4 lightColour = vec4(vec3(max(0., dot(normalize(lightPos - vPosition), normal))), 1.);
+#ifdef CLUSTERED_LIGHTS
+	lightColour.rgb += pointLights(vPosition, normal, vViewDepth);
+#endif
+	FragColor = lightColour * diffuse;
+#else
+	if (texel.a < .5) discard;
+	vec4 grayShade = vec4(vec3(distanceFromCamera / 50.) + .25, 1.);
+	FragColor = grayShade * diffuse;
+#endif
+}
+#endif
@@ -0,0 +1,140 @@
+#version 330 core
+// IMPOSTOR_ELEVATIONS and IMPOSTOR_PHASES are defined by the program when it
+// loads this shader, and INSTANCES_SSBO, CLUSTERED_LIGHTS and BAKE may be.
+#ifdef INSTANCES_SSBO
+#extension GL_ARB_shader_storage_buffer_object : require
+#endif
+
+// Draws each instance as a quad textured from the impostor atlas; see
+// impostors.h. With BAKE, draws a mesh into one cell of the atlas instead.
+
+const float PI = 3.14159265358979;
+
+// The direction a cell of the atlas looks at the canonical shape from, as
+// forward, which points from the shape towards the viewer, and the axes of
+// the picture, right and up. Each cell is an orthographic view, with the
+// shape's origin in the middle.
+void viewBasis(float elevation, float azimuth, out vec3 right, out vec3 up, out vec3 forward) {
+	forward = vec3(sin(elevation) * cos(azimuth), sin(elevation) * sin(azimuth), cos(elevation));
+	// Defined at the poles too
+	right = vec3(-sin(azimuth), cos(azimuth), 0.);
+	up = cross(forward, right);
+}
+
+#ifdef BAKE
+// Elevation and azimuth of the cell, and the mesh's radius
+uniform vec3 bakeView;
+
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec3 aNrm;
+
+out vec3 vNormal;
+
+void main() {
+	vec3 right, up, forward;
+	viewBasis(bakeView.x, bakeView.y, right, up, forward);
+	vNormal = aNrm;
+	gl_Position = vec4(vec3(dot(aPos, right), dot(aPos, up), -dot(aPos, forward)) / bakeView.z, 1.);
+}
+#else
+// Laid out as the structs in uniforms.h
+layout(std140) uniform Frame {
+	mat4 projView;
+	vec3 lightPos;
+	float zoom;
+	float time;
+};
+
+// The instance data, as in default.vert. scale.w holds the mesh, which is
+// also the layer of the atlas. The impostors start at instanceBase.
+uniform int instanceBase;
+#ifdef INSTANCES_SSBO
+struct Instance {
+	vec4 positionAngleMultiply;
+	vec4 colourAngleAdd;
+	vec4 scale;
+};
+layout(std430) readonly buffer Instances {
+	Instance instances[];
+};
+#else
+uniform samplerBuffer instances;
+#endif
+// Angle of one tooth, in radians, and radius, of each mesh, by Mesh::id
+uniform samplerBuffer impostorMeshes;
+// The camera's position
+uniform vec3 eye;
+
+// Texture coordinates and layer in the atlas
+out vec3 vAtlas;
+// Position within the quad, from -1 to 1 across and up
+out vec2 vCorner;
+// Turns the normals in the atlas into world space
+flat out mat3 vNormalMatrix;
+out vec3 vPosition;
+out vec4 diffuse;
+out float distanceFromCamera;
+#ifdef CLUSTERED_LIGHTS
+out float vViewDepth;
+#endif
+
+void main() {
+	int instance = instanceBase + gl_InstanceID;
+#ifdef INSTANCES_SSBO
+	vec4 positionAngleMultiply = instances[instance].positionAngleMultiply;
+	vec4 colourAngleAdd = instances[instance].colourAngleAdd;
+	vec4 scaleMesh = instances[instance].scale;
+#else
+	vec4 positionAngleMultiply = texelFetch(instances, instance * 3);
+	vec4 colourAngleAdd = texelFetch(instances, instance * 3 + 1);
+	vec4 scaleMesh = texelFetch(instances, instance * 3 + 2);
+#endif
+	vec3 position = positionAngleMultiply.xyz;
+	vec3 scale = scaleMesh.xyz;
+	vec2 mesh = texelFetch(impostorMeshes, int(scaleMesh.w)).xy;
+	float toothAngle = mesh.x;
+	float radius = mesh.y;
+	float angle = radians(positionAngleMultiply.w * time * 100. + colourAngleAdd.w);
+	float c = cos(angle), s = sin(angle);
+	mat4 model = mat4(
+		c, s, 0., 0.,
+		-s, c, 0., 0.,
+		0., 0., 1., 0.,
+		position, 1.);
+
+	// Where the eye is seen from, in the space of the canonical shape, which
+	// the atlas was drawn in
+	vec3 toEye = eye - position;
+	vec3 local = normalize(vec3(c * toEye.x + s * toEye.y, -s * toEye.x + c * toEye.y, toEye.z) / scale);
+	float row = round(acos(clamp(local.z, -1., 1.)) / PI * float(IMPOSTOR_ELEVATIONS - 1));
+	// The columns only cover one tooth. The nearest view is the one in the
+	// atlas turned by whole teeth, which looks just the same.
+	float phase = round(atan(local.y, local.x) / toothAngle * float(IMPOSTOR_PHASES));
+	float column = mod(phase, float(IMPOSTOR_PHASES));
+	float turn = (phase - column) / float(IMPOSTOR_PHASES) * toothAngle;
+	vec3 right, up, forward;
+	viewBasis(row / float(IMPOSTOR_ELEVATIONS - 1) * PI, phase / float(IMPOSTOR_PHASES) * toothAngle,
+		right, up, forward);
+
+	// A triangle strip of four corners
+	vCorner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2. - 1.;
+	vec3 corner = (right * vCorner.x + up * vCorner.y) * radius;
+	vAtlas = vec3((vec2(column, row) + vCorner * .5 + .5) / vec2(IMPOSTOR_PHASES, IMPOSTOR_ELEVATIONS),
+		scaleMesh.w);
+	// As default.vert transforms normals, after turning them by the teeth
+	float ct = cos(turn), st = sin(turn);
+	vNormalMatrix = mat3(model) * mat3(1. / scale.x, 0., 0., 0., 1. / scale.y, 0., 0., 0., 1. / scale.z) *
+		mat3(ct, st, 0., -st, ct, 0., 0., 0., 1.);
+
+	vec4 worldPos = model * vec4(corner * scale, 1.);
+	vPosition = worldPos.xyz;
+	diffuse = vec4(colourAngleAdd.rgb, 1.);
+	vec4 screenPos = projView * worldPos;
+	distanceFromCamera = screenPos.z;
+#ifdef CLUSTERED_LIGHTS
+	vViewDepth = screenPos.w;
+#endif
+	screenPos.w *= zoom;
+	gl_Position = screenPos;
+}
+#endif
@@ -0,0 +1,245 @@
+#include "impostors.h"
+
+#if defined(_MSC_VER)
+ // Make MS math.h define M_PI
+ #define _USE_MATH_DEFINES
+#endif
+
+#include "culling.h"
+#include "glad.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+// Size of each cell of the atlas, in pixels, and the number of mipmap levels
+// below it, down to one pixel per cell. An object is drawn as an impostor
+// once it is no bigger on the screen than its cell.
+#define IMPOSTOR_CELL 64
+#define IMPOSTOR_CELL_LEVELS 6
+// Rows of the atlas, from the front of the gear to the back, and columns,
+// across the angle of one tooth
+#define IMPOSTOR_ELEVATIONS 9
+#define IMPOSTOR_PHASES 8
+// Layers the atlas starts out with. It doubles whenever it runs out.
+#define IMPOSTOR_MIN_LAYERS 8
+// Texture units of the atlas and the mesh table. Units 0 to 8 are taken by
+// the instance data, clustered lighting and the visibility buffer. The
+// impostors' instance data is read the same way as the instanced renderer's,
+// from shader storage block binding 0 or texture unit 0.
+#define ATLAS_UNIT 9
+#define IMPOSTOR_MESH_UNIT 10
+
+ImpostorAtlas::ImpostorAtlas(bool storageBuffer, StreamBuffer& stream) :
+    texture(0), layers(0), instances(stream, storageBuffer, 0, GL_RGBA32F, sizeof(InstanceData)), stats()
+{
+    glGenTextures(1, &meshTexture);
+    glGenBuffers(1, &meshBuffer);
+    glGenFramebuffers(1, &framebuffer);
+    glGenVertexArrays(1, &vertexArray);
+    // Only ever used one layer at a time, so it doesn't need to be an array
+    glGenRenderbuffers(1, &depthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24,
+        IMPOSTOR_PHASES * IMPOSTOR_CELL, IMPOSTOR_ELEVATIONS * IMPOSTOR_CELL);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+}
+
+ImpostorAtlas::~ImpostorAtlas()
+{
+    GLuint textures[2] = {texture, meshTexture};
+    glDeleteTextures(2, textures);
+    glDeleteBuffers(1, &meshBuffer);
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteRenderbuffers(1, &depthBuffer);
+    glDeleteVertexArrays(1, &vertexArray);
+}
+
+void ImpostorAtlas::select(const std::vector<ThreeDimensionalObject>& objects, std::vector<GLuint>& visible,
+    const glm::mat4& projView, int height)
+{
+    // The projection's vertical scale, which is the length of the second row
+    // of projView, since the view matrix only turns and moves things. An
+    // object then covers radius * pixelScale / w pixels across, where w is
+    // its clip space w.
+    float pixelScale = glm::length(glm::vec3(projView[0][1], projView[1][1], projView[2][1])) * height;
+    instanceData.clear();
+    stats.trianglesReplaced = 0;
+    std::size_t kept = 0;
+    for (GLuint i : visible) {
+        const ThreeDimensionalObject& object = objects[i];
+        const vec3_t& p = object.position;
+        float w = projView[0][3] * p.x + projView[1][3] * p.y + projView[2][3] * p.z + projView[3][3];
+        if (w <= 0.f || boundingRadius(object) * pixelScale > IMPOSTOR_CELL * w) {
+            visible[kept++] = i;
+            continue;
+        }
+        const Mesh* mesh = object.getMesh();
+        if (mesh->id >= meshes.size()) {
+            meshes.resize(mesh->id + 1, nullptr);
+        }
+        if (!meshes[mesh->id]) {
+            meshes[mesh->id] = mesh;
+            unbaked.push_back(mesh);
+        }
+        instanceData.push_back(InstanceData::fromObject(object));
+        stats.trianglesReplaced += mesh->indexCount / 3;
+    }
+    visible.resize(kept);
+    stats.impostors = instanceData.size();
+}
+
+void ImpostorAtlas::grow(GLsizei newLayers)
+{
+    const GLsizei width = IMPOSTOR_PHASES * IMPOSTOR_CELL;
+    const GLsizei height = IMPOSTOR_ELEVATIONS * IMPOSTOR_CELL;
+    GLuint old = texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    for (int level = 0; level <= IMPOSTOR_CELL_LEVELS; level++) {
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, width >> level, height >> level, newLayers,
+            0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    }
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, IMPOSTOR_CELL_LEVELS);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    if (old) {
+        // Only the top level is copied, since bake() generates the mipmaps
+        // of every layer again anyway
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+        for (const Mesh* mesh : meshes) {
+            if (!mesh || (GLsizei) mesh->id >= layers ||
+                std::find(unbaked.begin(), unbaked.end(), mesh) != unbaked.end()) continue;
+            glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, old, 0, mesh->id);
+            glCopyTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, mesh->id, 0, 0, width, height);
+        }
+        glDeleteTextures(1, &old);
+    }
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    layers = newLayers;
+
+    // The mesh table grows with it
+    std::vector<GLfloat> meshData(layers * 2, 0.f);
+    for (const Mesh* mesh : meshes) {
+        if (!mesh) continue;
+        meshData[mesh->id * 2] = 2.f * (float) M_PI / mesh->teeth;
+        meshData[mesh->id * 2 + 1] = mesh->radius;
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, meshBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, meshData.size() * sizeof(GLfloat), meshData.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_BUFFER, meshTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32F, meshBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+void ImpostorAtlas::bake(const GeometryArena& arena, GLuint bakeProgram)
+{
+    const GLsizei width = IMPOSTOR_PHASES * IMPOSTOR_CELL;
+    const GLsizei height = IMPOSTOR_ELEVATIONS * IMPOSTOR_CELL;
+    GLint target;
+    GLint viewport[4];
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &target);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    if ((GLsizei) meshes.size() > layers) {
+        grow(std::max((GLsizei) meshes.size(), std::max(layers * 2, IMPOSTOR_MIN_LAYERS)));
+    } else {
+        glBindBuffer(GL_TEXTURE_BUFFER, meshBuffer);
+        for (const Mesh* mesh : unbaked) {
+            const GLfloat meshData[2] = {2.f * (float) M_PI / mesh->teeth, mesh->radius};
+            glBufferSubData(GL_TEXTURE_BUFFER, mesh->id * sizeof(meshData), sizeof(meshData), meshData);
+        }
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+    glUseProgram(bakeProgram);
+    GLint viewLocation = glGetUniformLocation(bakeProgram, "bakeView");
+    arena.bind();
+    for (const Mesh* mesh : unbaked) {
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture, 0, mesh->id);
+        GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        if (status != GL_FRAMEBUFFER_COMPLETE) {
+            fprintf(stderr, "Impostor atlas framebuffer is incomplete: 0x%x\n", status);
+            break;
+        }
+        glViewport(0, 0, width, height);
+        const GLfloat transparent[4] = {0.f, 0.f, 0.f, 0.f};
+        const GLfloat farthest = 1.f;
+        glClearBufferfv(GL_COLOR, 0, transparent);
+        glClearBufferfv(GL_DEPTH, 0, &farthest);
+        for (int row = 0; row < IMPOSTOR_ELEVATIONS; row++) {
+            for (int column = 0; column < IMPOSTOR_PHASES; column++) {
+                glViewport(column * IMPOSTOR_CELL, row * IMPOSTOR_CELL, IMPOSTOR_CELL, IMPOSTOR_CELL);
+                glUniform3f(viewLocation, (float) M_PI * row / (IMPOSTOR_ELEVATIONS - 1),
+                    2.f * (float) M_PI / mesh->teeth * column / IMPOSTOR_PHASES, mesh->radius);
+                glDrawElementsBaseVertex(GL_TRIANGLES, mesh->indexCount, GL_UNSIGNED_INT,
+                    mesh->indexOffset(), mesh->baseVertex);
+            }
+        }
+    }
+    unbaked.clear();
+    glBindFramebuffer(GL_FRAMEBUFFER, target);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+    // The cells are a power of two in size, so each mipmap level still
+    // keeps them apart. GL 3.3 can only generate the mipmaps of every layer
+    // at once, which is much cheaper than rendering them.
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+void ImpostorAtlas::draw(GLuint program, GLuint bakeProgram, const GeometryArena& arena, const glm::vec3& eye)
+{
+    if (!unbaked.empty()) {
+        bake(arena, bakeProgram);
+    }
+    if (instanceData.empty()) return;
+    void* data = instances.allocate(instanceData.size());
+    if (!data) return;
+    memcpy(data, instanceData.data(), instanceData.size() * sizeof(InstanceData));
+    instances.finish();
+    instances.bind();
+    glActiveTexture(GL_TEXTURE0 + ATLAS_UNIT);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    glActiveTexture(GL_TEXTURE0 + IMPOSTOR_MESH_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, meshTexture);
+    glActiveTexture(GL_TEXTURE0);
+
+    glUseProgram(program);
+    glUniform3f(glGetUniformLocation(program, "eye"), eye.x, eye.y, eye.z);
+    glUniform1i(glGetUniformLocation(program, "instanceBase"), instances.base());
+    glBindVertexArray(vertexArray);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, instanceData.size());
+}
+
+std::string ImpostorAtlas::shaderDefines() const
+{
+    char defines[128];
+    snprintf(defines, sizeof(defines), "#define IMPOSTOR_ELEVATIONS %d\n#define IMPOSTOR_PHASES %d\n",
+        IMPOSTOR_ELEVATIONS, IMPOSTOR_PHASES);
+    return instances.shaderDefines() + defines;
+}
+
+void ImpostorAtlas::bindSamplers(GLuint program)
+{
+    const struct {
+        const char* name;
+        GLint unit;
+    } samplers[] = {
+        {"atlas", ATLAS_UNIT},
+        {"impostorMeshes", IMPOSTOR_MESH_UNIT},
+    };
+    glUseProgram(program);
+    for (const auto& sampler : samplers) {
+        GLint location = glGetUniformLocation(program, sampler.name);
+        if (location >= 0) {
+            glUniform1i(location, sampler.unit);
+        }
+    }
+}
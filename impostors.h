@@ -0,0 +1,93 @@
+#pragma once
+
+#include "glad.h"
+#include "3dobject.h"
+#include "instances.h"
+#include "mesh.h"
+#include "streambuffer.h"
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+struct ImpostorStats {
+    // Objects in view drawn as impostors, and the triangles of their meshes
+    // which were left out
+    unsigned int impostors;
+    unsigned int trianglesReplaced;
+};
+
+// Draws distant gears as quads, textured from an atlas of pictures of their
+// meshes, instead of drawing the meshes themselves.
+//
+// The atlas is a texture array with a layer per mesh, by Mesh::id, made of
+// a grid of cells, each a view of the mesh's canonical shape from another
+// direction. The rows go from looking down the gear's axis from the front,
+// to looking up it from the back. Turning a gear by a whole tooth leaves it
+// looking the same, so the columns only need to cover the angles within one
+// tooth. The cells hold the normals of the canonical shape, so that the
+// impostors are lit as the meshes are, whatever the objects' colours and
+// scales.
+//
+// Each impostor is a quad in the object's canonical space, facing the cell's
+// direction, and transformed the same way as its mesh would be. An object
+// becomes an impostor once it is small enough on the screen that its cell
+// would not be magnified. A layer is rendered the first time one of the
+// mesh's objects becomes an impostor. The texture array is allocated with
+// room to spare, so that it is only replaced every so often as meshes are
+// added; the layers already rendered are then copied over.
+class ImpostorAtlas {
+    private:
+    GLuint texture;
+    // Tooth angle and radius of each mesh, by Mesh::id
+    GLuint meshBuffer;
+    GLuint meshTexture;
+    GLuint framebuffer;
+    GLuint depthBuffer;
+    // The quads aren't read from any buffer, but something has to be bound
+    GLuint vertexArray;
+    // Meshes with a layer, by Mesh::id, and the layers allocated
+    std::vector<const Mesh*> meshes;
+    GLsizei layers;
+    // Meshes whose layer is still to be rendered
+    std::vector<const Mesh*> unbaked;
+    // This frame's impostors, which are written into the stream buffer
+    StreamedArray instances;
+    std::vector<InstanceData> instanceData;
+    ImpostorStats stats;
+
+    // Replace the texture array and mesh table with ones of the given number
+    // of layers, keeping the layers rendered so far
+    void grow(GLsizei newLayers);
+    // Render the cells of the unbaked meshes into their layers
+    void bake(const GeometryArena& arena, GLuint bakeProgram);
+
+    public:
+    ImpostorAtlas(bool storageBuffer, StreamBuffer& stream);
+
+    // Prevent copying! See: https://www.khronos.org/opengl/wiki/Common_Mistakes#RAII_and_hidden_destructor_calls
+    ImpostorAtlas(ImpostorAtlas& other) = delete;
+    ImpostorAtlas& operator= (ImpostorAtlas& other) = delete;
+
+    ~ImpostorAtlas();
+
+    // Move the objects in visible which are drawn smaller than their cells
+    // would be, with the given projection * view matrix, onto this frame's
+    // list of impostors. height is the height of the viewport, in pixels.
+    void select(const std::vector<ThreeDimensionalObject>& objects, std::vector<GLuint>& visible,
+        const glm::mat4& projView, int height);
+    // Draw this frame's impostors with program, which is impostor.vert and
+    // impostor.frag linked, rendering any layers they need first with
+    // bakeProgram, which is the same linked with BAKE defined. eye is the
+    // camera's position.
+    void draw(GLuint program, GLuint bakeProgram, const GeometryArena& arena, const glm::vec3& eye);
+
+    // Shader #defines for both programs
+    std::string shaderDefines() const;
+    // Point the samplers of a linked program at the units draw() binds the
+    // textures to
+    static void bindSamplers(GLuint program);
+    // Space needed in the stream buffer per frame
+    GLsizeiptr streamBytes(std::size_t objects) const { return instances.streamBytes(objects); }
+
+    const ImpostorStats& lastFrame() const { return stats; }
+};
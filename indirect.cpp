@@ -0,0 +1,128 @@
+#include "indirect.h"
+
+#include "glad.h"
+
+// Location of the draw ID attribute in default.vert
+#define DRAW_ID_ATTRIBUTE 3
+
+IndirectRenderer::IndirectRenderer(bool storageBuffer, StreamBuffer& stream) :
+    objectData(storageBuffer), stream(stream)
+{
+    // Each command's baseInstance is the index of the object it draws, which
+    // needs ARB_base_instance. Every implementation of
+    // ARB_multi_draw_indirect should have it anyway.
+    drawParameters = GLAD_GL_ARB_shader_draw_parameters;
+    multiDraw = GLAD_GL_ARB_draw_indirect && GLAD_GL_ARB_multi_draw_indirect &&
+        GLAD_GL_ARB_base_instance;
+}
+
+void IndirectRenderer::update(const std::vector<ThreeDimensionalObject>& objects, std::size_t first)
+{
+    std::vector<InstanceData> data;
+    data.reserve(objects.size() - first);
+    for (std::size_t i = first; i < objects.size(); i++) {
+        data.push_back(InstanceData::fromObject(objects[i]));
+    }
+    objectData.upload(data, first);
+
+    if (multiDraw && !drawParameters) {
+        std::vector<GLuint> ids(objects.size() - first);
+        for (GLuint i = 0; i < ids.size(); i++) {
+            ids[i] = first + i;
+        }
+        drawIDs.write(first * sizeof(GLuint), ids.size() * sizeof(GLuint), ids.data());
+    }
+}
+
+void IndirectRenderer::draw(
+    const std::vector<ThreeDimensionalObject>& objects,
+    const std::vector<GLuint>& visible,
+    const GeometryArena& arena,
+    GLint uniformInstanceBase,
+    bool positionsOnly)
+{
+    if (visible.empty()) return;
+    objectData.bind();
+    arena.bind(positionsOnly);
+
+    if (!multiDraw) {
+        for (GLuint i : visible) {
+            const Mesh* mesh = objects[i].getMesh();
+            glUniform1i(uniformInstanceBase, i);
+            glDrawElementsBaseVertex(
+                GL_TRIANGLES, mesh->indexCount, GL_UNSIGNED_INT,
+                mesh->indexOffset(), mesh->baseVertex
+            );
+        }
+        return;
+    }
+
+    GLintptr commandOffset;
+    DrawElementsIndirectCommand* commands = (DrawElementsIndirectCommand*) stream.allocate(
+        visible.size() * sizeof(DrawElementsIndirectCommand),
+        sizeof(GLuint), commandOffset);
+    if (!commands) return;
+    for (std::size_t i = 0; i < visible.size(); i++) {
+        const Mesh* mesh = objects[visible[i]].getMesh();
+        DrawElementsIndirectCommand& command = commands[i];
+        command.count = mesh->indexCount;
+        command.instanceCount = 1;
+        command.firstIndex = mesh->firstIndex;
+        command.baseVertex = mesh->baseVertex;
+        command.baseInstance = visible[i];
+    }
+    stream.flush();
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, stream.getBuffer());
+
+    beginMultiDraw();
+    glMultiDrawElementsIndirect(
+        GL_TRIANGLES, GL_UNSIGNED_INT, (const void*) commandOffset,
+        visible.size(), 0
+    );
+    endMultiDraw();
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void IndirectRenderer::draw(const GPUCulling& culling, const GeometryArena& arena, bool positionsOnly)
+{
+    if (!multiDraw) return;
+    objectData.bind();
+    arena.bind(positionsOnly);
+    beginMultiDraw();
+    culling.draw();
+    endMultiDraw();
+}
+
+void IndirectRenderer::beginMultiDraw() const
+{
+    if (drawParameters) return;
+    glBindBuffer(GL_ARRAY_BUFFER, drawIDs.getBuffer());
+    glVertexAttribIPointer(DRAW_ID_ATTRIBUTE, 1, GL_UNSIGNED_INT, sizeof(GLuint), nullptr);
+    glVertexAttribDivisor(DRAW_ID_ATTRIBUTE, 1);
+    glEnableVertexAttribArray(DRAW_ID_ATTRIBUTE);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void IndirectRenderer::endMultiDraw() const
+{
+    if (drawParameters) return;
+    // The vertex array is shared with the other render paths
+    glDisableVertexAttribArray(DRAW_ID_ATTRIBUTE);
+}
+
+GLsizeiptr IndirectRenderer::streamBytes(std::size_t objects)
+{
+    return objects * sizeof(DrawElementsIndirectCommand) + sizeof(GLuint);
+}
+
+std::string IndirectRenderer::shaderDefines() const
+{
+    std::string defines = "#define INSTANCED\n" + objectData.shaderDefines();
+    if (multiDraw) {
+        defines += "#define MULTIDRAW\n";
+        if (drawParameters) {
+            defines += "#define DRAW_PARAMETERS\n";
+        }
+    }
+    return defines;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "glad.h"
+#include "3dobject.h"
+#include "gpuculling.h"
+#include "instances.h"
+#include "mesh.h"
+#include "streambuffer.h"
+#include <string>
+#include <vector>
+
+// Layout of one command in the indirect buffer, as defined by
+// ARB_draw_indirect
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// Draws a list of objects with a single glMultiDrawElementsIndirect call.
+// Since all meshes live in the geometry arena, one vertex array serves every
+// draw. Each command's baseInstance is the index of its object, which the
+// vertex shader looks up the object's data by.
+//
+// Without ARB_multi_draw_indirect, falls back to one glDrawElementsBaseVertex
+// call per object, with the draw ID in a uniform.
+class IndirectRenderer {
+    private:
+    // Per-object data, indexed by object
+    InstanceBuffer objectData;
+    // The draw commands are rebuilt in here every frame
+    StreamBuffer& stream;
+    // Holds 0, 1, 2... Read as a per-instance attribute, so that it gives
+    // each command's baseInstance, where gl_BaseInstanceARB is unavailable.
+    GrowableBuffer drawIDs;
+    bool multiDraw;
+    bool drawParameters;
+
+    // Set up and tear down what the vertex shader reads the base instance
+    // from, around a multi-draw call
+    void beginMultiDraw() const;
+    void endMultiDraw() const;
+
+    public:
+    IndirectRenderer(bool storageBuffer, StreamBuffer& stream);
+
+    // Prevent copying! See: https://www.khronos.org/opengl/wiki/Common_Mistakes#RAII_and_hidden_destructor_calls
+    IndirectRenderer(IndirectRenderer& other) = delete;
+    IndirectRenderer& operator= (IndirectRenderer& other) = delete;
+
+    // Upload the per-object data of the objects from first on. Only needs to
+    // be called again when objects are added, removed or modified; when they
+    // are only added, first can skip the ones uploaded before.
+    void update(const std::vector<ThreeDimensionalObject>& objects, std::size_t first = 0);
+    // Build this frame's draw commands for the objects with the given
+    // indices, and submit them. uniformInstanceBase is only used by the
+    // fallback path. positionsOnly reads no other vertex attributes, for
+    // depth-only passes.
+    void draw(
+        const std::vector<ThreeDimensionalObject>& objects,
+        const std::vector<GLuint>& visible,
+        const GeometryArena& arena,
+        GLint uniformInstanceBase,
+        bool positionsOnly = false
+    );
+    // Submit the draw commands written by GPU culling. Needs multi-draw
+    // indirect.
+    void draw(const GPUCulling& culling, const GeometryArena& arena, bool positionsOnly = false);
+
+    std::string shaderDefines() const;
+    // Space needed in the stream buffer per frame
+    static GLsizeiptr streamBytes(std::size_t objects);
+    bool usesMultiDraw() const { return multiDraw; }
+};
@@ -16,6 +16,7 @@ static KeyInputState curKeyState {
     false, // bool wireframe;
     true, // bool lit;
     true, // bool animate;
+    0, // int gearRows;
 };
 
 static MouseInputState curMouseState {
@@ -86,6 +87,9 @@ void Input::onKeyAction( GLFWwindow* window, int k, int s, int action, int mods
     case GLFW_KEY_T:
         curKeyState.animate = !curKeyState.animate;
         break;
+    case GLFW_KEY_G:
+        curKeyState.gearRows++;
+        break;
     }
 }
 
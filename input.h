@@ -16,6 +16,8 @@ struct KeyInputState {
     bool wireframe;
     bool lit;
     bool animate;
+    // Rows of gears asked for so far
+    int gearRows;
 };
 
 struct MouseInputState {
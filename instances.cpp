@@ -0,0 +1,285 @@
+#include "instances.h"
+
+#include "glad.h"
+#include <algorithm>
+#include <cstdio>
+
+// Number of RGBA32F texels per instance in the texture buffer
+#define TEXELS_PER_INSTANCE (sizeof(InstanceData) / (4 * sizeof(GLfloat)))
+// Where the vertex shader reads the instanced renderer's index list from: a
+// shader storage block binding, or a texture unit. Binding 0, and units 0 to
+// 10, are taken by the instance data, clustered lighting, the visibility
+// buffer and the impostor atlas.
+#define INSTANCE_INDEX_BINDING 1
+#define INSTANCE_INDEX_UNIT 11
+
+InstanceData InstanceData::fromObject(const ThreeDimensionalObject& obj)
+{
+    return {
+        {obj.position.x, obj.position.y, obj.position.z},
+        obj.angleMultiply,
+        {obj.colour.x, obj.colour.y, obj.colour.z},
+        obj.angleAdd,
+        {obj.scale.x, obj.scale.y, obj.scale.z},
+        (GLfloat) obj.getMesh()->id
+    };
+}
+
+GrowableBuffer::~GrowableBuffer()
+{
+    if (buffer) glDeleteBuffers(1, &buffer);
+}
+
+bool GrowableBuffer::reserve(GLsizeiptr bytes, GLsizeiptr keep)
+{
+    if (bytes <= capacity) return false;
+    GLsizeiptr newCapacity = std::max(bytes, capacity * 2);
+    GLuint newBuffer;
+    glGenBuffers(1, &newBuffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, newCapacity, nullptr, usage);
+    if (buffer && keep > 0) {
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, std::min(keep, capacity));
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    if (buffer) glDeleteBuffers(1, &buffer);
+    buffer = newBuffer;
+    capacity = newCapacity;
+    return true;
+}
+
+bool GrowableBuffer::write(GLintptr offset, GLsizeiptr bytes, const void* data)
+{
+    bool replaced = reserve(offset + bytes, offset);
+    if (bytes > 0) {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, offset, bytes, data);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+    return replaced;
+}
+
+InstanceBuffer::InstanceBuffer(bool storageBuffer) :
+    texture(0), storageBuffer(storageBuffer), maxTexels(0)
+{
+    if (!storageBuffer) {
+        glGenTextures(1, &texture);
+        glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+    }
+}
+
+InstanceBuffer::~InstanceBuffer()
+{
+    if (texture) glDeleteTextures(1, &texture);
+}
+
+void InstanceBuffer::upload(const std::vector<InstanceData>& instances, std::size_t first)
+{
+    bool replaced = buffer.write(
+        first * sizeof(InstanceData),
+        instances.size() * sizeof(InstanceData),
+        instances.data()
+    );
+
+    if (!storageBuffer) {
+        std::size_t count = first + instances.size();
+        if (count * TEXELS_PER_INSTANCE > (std::size_t) maxTexels) {
+            fprintf(stderr,
+                "%zu instances do not fit in a texture buffer of %d texels!\n",
+                count, maxTexels);
+        }
+        if (replaced) {
+            glBindTexture(GL_TEXTURE_BUFFER, texture);
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer.getBuffer());
+            glBindTexture(GL_TEXTURE_BUFFER, 0);
+        }
+    }
+}
+
+void InstanceBuffer::bind() const
+{
+    if (storageBuffer) {
+        // The shader leaves the block at its default binding, which is 0
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, buffer.getBuffer());
+    } else {
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_BUFFER, texture);
+    }
+}
+
+std::string InstanceBuffer::shaderDefines() const
+{
+    return storageBuffer ? "#define INSTANCES_SSBO\n" : "";
+}
+
+StreamedArray::StreamedArray(StreamBuffer& stream, bool storageBuffer, GLuint binding, GLenum format,
+    GLsizeiptr elementSize) :
+    stream(stream), storageBuffer(storageBuffer), binding(binding), format(format),
+    elementSize(elementSize), texture(0), maxTexels(0), offset(0), size(0), first(0)
+{
+    textureRange = !storageBuffer && GLAD_GL_ARB_texture_buffer_range;
+    if (storageBuffer) {
+        glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    } else {
+        glGenTextures(1, &texture);
+        glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+        if (textureRange) {
+            glGetIntegerv(GL_TEXTURE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        } else {
+            // The array has to start on a whole element of the texture
+            // buffer
+            alignment = elementSize;
+        }
+    }
+}
+
+StreamedArray::~StreamedArray()
+{
+    if (texture) glDeleteTextures(1, &texture);
+}
+
+void* StreamedArray::allocate(std::size_t count)
+{
+    size = count * elementSize;
+    void* data = stream.allocate(size, alignment, offset);
+    if (!data) size = 0;
+    return data;
+}
+
+void StreamedArray::finish()
+{
+    stream.flush();
+    first = 0;
+    if (storageBuffer || size == 0) return;
+
+    // A texture buffer only reaches its first maxTexels texels
+    GLsizeiptr texelSize = format == GL_R32UI ? sizeof(GLuint) : 4 * sizeof(GLfloat);
+    GLintptr start = textureRange ? 0 : offset;
+    if ((start + size) / texelSize > maxTexels) {
+        fprintf(stderr, "%ld bytes do not fit in a texture buffer of %d texels!\n",
+            (long) (start + size), maxTexels);
+    }
+    // The stream buffer is replaced when it grows, so the texture is
+    // pointed at it again every frame
+    glBindTexture(GL_TEXTURE_BUFFER, texture);
+    if (textureRange) {
+        glTexBufferRange(GL_TEXTURE_BUFFER, format, stream.getBuffer(), offset, size);
+    } else {
+        glTexBuffer(GL_TEXTURE_BUFFER, format, stream.getBuffer());
+        first = offset / elementSize;
+    }
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+void StreamedArray::bind() const
+{
+    if (storageBuffer) {
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, stream.getBuffer(), offset, size);
+    } else {
+        glActiveTexture(GL_TEXTURE0 + binding);
+        glBindTexture(GL_TEXTURE_BUFFER, texture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+}
+
+std::string StreamedArray::shaderDefines() const
+{
+    return storageBuffer ? "#define INSTANCES_SSBO\n" : "";
+}
+
+InstancedRenderer::InstancedRenderer(bool storageBuffer, StreamBuffer& stream) :
+    instances(storageBuffer),
+    indices(stream, storageBuffer, storageBuffer ? INSTANCE_INDEX_BINDING : INSTANCE_INDEX_UNIT,
+        GL_R32UI, sizeof(GLuint))
+{
+}
+
+void InstancedRenderer::update(const std::vector<ThreeDimensionalObject>& objects, std::size_t first)
+{
+    std::vector<InstanceData> data;
+    data.reserve(objects.size() - first);
+    if (first == 0) meshes.clear();
+    objectMeshes.resize(objects.size());
+    for (std::size_t i = first; i < objects.size(); i++) {
+        const Mesh* mesh = objects[i].getMesh();
+        if (mesh->id >= meshes.size()) {
+            meshes.resize(mesh->id + 1, nullptr);
+        }
+        meshes[mesh->id] = mesh;
+        objectMeshes[i] = mesh->id;
+        data.push_back(InstanceData::fromObject(objects[i]));
+    }
+    instances.upload(data, first);
+}
+
+void InstancedRenderer::select(const std::vector<GLuint>& visible)
+{
+    batches.clear();
+    if (visible.empty()) return;
+
+    // Count the visible objects of each mesh, and lay the meshes' runs out
+    // one after another in order of Mesh::id
+    meshCounts.assign(meshes.size(), 0);
+    for (GLuint i : visible) {
+        meshCounts[objectMeshes[i]]++;
+    }
+    GLuint first = 0;
+    for (std::size_t id = 0; id < meshes.size(); id++) {
+        GLuint count = meshCounts[id];
+        if (count == 0) continue;
+        batches.push_back({meshes[id], (GLint) first, (GLsizei) count});
+        // From here on, where the next index of the mesh goes
+        meshCounts[id] = first;
+        first += count;
+    }
+
+    GLuint* list = (GLuint*) indices.allocate(visible.size());
+    if (!list) {
+        batches.clear();
+        return;
+    }
+    for (GLuint i : visible) {
+        list[meshCounts[objectMeshes[i]]++] = i;
+    }
+    indices.finish();
+}
+
+void InstancedRenderer::draw(const GeometryArena& arena, GLint uniformInstanceBase, bool positionsOnly) const
+{
+    if (batches.empty()) return;
+    instances.bind();
+    indices.bind();
+    arena.bind(positionsOnly);
+
+    // GL 3.3 has no base instance, so the offset of each batch into the
+    // index list is passed in a uniform instead.
+    for (const Batch& batch : batches) {
+        glUniform1i(uniformInstanceBase, indices.base() + batch.first);
+        glDrawElementsInstancedBaseVertex(
+            GL_TRIANGLES, batch.mesh->indexCount, GL_UNSIGNED_INT,
+            batch.mesh->indexOffset(), batch.count, batch.mesh->baseVertex
+        );
+    }
+}
+
+std::string InstancedRenderer::shaderDefines() const
+{
+    return "#define INSTANCED\n#define INSTANCE_INDICES\n" + instances.shaderDefines();
+}
+
+void InstancedRenderer::bindSamplers(GLuint program)
+{
+    GLint location = glGetUniformLocation(program, "instanceIndices");
+    if (location >= 0) {
+        glUseProgram(program);
+        glUniform1i(location, INSTANCE_INDEX_UNIT);
+    }
+    if (GLAD_GL_ARB_program_interface_query) {
+        GLuint index = glGetProgramResourceIndex(program, GL_SHADER_STORAGE_BLOCK, "InstanceIndices");
+        if (index != GL_INVALID_INDEX) {
+            glShaderStorageBlockBinding(program, index, INSTANCE_INDEX_BINDING);
+        }
+    }
+}
@@ -0,0 +1,181 @@
+#pragma once
+
+#include "glad.h"
+#include "3dobject.h"
+#include "mesh.h"
+#include "streambuffer.h"
+#include <string>
+#include <vector>
+
+// Per-instance data, as laid out in the instance buffer. It is made of three
+// vec4s, so that it can be fetched as RGBA32F texels from a texture buffer, or
+// read as a std430 struct from a shader storage buffer.
+struct InstanceData {
+    GLfloat position[3];
+    GLfloat angleMultiply;
+    GLfloat colour[3];
+    GLfloat angleAdd;
+    GLfloat scale[3];
+    // Mesh::id of the object's mesh, which the visibility buffer's resolve
+    // pass looks its triangles up by
+    GLfloat mesh;
+
+    static InstanceData fromObject(const ThreeDimensionalObject& obj);
+};
+
+// A buffer of per-object data which objects can be added to a few at a time.
+// It keeps room to spare, and once that runs out, is replaced by one at
+// least twice the size, which the data so far is copied into on the GPU.
+class GrowableBuffer {
+    private:
+    GLuint buffer;
+    GLsizeiptr capacity;
+    GLenum usage;
+
+    public:
+    GrowableBuffer(GLenum usage = GL_STATIC_DRAW) : buffer(0), capacity(0), usage(usage) {}
+
+    // Prevent copying! See: https://www.khronos.org/opengl/wiki/Common_Mistakes#RAII_and_hidden_destructor_calls
+    GrowableBuffer(GrowableBuffer& other) = delete;
+    GrowableBuffer& operator= (GrowableBuffer& other) = delete;
+
+    ~GrowableBuffer();
+
+    // Make room for at least the given number of bytes, keeping the first
+    // keep bytes. Returns whether the buffer was replaced, so that anything
+    // which refers to it can be pointed at the new one.
+    bool reserve(GLsizeiptr bytes, GLsizeiptr keep);
+    // Write data at offset, making room for it first. Everything before
+    // offset is kept.
+    bool write(GLintptr offset, GLsizeiptr bytes, const void* data);
+
+    GLuint getBuffer() const { return buffer; }
+};
+
+// GPU copy of an array of InstanceData, readable by the vertex shader. It is
+// a shader storage buffer where supported, and a texture buffer on plain
+// OpenGL 3.3.
+class InstanceBuffer {
+    private:
+    GrowableBuffer buffer;
+    // Texture buffer view of the buffer; unused with an SSBO
+    GLuint texture;
+    bool storageBuffer;
+    // GL_MAX_TEXTURE_BUFFER_SIZE, in texels
+    GLint maxTexels;
+
+    public:
+    InstanceBuffer(bool storageBuffer);
+
+    // Prevent copying! See: https://www.khronos.org/opengl/wiki/Common_Mistakes#RAII_and_hidden_destructor_calls
+    InstanceBuffer(InstanceBuffer& other) = delete;
+    InstanceBuffer& operator= (InstanceBuffer& other) = delete;
+
+    ~InstanceBuffer();
+
+    // Upload instances as the ones from index first on, keeping the ones
+    // before it from the last upload
+    void upload(const std::vector<InstanceData>& instances, std::size_t first = 0);
+    // Make the instances visible to the vertex shader
+    void bind() const;
+    // Shader #defines for reading this buffer
+    std::string shaderDefines() const;
+};
+
+// An array written into the stream buffer every frame, which shaders read
+// the same ways as an InstanceBuffer. A shader storage block is bound to just
+// this frame's part of the stream buffer. So is a texture buffer, with
+// ARB_texture_buffer_range; without it, the texture buffer covers the whole
+// stream buffer, and the array starts at element base() of it.
+class StreamedArray {
+    private:
+    StreamBuffer& stream;
+    bool storageBuffer;
+    bool textureRange;
+    // Shader storage block binding, or texture unit, it is bound to
+    GLuint binding;
+    // Texel format of the texture buffer
+    GLenum format;
+    GLsizeiptr elementSize;
+    // Texture buffer view of the stream buffer; unused with an SSBO
+    GLuint texture;
+    // Alignment of the array's offset in the stream buffer
+    GLint alignment;
+    // GL_MAX_TEXTURE_BUFFER_SIZE, in texels
+    GLint maxTexels;
+    // This frame's part of the stream buffer
+    GLintptr offset;
+    GLsizeiptr size;
+    GLint first;
+
+    public:
+    StreamedArray(StreamBuffer& stream, bool storageBuffer, GLuint binding, GLenum format,
+        GLsizeiptr elementSize);
+
+    // Prevent copying! See: https://www.khronos.org/opengl/wiki/Common_Mistakes#RAII_and_hidden_destructor_calls
+    StreamedArray(StreamedArray& other) = delete;
+    StreamedArray& operator= (StreamedArray& other) = delete;
+
+    ~StreamedArray();
+
+    // Room for this frame's array of count elements, or nullptr if the
+    // stream buffer is full. Call finish() once they are written.
+    void* allocate(std::size_t count);
+    // Make the elements written visible to the GPU
+    void finish();
+    // Make them visible to the shaders. Needs a non-empty array.
+    void bind() const;
+    // Index of the array's first element in what the shaders see
+    GLint base() const { return first; }
+    // Shader #defines for reading the array; the same as InstanceBuffer's
+    std::string shaderDefines() const;
+    // Space needed in the stream buffer per frame
+    GLsizeiptr streamBytes(std::size_t count) const { return count * elementSize + alignment; }
+};
+
+// Draws many objects with one glDrawElementsInstanced call per unique mesh.
+//
+// Every object's instance data is uploaded once, in the order of the
+// objects. Each frame, the indices of the visible objects are written into
+// the stream buffer, grouped by mesh, and the vertex shader looks their
+// instance data up through them.
+class InstancedRenderer {
+    private:
+    // A run of indices in this frame's list which share the same mesh
+    struct Batch {
+        const Mesh* mesh;
+        GLint first;
+        GLsizei count;
+    };
+    std::vector<Batch> batches;
+    InstanceBuffer instances;
+    StreamedArray indices;
+    // Mesh::id of each object, and the meshes by Mesh::id
+    std::vector<GLuint> objectMeshes;
+    std::vector<const Mesh*> meshes;
+    // Visible objects of each mesh, counted by select()
+    std::vector<GLuint> meshCounts;
+
+    public:
+    InstancedRenderer(bool storageBuffer, StreamBuffer& stream);
+
+    // Upload the instance data of the objects from first on. Only needs to
+    // be called again when objects are added, removed or modified; when they
+    // are only added, first can skip the ones uploaded before.
+    void update(const std::vector<ThreeDimensionalObject>& objects, std::size_t first = 0);
+    // Write this frame's list of the objects to draw, which holds their
+    // indices, grouped by mesh. Call every frame, after the stream buffer's
+    // beginFrame().
+    void select(const std::vector<GLuint>& visible);
+    // Draw every batch. uniformInstanceBase is the location of the uniform
+    // holding the index of the batch's first entry in the list.
+    // positionsOnly reads no other vertex attributes, for depth-only passes.
+    void draw(const GeometryArena& arena, GLint uniformInstanceBase, bool positionsOnly = false) const;
+
+    std::string shaderDefines() const;
+    // Point the index list of a linked program at where draw() binds it
+    static void bindSamplers(GLuint program);
+    // Space needed in the stream buffer per frame
+    GLsizeiptr streamBytes(std::size_t objects) const { return indices.streamBytes(objects); }
+    std::size_t batchCount() const { return batches.size(); }
+};
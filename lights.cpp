@@ -0,0 +1,294 @@
+#include "lights.h"
+
+#include "glad.h"
+#include "uniforms.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+// Texture units of the texture buffers; unit 0 is left to the instance data
+#define LIGHT_DATA_UNIT 1
+#define CLUSTER_UNIT 2
+#define LIGHT_INDEX_UNIT 3
+// Number of RGBA32F texels per light
+#define TEXELS_PER_LIGHT 2
+// View depths which the slices are spread between. Anything nearer is in the
+// first slice, and anything further in the last.
+#define CLUSTER_NEAR .5f
+#define CLUSTER_FAR 256.f
+#define CLUSTER_COUNT (CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z)
+
+// Slices are spaced exponentially, so that the slice of a view depth is
+// linear in its log: log(depth) * SLICE_SCALE + SLICE_BIAS
+static const float SLICE_SCALE = CLUSTERS_Z / std::log(CLUSTER_FAR / CLUSTER_NEAR);
+static const float SLICE_BIAS = -std::log(CLUSTER_NEAR) * SLICE_SCALE;
+
+ClusteredLights::ClusteredLights(StreamBuffer& stream) :
+    stream(stream), stats()
+{
+    GLuint buffers[3], textures[3];
+    glGenBuffers(3, buffers);
+    glGenTextures(3, textures);
+    lightBuffer = buffers[0];
+    clusterBuffer = buffers[1];
+    indexBuffer = buffers[2];
+    lightTexture = textures[0];
+    clusterTexture = textures[1];
+    indexTexture = textures[2];
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxIndices);
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+}
+
+ClusteredLights::~ClusteredLights()
+{
+    GLuint buffers[3] = {lightBuffer, clusterBuffer, indexBuffer};
+    GLuint textures[3] = {lightTexture, clusterTexture, indexTexture};
+    glDeleteTextures(3, textures);
+    glDeleteBuffers(3, buffers);
+}
+
+void ClusteredLights::scatter(const std::vector<ThreeDimensionalObject>& objects, int count)
+{
+    glm::vec3 min(INFINITY), max(-INFINITY);
+    for (const ThreeDimensionalObject& object : objects) {
+        glm::vec3 position(object.position.x, object.position.y, object.position.z);
+        min = glm::min(min, position);
+        max = glm::max(max, position);
+    }
+    // Fixed seed, so that every run looks the same
+    std::minstd_rand random(2);
+    std::uniform_real_distribution<float> unit(0., 1.);
+    lights.reserve(lights.size() + count);
+    orbits.reserve(orbits.size() + count);
+    for (int i = 0; i < count; i++) {
+        // Draw the random numbers in a fixed order; the order in which
+        // function arguments are evaluated is unspecified.
+        PointLight light;
+        light.position.x = min.x + unit(random) * (max.x - min.x);
+        light.position.y = min.y + unit(random) * (max.y - min.y);
+        // Just above the gears
+        light.position.z = min.z + 1.f + unit(random) * (max.z - min.z + 1.f);
+        light.radius = 3.f + unit(random) * 3.f;
+        light.colour.x = unit(random);
+        light.colour.y = unit(random);
+        light.colour.z = unit(random);
+        // As bright as can be, in whatever colour it is
+        light.colour = light.colour *
+            (1.f / std::max(light.colour.x, std::max(light.colour.y, std::max(light.colour.z, .001f))));
+        Orbit orbit;
+        orbit.radius = .5f + unit(random) * 2.5f;
+        orbit.speed = (unit(random) - .5f) * 4.f;
+        orbit.phase = unit(random) * 6.2831853f;
+        lights.push_back(light);
+        orbits.push_back(orbit);
+    }
+}
+
+static int sliceOf(float depth)
+{
+    if (depth <= CLUSTER_NEAR) return 0;
+    int slice = (int) std::floor(std::log(depth) * SLICE_SCALE + SLICE_BIAS);
+    return std::min(std::max(slice, 0), CLUSTERS_Z - 1);
+}
+
+// Cluster column or row of a coordinate in normalized device coordinates
+static int tileOf(float ndc, int tiles)
+{
+    int tile = (int) std::floor((ndc * .5f + .5f) * tiles);
+    return std::min(std::max(tile, 0), tiles - 1);
+}
+
+// View depths at which a slice starts and ends, widened a little, so that
+// rounding in the fragment shader cannot put a fragment in a slice its
+// lights were not assigned to
+static float sliceStart(int slice)
+{
+    if (slice == 0) return 0.f;
+    return std::exp((slice - SLICE_BIAS) / SLICE_SCALE) * .99f;
+}
+
+static float sliceEnd(int slice)
+{
+    if (slice == CLUSTERS_Z - 1) return INFINITY;
+    return std::exp((slice + 1 - SLICE_BIAS) / SLICE_SCALE) * 1.01f;
+}
+
+void ClusteredLights::addClusterRanges(GLuint light, const glm::vec3& centre, float radius,
+    const glm::mat4& projection)
+{
+    // The camera looks down -Z in view space
+    float depth = -centre.z;
+    float nearest = depth - radius, furthest = depth + radius;
+    if (furthest <= 0.f) return;
+    int firstSlice = sliceOf(nearest), lastSlice = sliceOf(furthest);
+
+    // Bound the part of the sphere within each slice separately: a slice
+    // which only cuts through the top or bottom of the sphere covers less of
+    // the screen than the whole of it does
+    for (int slice = firstSlice; slice <= lastSlice; slice++) {
+        float start = std::max(nearest, sliceStart(slice));
+        float end = std::min(furthest, sliceEnd(slice));
+        // Radius of the widest circle of the sphere between those depths
+        float offset = depth < start ? start - depth : depth > end ? depth - end : 0.f;
+        float width = std::sqrt(std::max(radius * radius - offset * offset, 0.f));
+
+        // Screen bounds of the box around that part. A box reaching behind
+        // the camera could cover any part of the screen.
+        float minX = -1.f, maxX = 1.f, minY = -1.f, maxY = 1.f;
+        if (start > 0.f) {
+            minX = minY = INFINITY;
+            maxX = maxY = -INFINITY;
+            for (int corner = 0; corner < 8; corner++) {
+                glm::vec4 clip = projection * glm::vec4(
+                    centre.x + (corner & 1 ? width : -width),
+                    centre.y + (corner & 2 ? width : -width),
+                    corner & 4 ? -start : -end, 1.f);
+                minX = std::min(minX, clip.x / clip.w);
+                maxX = std::max(maxX, clip.x / clip.w);
+                minY = std::min(minY, clip.y / clip.w);
+                maxY = std::max(maxY, clip.y / clip.w);
+            }
+            if (maxX < -1.f || minX > 1.f || maxY < -1.f || minY > 1.f) continue;
+        }
+        ClusterRange range;
+        range.light = light;
+        range.slice = slice;
+        range.minX = tileOf(minX, CLUSTERS_X);
+        range.maxX = tileOf(maxX, CLUSTERS_X);
+        range.minY = tileOf(minY, CLUSTERS_Y);
+        range.maxY = tileOf(maxY, CLUSTERS_Y);
+        ranges.push_back(range);
+    }
+}
+
+void ClusteredLights::upload(GLuint buffer, GLuint texture, GLenum format, const void* data, GLsizeiptr size)
+{
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    // Orphan last frame's storage, which the GPU may still be reading. Never
+    // empty, so that the texture always has some storage to refer to.
+    glBufferData(GL_TEXTURE_BUFFER, std::max<GLsizeiptr>(size, 16), nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_BUFFER, texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+}
+
+void ClusteredLights::update(const glm::mat4& view, const glm::mat4& projection, int width, int height, float time)
+{
+    auto startTime = std::chrono::steady_clock::now();
+    stats = ClusteredLightsStats();
+    stats.lights = lights.size();
+
+    // Move the lights, and find the clusters they touch
+    lightData.resize(lights.size() * TEXELS_PER_LIGHT * 4);
+    ranges.clear();
+    for (std::size_t i = 0; i < lights.size(); i++) {
+        const PointLight& light = lights[i];
+        const Orbit& orbit = orbits[i];
+        float angle = orbit.speed * time + orbit.phase;
+        glm::vec3 position = light.position +
+            glm::vec3(std::cos(angle) * orbit.radius, std::sin(angle) * orbit.radius, 0.f);
+        GLfloat* texels = &lightData[i * TEXELS_PER_LIGHT * 4];
+        texels[0] = position.x;
+        texels[1] = position.y;
+        texels[2] = position.z;
+        texels[3] = light.radius;
+        texels[4] = light.colour.x;
+        texels[5] = light.colour.y;
+        texels[6] = light.colour.z;
+        texels[7] = 0.f;
+
+        std::size_t before = ranges.size();
+        glm::vec3 centre(view * glm::vec4(position, 1.f));
+        addClusterRanges(i, centre, light.radius, projection);
+        if (ranges.size() > before) stats.lightsInView++;
+    }
+
+    // Count the lights in each cluster
+    clusterData.assign(CLUSTER_COUNT * 2, 0);
+    for (const ClusterRange& range : ranges) {
+        for (int y = range.minY; y <= range.maxY; y++) {
+            for (int x = range.minX; x <= range.maxX; x++) {
+                clusterData[((range.slice * CLUSTERS_Y + y) * CLUSTERS_X + x) * 2 + 1]++;
+            }
+        }
+    }
+
+    // Give each cluster its place in the index list, and fill it in
+    GLuint total = 0;
+    for (int cluster = 0; cluster < CLUSTER_COUNT; cluster++) {
+        GLuint count = clusterData[cluster * 2 + 1];
+        stats.maxPerCluster = std::max(stats.maxPerCluster, count);
+        clusterData[cluster * 2] = total;
+        clusterData[cluster * 2 + 1] = 0;
+        total += count;
+    }
+    if (total > (GLuint) maxIndices) {
+        fprintf(stderr, "%u light indices do not fit in a texture buffer of %d texels!\n",
+            total, maxIndices);
+        total = maxIndices;
+    }
+    indices.resize(total);
+    for (const ClusterRange& range : ranges) {
+        for (int y = range.minY; y <= range.maxY; y++) {
+            for (int x = range.minX; x <= range.maxX; x++) {
+                GLuint* cluster = &clusterData[((range.slice * CLUSTERS_Y + y) * CLUSTERS_X + x) * 2];
+                // Clusters past the end of a full list lose their lights
+                if (cluster[0] + cluster[1] >= total) continue;
+                indices[cluster[0] + cluster[1]++] = range.light;
+            }
+        }
+    }
+    stats.indices = total;
+
+    glActiveTexture(GL_TEXTURE0 + LIGHT_DATA_UNIT);
+    upload(lightBuffer, lightTexture, GL_RGBA32F, lightData.data(), lightData.size() * sizeof(GLfloat));
+    glActiveTexture(GL_TEXTURE0 + CLUSTER_UNIT);
+    upload(clusterBuffer, clusterTexture, GL_RG32UI, clusterData.data(), clusterData.size() * sizeof(GLuint));
+    glActiveTexture(GL_TEXTURE0 + LIGHT_INDEX_UNIT);
+    upload(indexBuffer, indexTexture, GL_R32UI, indices.data(), indices.size() * sizeof(GLuint));
+    glActiveTexture(GL_TEXTURE0);
+
+    LightUniforms block = {
+        {(GLfloat) CLUSTERS_X / width, (GLfloat) CLUSTERS_Y / height, SLICE_SCALE, SLICE_BIAS},
+        {CLUSTERS_X, CLUSTERS_Y, CLUSTERS_Z, 0}
+    };
+    GLintptr offset;
+    void* data = stream.allocate(sizeof(block), alignment, offset);
+    if (data) {
+        memcpy(data, &block, sizeof(block));
+        stream.flush();
+        glBindBufferRange(GL_UNIFORM_BUFFER, LIGHTS_BINDING, stream.getBuffer(), offset, sizeof(block));
+    }
+
+    stats.milliseconds = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - startTime).count();
+}
+
+void ClusteredLights::bindSamplers(GLuint program)
+{
+    const struct {
+        const char* name;
+        GLint unit;
+    } samplers[] = {
+        {"lightData", LIGHT_DATA_UNIT},
+        {"clusters", CLUSTER_UNIT},
+        {"lightIndices", LIGHT_INDEX_UNIT},
+    };
+    glUseProgram(program);
+    for (const auto& sampler : samplers) {
+        GLint location = glGetUniformLocation(program, sampler.name);
+        if (location >= 0) {
+            glUniform1i(location, sampler.unit);
+        }
+    }
+}
+
+GLsizeiptr ClusteredLights::streamBytes() const
+{
+    // Allow for padding in front of the block
+    return sizeof(LightUniforms) + alignment;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "glad.h"
+#include "3dobject.h"
+#include "streambuffer.h"
+#include <glm/glm.hpp>
+#include <vector>
+
+// Size of the cluster grid: tiles across and down the screen, and slices of
+// view depth
+#define CLUSTERS_X 16
+#define CLUSTERS_Y 9
+#define CLUSTERS_Z 24
+
+// A point light, which lights everything within radius of it, fading out
+// towards the edge
+struct PointLight {
+    glm::vec3 position;
+    float radius;
+    glm::vec3 colour;
+};
+
+// std140 layout of the Lights block in default.frag
+struct LightUniforms {
+    // Clusters per pixel across and down, and the scale and bias which turn
+    // the log of view depth into a slice
+    GLfloat clusterScale[4];
+    GLint clusterCount[4];
+};
+
+struct ClusteredLightsStats {
+    unsigned int lights;
+    // Lights touching at least one cluster
+    unsigned int lightsInView;
+    // Entries in the light index list, over all clusters
+    unsigned int indices;
+    unsigned int maxPerCluster;
+    // Time taken by update(), in milliseconds
+    double milliseconds;
+};
+
+// Clustered forward lighting. The view frustum is split into a grid of
+// clusters, each a tile of the screen between two depths, which are spaced
+// exponentially. Every frame, each light is added to the list of every
+// cluster which the bounds of its sphere touch, slice by slice, and the
+// fragment shader only loops over the lights of the cluster it is in.
+//
+// The lists are packed into one array of light indices, with the offset and
+// length of each cluster's list in another. Both, and the lights, are read
+// through texture buffers, which OpenGL 3.3 has.
+class ClusteredLights {
+    private:
+    // The lights, as they are before they move
+    std::vector<PointLight> lights;
+    struct Orbit {
+        float radius;
+        // Radians per second
+        float speed;
+        float phase;
+    };
+    std::vector<Orbit> orbits;
+    // Buffers read by the fragment shader, and their texture buffer views
+    GLuint lightBuffer, clusterBuffer, indexBuffer;
+    GLuint lightTexture, clusterTexture, indexTexture;
+    GLint maxIndices;
+    StreamBuffer& stream;
+    // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+    GLint alignment;
+    // The clusters a light touches in one slice, from first to last across
+    // and down
+    struct ClusterRange {
+        GLuint light;
+        int slice;
+        int minX, maxX, minY, maxY;
+    };
+    // Scratch space, kept to save reallocating it every frame
+    std::vector<GLfloat> lightData;
+    std::vector<ClusterRange> ranges;
+    std::vector<GLuint> clusterData;
+    std::vector<GLuint> indices;
+    ClusteredLightsStats stats;
+
+    // Add the clusters which the light's sphere, given in view space, may
+    // touch to ranges, one slice at a time
+    void addClusterRanges(GLuint light, const glm::vec3& centre, float radius,
+        const glm::mat4& projection);
+    void upload(GLuint buffer, GLuint texture, GLenum format, const void* data, GLsizeiptr size);
+
+    public:
+    ClusteredLights(StreamBuffer& stream);
+
+    // Prevent copying! See: https://www.khronos.org/opengl/wiki/Common_Mistakes#RAII_and_hidden_destructor_calls
+    ClusteredLights(ClusteredLights& other) = delete;
+    ClusteredLights& operator= (ClusteredLights& other) = delete;
+
+    ~ClusteredLights();
+
+    // Scatter count lights of assorted colours over the objects, each
+    // circling a point of its own
+    void scatter(const std::vector<ThreeDimensionalObject>& objects, int count);
+    // Move the lights to where they are at the given animation time, assign
+    // them to clusters, and upload and bind the result. width and height are
+    // the size of the viewport, in pixels.
+    void update(const glm::mat4& view, const glm::mat4& projection, int width, int height, float time);
+
+    // Point the texture buffer samplers of a linked program at the units
+    // update() binds the buffers to
+    static void bindSamplers(GLuint program);
+    // Space needed in the stream buffer per frame
+    GLsizeiptr streamBytes() const;
+    static const char* shaderDefines() { return "#define CLUSTERED_LIGHTS\n"; }
+    const ClusteredLightsStats& lastFrame() const { return stats; }
+};
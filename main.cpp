@@ -4,6 +4,57 @@
  * Command line options:
  *    -info      print GL implementation information
  *    -exit      automatically exit after 30 seconds
+ *    -bench-extrude  time triangulation and extrusion of a large profile
+ *    -gears <n>  add a field of n extra gears
+ *    -instanced  draw with one instanced draw call per mesh
+ *    -indirect  draw everything with one multi-draw-indirect call
+ *    -gpu-cull  cull with a compute shader, which writes the multi-draw-indirect
+ *               commands
+ *    -occlusion  leave out clusters of gears hidden behind others, found with
+ *                occlusion queries
+ *    -soft-occlusion  leave out gears hidden behind the largest ones in view,
+ *                     found with a depth buffer rasterized on the CPU
+ *    -no-ssbo   read instance data from a texture buffer, even if shader
+ *               storage buffers are supported
+ *    -bench-submit  time the CPU cost of submitting a frame with each render
+ *                   path, at 1k, 10k and 100k gears
+ *    -stats     print rendering statistics once a second
+ *    -no-state-cache  pass every state change on to OpenGL, even redundant
+ *                     ones
+ *    -no-dsa    create meshes with the GL 3.3 bind-to-edit functions, even if
+ *               direct state access is supported
+ *    -bench-create  time creating 10k meshes, with and without direct state
+ *                   access and batching
+ *    -layout <planar|interleaved|mixed>  how vertex attributes are packed
+ *                                        into the vertex buffer
+ *    -bench-layout  time vertex processing with each vertex layout
+ *    -no-cull   draw every object, even those outside the view frustum
+ *    -lights <n>  add n moving point lights, shaded with clustered forward
+ *                 lighting
+ *    -depth-prepass <auto|always>  draw the depth of the scene before its
+ *                                  colour, so that each pixel is shaded
+ *                                  once; automatically, whenever the
+ *                                  measured overdraw is high, or always
+ *    -visibility-buffer  draw which triangle covers each pixel, then shade
+ *                        each pixel once in a full-screen pass; not with
+ *                        the per-object path
+ *    -bench-visibility  time forward and visibility buffer rendering as the
+ *                       gears' triangles get smaller
+ *    -dynamic-resolution <ms>  render at a lower resolution, scaled up to
+ *                              the window, whenever the GPU takes more than
+ *                              the given milliseconds per frame
+ *    -impostors  draw distant gears as quads textured from pictures of their
+ *                meshes; not with -gpu-cull
+ *    -no-program-cache  compile every shader, instead of loading the
+ *                       programs linked on earlier runs
+ *    -watch-shaders  rebuild the shader programs whenever their files are
+ *                    saved, drawing with the old ones until the new ones
+ *                    are linked
+ *    -no-parallel-compile  link programs on the main thread, even if
+ *                          KHR_parallel_shader_compile is supported
+ *    -no-mesh-thread  generate and upload the meshes of gears added with G
+ *                     on the main thread, instead of a loader thread with
+ *                     a shared context
  *
  *
  * Brian Paul
@@ -32,10 +83,15 @@
  #define _USE_MATH_DEFINES
 #endif
 
+#include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <cstdlib>
 #include <cstdio>
 #include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
 #include <vector>
 #include <iostream>
 
@@ -49,41 +105,602 @@
 #include "input.h"
 #include "camera.h"
 #include "3dobject.h"
+#include "bench.h"
+#include "culling.h"
+#include "depthprepass.h"
+#include "dynamicresolution.h"
+#include "filewatcher.h"
+#include "glstate.h"
+#include "gpuculling.h"
+#include "impostors.h"
+#include "indirect.h"
+#include "instances.h"
+#include "lights.h"
+#include "mesh.h"
+#include "meshloader.h"
+#include "occlusion.h"
+#include "programcache.h"
+#include "renderqueue.h"
+#include "softocclusion.h"
+#include "streambuffer.h"
+#include "uniforms.h"
+#include "vertexlayout.h"
+#include "visibility.h"
 
-GLint uniformColour, uniformModel;
-GLfloat angle = 0.f;
+// Seconds of animation so far; stands still while animation is toggled off
+static GLfloat animationTime = 0.f;
+
+// A linked shader program. Everything else it needs comes from the uniform
+// blocks, which are shared by all programs.
+struct ShaderProgram {
+    // 0 until it has been linked
+    GLint program;
+    // Only used by the instanced and indirect programs
+    GLint instanceBase;
+    // Whether it has been built, or started to be
+    bool requested;
+};
+
+// What a program is built from, and what to do with it once it is linked.
+// Kept, so that it can be built again when one of its files changes.
+struct ProgramSource {
+    // Shown when it fails to build, or is reloaded
+    std::string name;
+    std::vector<const char*> paths;
+    std::vector<GLint> shaderTypes;
+    std::string defines;
+    // Called with each program linked from it, which takes the place of the
+    // one before
+    std::function<void(GLuint)> install;
+};
+
+// A program being compiled and linked, which finishPrograms() checks on
+struct ProgramBuild {
+    // Index in programSources
+    std::size_t source;
+    GLuint program;
+    std::vector<GLuint> shaders;
+    // Its key in the program cache, which is all of its shaders' source
+    std::string key;
+};
+
+// A gear added while running, which is waiting for its mesh to be loaded
+struct WaitingGear {
+    ThreeDimensionalObject object;
+    GearBlueprint blueprint;
+};
+
+// How the objects are shaded, from the wireframe and lighting toggles. Each
+// is compiled into programs of its own, so that the shaders don't branch on
+// it, and don't compute what it doesn't show.
+enum ShaderVariant {
+    VARIANT_UNLIT,     // Grey, darker with distance
+    VARIANT_LIT,
+    VARIANT_WIREFRAME, // The triangles' edges, lit or not
+    VARIANT_COUNT
+};
+static const char* variantDefines[VARIANT_COUNT] = {
+    "", "#define LIT\n", "#define WIREFRAME\n"
+};
+
+// A program, in each variant. Each variant is compiled the first time it is
+// drawn with, by getVariant(), and the ones already linked are drawn with
+// until it is done.
+struct ShaderVariants {
+    std::string defines;
+    const char* vertexPath;
+    const char* fragmentPath;
+    // Called with each program once it is linked, or nullptr
+    void (*bindSamplers)(GLuint program);
+    ShaderProgram programs[VARIANT_COUNT];
+
+    ShaderVariants(const std::string& defines = "",
+        const char* vertexPath = "default.vert", const char* fragmentPath = "default.frag",
+        void (*bindSamplers)(GLuint program) = nullptr) :
+        defines(defines), vertexPath(vertexPath), fragmentPath(fragmentPath), bindSamplers(bindSamplers),
+        programs() {}
+};
+
+// Ways of submitting the objects to OpenGL
+enum RenderPath {
+    PATH_OBJECTS,   // One glDrawElements call per object, in sorted order
+    PATH_INSTANCED, // One glDrawElementsInstanced call per mesh
+    PATH_INDIRECT,  // One glMultiDrawElementsIndirect call
+    PATH_GPU_CULLED, // The same, with commands written by a compute shader
+    PATH_COUNT
+};
+static const char* pathNames[PATH_COUNT] = {
+    "per-object", "instanced", "multi-draw indirect", "GPU-culled indirect"
+};
 
 static Camera viewpoint;
-static GLint shaderProgram;
-static GLint uniformProjection, uniformWireframe, uniformLightPos, uniformLit, uniformZoom;
+static RenderPath renderPath = PATH_OBJECTS;
+static bool allowSSBO = true;
+static bool stateCache = true;
+static ShaderVariants shaders[PATH_COUNT];
+// Picked by draw() for the next frame
+static ShaderVariant shaderVariant = VARIANT_LIT;
+// The same programs, for depth-only passes
+static ShaderProgram depthShaders[PATH_COUNT];
+static std::unique_ptr<StreamBuffer> streamBuffer;
+static std::unique_ptr<UniformBuffers> uniformBuffers;
+static RenderQueue renderQueue;
+static bool frustumCulling = true;
+static BoundingSpheres boundingSpheres;
+// Indices of the objects drawn this frame
+static std::vector<GLuint> visibleObjects;
+// Created by preparePath() when first needed
+static std::unique_ptr<InstancedRenderer> instancedRenderer;
+static std::unique_ptr<IndirectRenderer> indirectRenderer;
+static std::unique_ptr<GPUCulling> gpuCulling;
+static bool occlusionQueries = false;
+static std::unique_ptr<OcclusionCulling> occlusionCulling;
+static bool softwareOcclusionCulling = false;
+static std::unique_ptr<SoftwareOcclusion> softwareOcclusion;
+static PrepassMode prepassMode = PREPASS_NEVER;
+static std::unique_ptr<DepthPrepass> depthPrepass;
+static std::unique_ptr<ClusteredLights> clusteredLights;
+static bool visibilityBufferMode = false;
+static std::unique_ptr<VisibilityBuffer> visibilityBuffer;
+// The programs of the visibility buffer's geometry and resolve passes
+static ShaderProgram visibilityShaders[PATH_COUNT];
+static ShaderVariants resolveShaders[PATH_COUNT];
+static int framebufferWidth = 0, framebufferHeight = 0;
+static std::unique_ptr<DynamicResolution> dynamicResolution;
+// Size of the frame being rendered, which is smaller than the framebuffer
+// with dynamic resolution
+static int renderWidth = 0, renderHeight = 0;
+static bool impostorMode = false;
+static std::unique_ptr<ImpostorAtlas> impostorAtlas;
+// The programs which draw the impostors, and render the atlas
+static ShaderVariants impostorShaders;
+static ShaderProgram impostorBakeShader;
+// Where linked programs are kept between runs, or nullptr
+static std::unique_ptr<ProgramCache> programCache;
+// Every program built so far, and the ones still being linked
+static std::vector<ProgramSource> programSources;
+static std::vector<ProgramBuild> programBuilds;
+// Whether programs are linked in the background
+static bool parallelCompile = false;
+// Reports edits to the shaders, or nullptr
+static std::unique_ptr<FileWatcher> shaderWatcher;
+// Loads the meshes of gears added while running, or nullptr to do it on the
+// main thread
+static std::unique_ptr<MeshLoader> meshLoader;
+static std::vector<WaitingGear> waitingGears;
+// Rows of gears added so far, and the longest the main thread has taken to
+// add gears in one frame, in milliseconds
+static int gearRows = 0;
+static double longestGearFrame = 0.;
+
+// Start building a program from a vertex and a fragment shader, which is
+// put into shader once it is linked. The defines are inserted into both.
+static void initShaders(ShaderProgram& shader, const std::string& defines,
+    const char* vertexPath = "default.vert", const char* fragmentPath = "default.frag",
+    void (*bindSamplers)(GLuint program) = nullptr);
+static void initSingleShader(const char* path, GLint shaderType, std::function<void(GLuint)> install);
+// Install the programs which have finished linking, or all of them if wait
+// is set
+static void finishPrograms(bool wait);
+
+// Start building a variant of a program, if it hasn't been yet
+static void requestVariant(ShaderVariants& variants, ShaderVariant variant)
+{
+    ShaderProgram& shader = variants.programs[variant];
+    if (!shader.requested) {
+        initShaders(shader, variants.defines + variantDefines[variant],
+            variants.vertexPath, variants.fragmentPath, variants.bindSamplers);
+    }
+}
+
+// The given variant of a program, or while it is still being linked,
+// another one which is ready. Only waits for it if there is none.
+static const ShaderProgram& getVariant(ShaderVariants& variants, ShaderVariant variant)
+{
+    requestVariant(variants, variant);
+    ShaderProgram& shader = variants.programs[variant];
+    if (shader.program) return shader;
+    for (const ShaderProgram& other : variants.programs) {
+        if (other.program) return other;
+    }
+    finishPrograms(true);
+    return shader;
+}
+
+// Create the renderers for a render path, and start building the programs
+// it draws with. Needs none of the objects, so that the programs can be
+// compiled while they are being generated.
+static void prepareRenderers(int path)
+{
+    bool storageBuffer = allowSSBO && GLAD_GL_ARB_shader_storage_buffer_object;
+    std::string defines;
+    switch (path) {
+    case PATH_OBJECTS:
+        break;
+    case PATH_INSTANCED:
+        if (!instancedRenderer) {
+            instancedRenderer.reset(new InstancedRenderer(storageBuffer, *streamBuffer));
+        }
+        defines = instancedRenderer->shaderDefines();
+        break;
+    case PATH_INDIRECT:
+    case PATH_GPU_CULLED:
+        if (!indirectRenderer) {
+            indirectRenderer.reset(new IndirectRenderer(storageBuffer, *streamBuffer));
+        }
+        if (path == PATH_GPU_CULLED && !gpuCulling) {
+            gpuCulling.reset(new GPUCulling());
+            initSingleShader("cull.comp", GL_COMPUTE_SHADER,
+                [](GLuint program) { gpuCulling->setProgram(program); });
+        }
+        defines = indirectRenderer->shaderDefines();
+        break;
+    }
+    shaders[path].defines = defines;
+    requestVariant(shaders[path], shaderVariant);
+    if (prepassMode != PREPASS_NEVER) {
+        if (!depthPrepass) {
+            depthPrepass.reset(new DepthPrepass(prepassMode));
+        }
+        if (!depthShaders[path].requested) {
+            initShaders(depthShaders[path], defines + "#define DEPTH_ONLY\n");
+        }
+    }
+    if (visibilityBufferMode && path != PATH_OBJECTS) {
+        if (!visibilityBuffer) {
+            visibilityBuffer.reset(new VisibilityBuffer());
+        }
+        if (!visibilityShaders[path].requested) {
+            initShaders(visibilityShaders[path], defines + "#define DEPTH_ONLY\n#define VISIBILITY_BUFFER\n");
+            resolveShaders[path] = ShaderVariants(defines, "resolve.vert", "resolve.frag",
+                VisibilityBuffer::bindSamplers);
+            requestVariant(resolveShaders[path], shaderVariant);
+        }
+    }
+    if (occlusionQueries && !occlusionCulling) {
+        occlusionCulling.reset(new OcclusionCulling());
+        initSingleShader("bounds.vert", GL_VERTEX_SHADER,
+            [](GLuint program) { occlusionCulling->setProgram(program); });
+    }
+    if (softwareOcclusionCulling && !softwareOcclusion) {
+        softwareOcclusion.reset(new SoftwareOcclusion());
+    }
+    if (impostorMode && !impostorAtlas) {
+        impostorAtlas.reset(new ImpostorAtlas(storageBuffer, *streamBuffer));
+        impostorShaders = ShaderVariants(impostorAtlas->shaderDefines(), "impostor.vert", "impostor.frag",
+            ImpostorAtlas::bindSamplers);
+        requestVariant(impostorShaders, shaderVariant);
+        initShaders(impostorBakeShader, impostorShaders.defines + "#define BAKE\n",
+            "impostor.vert", "impostor.frag");
+    }
+}
+
+// Upload the data the renderers of a path need of the objects from first
+// on, and make room for them in the stream buffer. The objects before first
+// must have been uploaded already, and not changed since.
+static void updateObjects(const std::vector<ThreeDimensionalObject> &objects, std::size_t first, int path)
+{
+    GLsizeiptr streamBytes = uniformBuffers->streamBytes();
+    boundingSpheres.update(objects, first);
+    switch (path) {
+    case PATH_OBJECTS:
+        uniformBuffers->uploadObjects(objects, first);
+        break;
+    case PATH_INSTANCED:
+        instancedRenderer->update(objects, first);
+        streamBytes += instancedRenderer->streamBytes(objects.size());
+        break;
+    case PATH_INDIRECT:
+        indirectRenderer->update(objects, first);
+        streamBytes += IndirectRenderer::streamBytes(objects.size());
+        break;
+    case PATH_GPU_CULLED:
+        indirectRenderer->update(objects, first);
+        gpuCulling->update(objects, first);
+        break;
+    }
+    if (visibilityBuffer && path != PATH_OBJECTS) {
+        visibilityBuffer->update(objects, first);
+    }
+    if (occlusionCulling) {
+        occlusionCulling->update(objects, first);
+    }
+    if (clusteredLights) {
+        streamBytes += clusteredLights->streamBytes();
+    }
+    if (impostorAtlas) {
+        streamBytes += impostorAtlas->streamBytes(objects.size());
+    }
+    streamBuffer->reserve(streamBytes);
+}
+
+// Set up the renderers and shader programs for a render path, and upload
+// the per-object data they need. Waits for the programs to be linked.
+static void preparePath(const std::vector<ThreeDimensionalObject> &objects, int path)
+{
+    prepareRenderers(path);
+    updateObjects(objects, 0, path);
+    finishPrograms(true);
+}
+
+// Draw the visible objects with the given render path and program. The
+// instance data and GPU culling must be up to date. positionsOnly reads no
+// other vertex attributes, for depth-only passes.
+static void drawPath(const std::vector<ThreeDimensionalObject> &objects, const MeshCache &meshes, int path,
+    const ShaderProgram& shader, bool positionsOnly)
+{
+    switch (path) {
+    case PATH_OBJECTS: {
+        // The queue binds the program and vertex array itself, only when
+        // they change
+        glm::mat4 view = viewpoint.getViewMatrix();
+        GLuint vertexArray = meshes.getArena().getVertexArray(positionsOnly);
+        renderQueue.clear();
+        for (GLuint i : visibleObjects) {
+            const vec3_t& position = objects[i].position;
+            glm::vec4 viewPosition = view * glm::vec4(position.x, position.y, position.z, 1.);
+            // Every gear has the same material, so far
+            uint64_t key = RenderQueue::makeKey(shader.program, 0, -viewPosition.z);
+            renderQueue.push(key, {(GLuint) shader.program, vertexArray, &objects[i], i});
+        }
+        renderQueue.sort();
+        renderQueue.submit(*uniformBuffers);
+        break;
+    }
+    case PATH_INSTANCED:
+        glUseProgram(shader.program);
+        instancedRenderer->draw(meshes.getArena(), shader.instanceBase, positionsOnly);
+        break;
+    case PATH_INDIRECT:
+        glUseProgram(shader.program);
+        indirectRenderer->draw(objects, visibleObjects, meshes.getArena(), shader.instanceBase, positionsOnly);
+        break;
+    case PATH_GPU_CULLED:
+        glUseProgram(shader.program);
+        indirectRenderer->draw(*gpuCulling, meshes.getArena(), positionsOnly);
+        break;
+    }
+}
+
+// Issue the draw calls for one frame, using the given render path
+static void submit(const std::vector<ThreeDimensionalObject> &objects, const MeshCache &meshes, int path)
+{
+    glm::mat4 projection = viewpoint.getViewProjMatrix();
+    const ShaderProgram& shader = getVariant(shaders[path], shaderVariant);
+
+    // Per-frame data is written into the next region of the stream buffer
+    streamBuffer->beginFrame();
+
+    FrameUniforms frame;
+    memcpy(frame.projView, glm::value_ptr(projection), sizeof(frame.projView));
+    frame.lightPos[0] = sin(glfwGetTime()) * 5.;
+    frame.lightPos[1] = sin(glfwGetTime()) * 5.;
+    frame.lightPos[2] = cos(glfwGetTime()) * 10;
+    frame.zoom = 1;
+    frame.time = animationTime;
+    uniformBuffers->update(frame);
+    if (clusteredLights) {
+        clusteredLights->update(viewpoint.getViewMatrix(), viewpoint.getProjectionMatrix(),
+            renderWidth, renderHeight, animationTime);
+    }
+
+    if (path == PATH_GPU_CULLED) {
+        // Culled by the compute shader instead
+        visibleObjects.clear();
+    } else if (frustumCulling) {
+        boundingSpheres.cull(Frustum::fromMatrix(projection), visibleObjects);
+    } else {
+        visibleObjects.resize(objects.size());
+        for (std::size_t i = 0; i < objects.size(); i++) {
+            visibleObjects[i] = i;
+        }
+    }
+    // The GPU culling path draws everything in the frustum
+    bool occlusion = occlusionCulling && path != PATH_GPU_CULLED;
+    bool softOcclusion = softwareOcclusion && path != PATH_GPU_CULLED;
+    if (softOcclusion) {
+        softwareOcclusion->cull(objects, visibleObjects, projection, animationTime);
+    }
+    if (occlusion) {
+        occlusionCulling->cull(visibleObjects, viewpoint.position);
+    }
+    // The GPU culling path has no list of visible objects to take them from
+    bool impostors = impostorAtlas && path != PATH_GPU_CULLED;
+    if (impostors) {
+        impostorAtlas->select(objects, visibleObjects, projection, renderHeight);
+    }
+
+    if (path == PATH_INSTANCED) {
+        // Only the list of objects to draw changes every frame
+        instancedRenderer->select(visibleObjects);
+    } else if (path == PATH_GPU_CULLED) {
+        // Without culling, every object is inside the "frustum"
+        gpuCulling->cull(frustumCulling ? Frustum::fromMatrix(projection) : Frustum::everything());
+    }
+
+    if (visibilityBufferMode && path != PATH_OBJECTS) {
+        // Every pixel is shaded once anyway, so there is no depth pre-pass
+        visibilityBuffer->beginGeometryPass(renderWidth, renderHeight);
+        drawPath(objects, meshes, path, visibilityShaders[path], true);
+        visibilityBuffer->resolve(getVariant(resolveShaders[path], shaderVariant).program, meshes.getArena());
+    } else {
+        if (depthPrepass && depthPrepass->beginFrame()) {
+            depthPrepass->beginDepthPass();
+            drawPath(objects, meshes, path, depthShaders[path], true);
+        }
+        if (depthPrepass) {
+            depthPrepass->beginColourPass();
+        }
+        drawPath(objects, meshes, path, shader, false);
+        if (depthPrepass) {
+            depthPrepass->endFrame();
+        }
+    }
+    if (impostors) {
+        impostorAtlas->draw(getVariant(impostorShaders, shaderVariant).program, impostorBakeShader.program,
+            meshes.getArena(), viewpoint.position);
+    }
+    // Tested against this frame's depth buffer, for the next frame
+    if (occlusion) {
+        occlusionCulling->query();
+    }
+
+    streamBuffer->endFrame();
+}
+
+// Switch the visibility buffer on or off; preparePath() creates what it needs
+static void useVisibilityBuffer(bool enabled)
+{
+    visibilityBufferMode = enabled;
+}
 
 /* OpenGL draw function & timing */
-static void draw(const std::vector<ThreeDimensionalObject> &objects)
+static void draw(const std::vector<ThreeDimensionalObject> &objects, const MeshCache &meshes)
 {
     const KeyInputState* input = Input::GetKeyState();
+    shaderVariant = input->wireframe ? VARIANT_WIREFRAME : input->lit ? VARIANT_LIT : VARIANT_UNLIT;
+    renderWidth = framebufferWidth;
+    renderHeight = framebufferHeight;
+    if (dynamicResolution) {
+        dynamicResolution->beginFrame(renderWidth, renderHeight);
+    }
     glClearColor(0.0, 0.0, 0.0, 0.0);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    glm::mat4 projection = viewpoint.getViewProjMatrix();
+    submit(objects, meshes, renderPath);
+    if (dynamicResolution) {
+        dynamicResolution->endFrame();
+    }
+}
+
+// Print statistics about the last second's frames
+static void printStats()
+{
+    static double lastPrint = glfwGetTime();
+    static int frames = 0;
+    static unsigned int lastStalls = 0;
+    static double lastStallTime = 0;
 
-    glUseProgram(shaderProgram);
-    glUniformMatrix4fv(uniformProjection, 1, GL_FALSE, glm::value_ptr(projection));
-    glUniform1f(uniformZoom, 1);
-    glUniform3f(uniformLightPos, sin(glfwGetTime()) * 5., sin(glfwGetTime()) * 5., cos(glfwGetTime()) * 10);
-    glUniform1ui(uniformLit, input->lit);
-    glUniform1ui(uniformWireframe, input->wireframe);
+    frames++;
+    double now = glfwGetTime();
+    if (now - lastPrint < 1.) return;
 
-    for (const ThreeDimensionalObject& obj : objects) {
-        obj.draw();
+    printf("%d frames in %.2f s; stream buffer: %u stalls, %.2f ms waiting\n",
+        frames, now - lastPrint,
+        streamBuffer->stallCount() - lastStalls,
+        streamBuffer->stallMilliseconds() - lastStallTime);
+    fflush(stdout);
+    frames = 0;
+    lastPrint = now;
+    lastStalls = streamBuffer->stallCount();
+    lastStallTime = streamBuffer->stallMilliseconds();
+    if (stateCache) {
+        const GLStateStats& state = GLState::lastFrame();
+        printf("State cache, last frame: %u calls issued, %u skipped\n",
+            state.issued, state.skipped);
+        fflush(stdout);
+    }
+    bool occlusion = occlusionCulling && renderPath != PATH_GPU_CULLED;
+    bool softOcclusion = softwareOcclusion && renderPath != PATH_GPU_CULLED;
+    if (frustumCulling) {
+        bool gpu = renderPath == PATH_GPU_CULLED;
+        unsigned int drawn = gpu ? gpuCulling->visibleCount() : visibleObjects.size();
+        // Including the ones culled by occlusion, or drawn as impostors,
+        // afterwards
+        if (occlusion) drawn += occlusionCulling->lastFrame().objectsCulled;
+        if (softOcclusion) drawn += softwareOcclusion->lastFrame().objectsCulled;
+        if (impostorAtlas && !gpu) drawn += impostorAtlas->lastFrame().impostors;
+        printf("Frustum culling (%s), last frame: %u objects in view, %u culled\n",
+            gpu ? "compute shader" : BoundingSpheres::instructionSet(), drawn,
+            (unsigned) boundingSpheres.size() - drawn);
+        fflush(stdout);
+    }
+    if (softOcclusion) {
+        const SoftwareOcclusionStats& stats = softwareOcclusion->lastFrame();
+        printf("Software occlusion (%s, %d threads), last frame: %u occluders, %u triangles, "
+            "%u of %u objects culled, %.3f ms\n",
+            SoftwareOcclusion::instructionSet(), softwareOcclusion->threadCount(),
+            stats.occluders, stats.triangles, stats.objectsCulled, stats.objectsTested,
+            stats.milliseconds);
+        fflush(stdout);
+    }
+    if (impostorAtlas && renderPath != PATH_GPU_CULLED) {
+        const ImpostorStats& stats = impostorAtlas->lastFrame();
+        printf("Impostors, last frame: %u objects drawn as impostors, %u triangles left out\n",
+            stats.impostors, stats.trianglesReplaced);
+        fflush(stdout);
+    }
+    if (occlusion) {
+        const OcclusionStats& stats = occlusionCulling->lastFrame();
+        printf("Occlusion culling, last frame: %u queries, %u clusters, %u objects and %u triangles culled\n",
+            stats.queries, stats.clustersCulled, stats.objectsCulled, stats.trianglesCulled);
+        fflush(stdout);
+    }
+    if (clusteredLights) {
+        const ClusteredLightsStats& stats = clusteredLights->lastFrame();
+        printf("Clustered lighting, last frame: %u of %u lights in view, %u light indices, "
+            "at most %u lights in a cluster, %.3f ms\n",
+            stats.lightsInView, stats.lights, stats.indices, stats.maxPerCluster, stats.milliseconds);
+        fflush(stdout);
     }
+    if (dynamicResolution) {
+        const DynamicResolutionStats& stats = dynamicResolution->lastFrame();
+        printf("Dynamic resolution, last frame: %.0f%% (%dx%d), %.2f ms last measured\n",
+            stats.scale * 100., stats.width, stats.height, stats.milliseconds);
+        fflush(stdout);
+    }
+    if (depthPrepass) {
+        const DepthPrepassStats& stats = depthPrepass->lastFrame();
+        printf("Depth pre-pass (%s), last frame: %s, overdraw %.2f, %u fragments shaded\n",
+            depthPrepass->getMode() == PREPASS_AUTO ? "auto" : "always",
+            stats.enabled ? "on" : "off", stats.overdraw, stats.fragmentsShaded);
+        fflush(stdout);
+    }
+    if (gearRows > 0) {
+        printf("Added gears (%s): %d rows, %u gears waiting for meshes, %.2f ms in the longest frame\n",
+            meshLoader ? "loader thread" : "main thread", gearRows, (unsigned) waitingGears.size(),
+            longestGearFrame);
+        if (meshLoader) {
+            MeshLoaderStats stats = meshLoader->totals();
+            printf("Mesh loader: %u meshes generated and uploaded, %.2f ms\n", stats.meshes, stats.milliseconds);
+        }
+        fflush(stdout);
+    }
+    if (renderPath == PATH_OBJECTS) {
+        const RenderQueueStats& queue = renderQueue.lastFrame();
+        printf("Render queue, last frame: %u draws, %u binds, %u binds saved\n",
+            queue.draws, queue.binds, queue.bindsSaved);
+        fflush(stdout);
+    }
+}
+
+// Print how long it took to get the first frame drawn, and how its
+// programs were built
+static void printStartup()
+{
+    // Waits for the first frame, which compiles the programs it draws with
+    glFinish();
+    // GLFW's timer starts at zero when it is initialized
+    printf("Startup: %.0f ms to the first frame\n", glfwGetTime() * 1000.);
+    if (programCache) {
+        const ProgramCacheStats& stats = programCache->totals();
+        printf("Program cache (%s): %u programs loaded, %u compiled, %u rejected, %.0f ms\n",
+            programCache->isEnabled() ? "on" : "off",
+            stats.loaded, stats.compiled, stats.rejected, stats.milliseconds);
+    }
+    fflush(stdout);
 }
 
 /* update animation parameters */
 static void animate(void)
 {
+    static double lastTime = glfwGetTime();
+    double now = glfwGetTime();
     const KeyInputState* input = Input::GetKeyState();
+    // The gears themselves are turned by the vertex shader
     if (input->animate)
-        angle = 100.f * (float) glfwGetTime();
+        animationTime += now - lastTime;
+    lastTime = now;
     if (input->forward)
         viewpoint.move(glm::vec3(0, .125, 0));
     if (input->backward)
@@ -102,22 +719,37 @@ static void animate(void)
     viewpoint.phi = glm::clamp<GLfloat>(viewpoint.phi, -90, 90);
 }
 
-static GLint loadShader(FILE* sourceFile, GLint shaderType)
+static double millisecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Read a shader's source, with defines inserted after its #version line
+static bool readShader(const char* path, const char* defines, std::string& source)
 {
-    char* source;
-    int length, shader, compileStatus = 0;
+    FILE* sourceFile = fopen(path, "r");
+    if (!sourceFile)
+    {
+        fprintf(stderr, "%s cannot be opened!\n", path);
+        return false;
+    }
     // Get length, allocate memory for source code, and read it in
     fseek(sourceFile, 0, SEEK_END);
-    length = ftell(sourceFile);
-    source = new char[length];
+    long length = ftell(sourceFile);
+    std::string text(length, '\0');
     fseek(sourceFile, 0, SEEK_SET);
-    fread(source, 1, length, sourceFile);
-    // Create and compile shader
-    shader = glCreateShader(shaderType);
-    glShaderSource(shader, 1, &source, &length);
-    glCompileShader(shader);
-    delete[] source;
-    // Show error and warning messages from the compiler
+    text.resize(fread(&text[0], 1, length, sourceFile));
+    fclose(sourceFile);
+    // Split the source after the #version line, which must come first
+    std::size_t versionLength = text.find('\n');
+    versionLength = versionLength == std::string::npos ? text.size() : versionLength + 1;
+    source = text.substr(0, versionLength) + defines + text.substr(versionLength);
+    return true;
+}
+
+// Show error and warning messages from the compiler
+static void printShaderLog(GLuint shader)
+{
     int textLength;
     glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &textLength);
     if (textLength > 0)
@@ -127,107 +759,311 @@ static GLint loadShader(FILE* sourceFile, GLint shaderType)
         fputs(compileErrorText, stderr);
         delete[] compileErrorText;
     }
-    // Check whether shader successfully compiled or not
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &compileStatus);
-    if (compileStatus == GL_FALSE)
+}
+
+static void printProgramLog(GLuint program)
+{
+    int textLength;
+    glGetProgramiv(program, GL_INFO_LOG_LENGTH, &textLength);
+    if (textLength > 0)
     {
-        glDeleteShader(shader);
-        return 0;
+        char* linkErrorText = new char[textLength];
+        glGetProgramInfoLog(program, textLength, &textLength, linkErrorText);
+        fputs(linkErrorText, stderr);
+        delete[] linkErrorText;
     }
-    return shader;
 }
 
-static bool initShaders()
+// Check a build's program, once it is linked, and install it if it works.
+// Waits for the driver if it is still being linked.
+static void finishBuild(ProgramBuild& build)
 {
-    bool success = true;
-    GLint vertexShader, fragmentShader;
-    shaderProgram = glCreateProgram();
-    // Read the shader source files
-    FILE* vsSourceFile = fopen("default.vert", "r");
-    if (!vsSourceFile)
+    auto start = std::chrono::steady_clock::now();
+    GLint linkStatus;
+    glGetProgramiv(build.program, GL_LINK_STATUS, &linkStatus);
+    bool compiled = true;
+    for (GLuint shader : build.shaders) {
+        printShaderLog(shader);
+        GLint compileStatus;
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &compileStatus);
+        compiled = compiled && compileStatus;
+        // Only deleted once the program is
+        glDeleteShader(shader);
+    }
+    const ProgramSource& source = programSources[build.source];
+    if (linkStatus == GL_FALSE)
     {
-        fputs("default.vert cannot be opened!", stderr);
-        success = false;
+        // Which only says that a shader didn't compile, if one didn't
+        if (compiled) printProgramLog(build.program);
+        fprintf(stderr, "%s cannot be linked!\n", source.name.c_str());
+        glDeleteProgram(build.program);
     }
     else
     {
-        vertexShader = loadShader(vsSourceFile, GL_VERTEX_SHADER);
-        if (!vertexShader) success = false;
-        fclose(vsSourceFile);
+        if (programCache) programCache->save(build.program, build.key);
+        source.install(build.program);
     }
+    if (programCache) programCache->addTime(millisecondsSince(start));
+}
 
-    FILE* fsSourceFile = fopen("default.frag", "r");
-    if (!fsSourceFile)
-    {
-        fputs("default.frag cannot be opened!", stderr);
-        success = false;
+// Start building a program from its source files, as they are now. Programs
+// in the program cache are installed at once. The others are linked in the
+// background, with KHR_parallel_shader_compile, and installed by
+// finishPrograms(); without it, they are linked before this returns. Any
+// build of the same program which hasn't finished is dropped.
+static void startBuild(std::size_t index)
+{
+    for (std::size_t i = 0; i < programBuilds.size(); i++) {
+        if (programBuilds[i].source != index) continue;
+        for (GLuint shader : programBuilds[i].shaders) glDeleteShader(shader);
+        glDeleteProgram(programBuilds[i].program);
+        programBuilds.erase(programBuilds.begin() + i);
+        break;
     }
-    else
-    {
-        fragmentShader = loadShader(fsSourceFile, GL_FRAGMENT_SHADER);
-        if (!fragmentShader) success = false;
-        fclose(fsSourceFile);
+    auto start = std::chrono::steady_clock::now();
+    const ProgramSource& source = programSources[index];
+    ProgramBuild build;
+    build.source = index;
+    std::vector<std::string> texts(source.paths.size());
+    for (std::size_t i = 0; i < source.paths.size(); i++) {
+        if (!readShader(source.paths[i], source.defines.c_str(), texts[i])) return;
+        // The key covers the shader types as well, since the same source
+        // could be compiled as either
+        build.key += std::to_string(source.shaderTypes[i]) + '\n' + texts[i];
     }
-    if (!success)
-    {
-        glDeleteProgram(shaderProgram);
-        return false;
+    GLuint cached = programCache ? programCache->load(build.key) : 0;
+    if (cached) {
+        source.install(cached);
+        programCache->addTime(millisecondsSince(start));
+        return;
     }
 
-    // Link the shader program
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
-    glLinkProgram(shaderProgram);
-
-    uniformLightPos = glGetUniformLocation(shaderProgram, "lightPos");
-    uniformProjection = glGetUniformLocation(shaderProgram, "projView");
-    uniformModel = glGetUniformLocation(shaderProgram, "model");
-    uniformLit = glGetUniformLocation(shaderProgram, "lit");
-    uniformZoom = glGetUniformLocation(shaderProgram, "zoom");
-    uniformColour = glGetUniformLocation(shaderProgram, "colour");
-    uniformWireframe = glGetUniformLocation(shaderProgram, "wireframe");
-    // Done!
-    return success;
+    // Nothing here waits for the compiler; with parallel compiling, it
+    // carries on in the driver's own threads
+    build.program = glCreateProgram();
+    for (std::size_t i = 0; i < texts.size(); i++) {
+        const char* text = texts[i].c_str();
+        GLuint shader = glCreateShader(source.shaderTypes[i]);
+        glShaderSource(shader, 1, &text, nullptr);
+        glCompileShader(shader);
+        glAttachShader(build.program, shader);
+        build.shaders.push_back(shader);
+    }
+    if (programCache) programCache->prepare(build.program);
+    glLinkProgram(build.program);
+    if (programCache) programCache->addTime(millisecondsSince(start));
+    if (parallelCompile) {
+        programBuilds.push_back(build);
+    } else {
+        finishBuild(build);
+    }
 }
 
-/* program & OpenGL initialization */
-static void init(std::vector<ThreeDimensionalObject> &objects)
+static void finishPrograms(bool wait)
 {
-    initShaders();
+    for (std::size_t i = 0; i < programBuilds.size();) {
+        GLint done = GL_TRUE;
+        if (!wait) glGetProgramiv(programBuilds[i].program, GL_COMPLETION_STATUS_KHR, &done);
+        if (done) {
+            ProgramBuild build = programBuilds[i];
+            programBuilds.erase(programBuilds.begin() + i);
+            finishBuild(build);
+        } else {
+            i++;
+        }
+    }
+}
 
+static void reloadShaders(const std::vector<std::string>& changedFiles)
+{
+    for (const std::string& file : changedFiles) {
+        for (std::size_t i = 0; i < programSources.size(); i++) {
+            const std::vector<const char*>& paths = programSources[i].paths;
+            if (std::find(paths.begin(), paths.end(), file) == paths.end()) continue;
+            printf("Reloading %s\n", programSources[i].name.c_str());
+            fflush(stdout);
+            startBuild(i);
+        }
+    }
+}
+
+// Build a program made of one shader, and call install with it once it is
+// linked
+static void initSingleShader(const char* path, GLint shaderType, std::function<void(GLuint)> install)
+{
+    ProgramSource source;
+    source.name = path;
+    source.paths = {path};
+    source.shaderTypes = {shaderType};
+    source.install = install;
+    programSources.push_back(source);
+    startBuild(programSources.size() - 1);
+}
+
+static void initShaders(ShaderProgram& shader, const std::string& pathDefines,
+    const char* vertexPath, const char* fragmentPath, void (*bindSamplers)(GLuint program))
+{
+    ProgramSource source;
+    source.name = std::string(vertexPath) + " and " + fragmentPath;
+    source.paths = {vertexPath, fragmentPath};
+    source.shaderTypes = {GL_VERTEX_SHADER, GL_FRAGMENT_SHADER};
+    source.defines = pathDefines;
+    if (clusteredLights) {
+        source.defines += ClusteredLights::shaderDefines();
+    }
+    source.install = [&shader, bindSamplers](GLuint program) {
+        // None of these are kept by a program binary, so they are set
+        // either way
+        UniformBuffers::bindBlocks(program);
+        if (clusteredLights) {
+            ClusteredLights::bindSamplers(program);
+        }
+        if (instancedRenderer) {
+            InstancedRenderer::bindSamplers(program);
+        }
+        if (bindSamplers) {
+            bindSamplers(program);
+        }
+        if (shader.program) glDeleteProgram(shader.program);
+        shader.program = program;
+        shader.instanceBase = glGetUniformLocation(program, "instanceBase");
+    };
+    shader.requested = true;
+    programSources.push_back(source);
+    startBuild(programSources.size() - 1);
+}
+
+/* program & OpenGL initialization */
+static void init(std::vector<ThreeDimensionalObject> &objects, MeshCache &meshes, int fieldGears, int lights)
+{
     glEnable(GL_CULL_FACE);
     glCullFace(GL_BACK);
     glEnable(GL_DEPTH_TEST);
 
+    // Enough for the uniform blocks; preparePath() makes room for the rest
+    streamBuffer.reset(new StreamBuffer(65536));
+    uniformBuffers.reset(new UniformBuffers(*streamBuffer));
+    if (lights > 0) {
+        clusteredLights.reset(new ClusteredLights(*streamBuffer));
+    }
+    // The programs are compiled while the gears are generated
+    prepareRenderers(renderPath);
+
+    // Upload all of the meshes in one go
+    meshes.beginBatch();
     objects.emplace_back(
         vec3_t {{0.8, 0.1, 0.0}}, // colour
         vec3_t {{-3.0, -2.0, 0.0}} // position
     );
-    objects.back().setupForDrawing({1., 4., 1., 20, 0.7});
+    objects.back().setupForDrawing({1., 4., 1., 20, 0.7}, meshes);
 
     objects.emplace_back(
         vec3_t {{0., 0.8, 0.2}}, // colour
         vec3_t {{3.1, -2., 0.0}}, // position
         -2.0, -9.0 // angleMultiply, angleAdd
     );
-    objects.back().setupForDrawing({0.5, 2., 2., 10, 0.7});
+    objects.back().setupForDrawing({0.5, 2., 2., 10, 0.7}, meshes);
 
     objects.emplace_back(
         vec3_t {{0.2, 0.2, 1.}}, // colour
         vec3_t {{-3.1, 4.2, 0.0}}, // position
         -2.0, -25.0 // angleMultiply, angleAdd
     );
-    objects.back().setupForDrawing({1.3, 2., 0.5, 10, 0.7});
+    objects.back().setupForDrawing({1.3, 2., 0.5, 10, 0.7}, meshes);
+
+    addGearField(objects, meshes, fieldGears);
+    meshes.endBatch();
+    if (clusteredLights) {
+        clusteredLights->scatter(objects, lights);
+    }
+    preparePath(objects, renderPath);
 
     viewpoint.position = glm::vec3(2.0, -5.0, 3.0);
     viewpoint.phi = -25.0;
     viewpoint.theta = -15.0;
 }
 
+// Add the rows of gears asked for with G. Without the mesh loader, their
+// meshes are generated and uploaded straight away; with it, the gears which
+// need new ones wait, and are added in a later frame, once the meshes have
+// been received.
+static void addGears(std::vector<ThreeDimensionalObject> &objects, MeshCache &meshes, int fieldGears)
+{
+    auto start = std::chrono::steady_clock::now();
+    std::size_t first = objects.size();
+    bool added = false, requested = false;
+    std::vector<ThreeDimensionalObject> row;
+    std::vector<GearBlueprint> blueprints;
+    for (; gearRows < Input::GetKeyState()->gearRows; gearRows++) {
+        row.clear();
+        blueprints.clear();
+        addGearRow(row, blueprints, gearRows, fieldGears);
+        if (!meshLoader) meshes.beginBatch();
+        for (std::size_t i = 0; i < row.size(); i++) {
+            if (meshLoader) {
+                waitingGears.push_back({row[i], blueprints[i]});
+            } else {
+                row[i].setupForDrawing(blueprints[i], meshes);
+                objects.push_back(row[i]);
+            }
+        }
+        if (!meshLoader) meshes.endBatch();
+        added = !meshLoader;
+        requested = true;
+    }
+    if (meshLoader && !waitingGears.empty()) {
+        meshes.receive(*meshLoader);
+        auto kept = waitingGears.begin();
+        for (WaitingGear& gear : waitingGears) {
+            if (gear.object.setupForDrawing(gear.blueprint, meshes, *meshLoader)) {
+                objects.push_back(gear.object);
+                added = true;
+            } else {
+                *kept++ = gear;
+            }
+        }
+        waitingGears.erase(kept, waitingGears.end());
+    }
+    if (added) {
+        // The path is already prepared, so only the new objects are
+        // uploaded, and the programs still being linked aren't waited for
+        updateObjects(objects, first, renderPath);
+    }
+    if (added || requested) {
+        longestGearFrame = std::max(longestGearFrame, millisecondsSince(start));
+    }
+}
+
+// Destroy everything which holds OpenGL objects, while the context is still
+// there. The loader thread goes first, and the stream buffer last, since the
+// renderers write into it.
+static void releaseRenderers()
+{
+    meshLoader.reset();
+    shaderWatcher.reset();
+    programCache.reset();
+    dynamicResolution.reset();
+    impostorAtlas.reset();
+    visibilityBuffer.reset();
+    depthPrepass.reset();
+    softwareOcclusion.reset();
+    occlusionCulling.reset();
+    gpuCulling.reset();
+    indirectRenderer.reset();
+    instancedRenderer.reset();
+    clusteredLights.reset();
+    uniformBuffers.reset();
+    streamBuffer.reset();
+}
+
 static void onWindowResize(GLFWwindow* window, int width, int height)
 {
     glViewport(0, 0, width, height);
     viewpoint.onWindowResize(window, width, height);
+    framebufferWidth = width;
+    framebufferHeight = height;
+    renderWidth = width;
+    renderHeight = height;
 }
 
 /* program entry */
@@ -237,6 +1073,14 @@ int main(int argc, char *argv[])
     const unsigned int windowWidth = 800;
     const unsigned int windowHeight = 540;
 
+    // Benchmarks which don't need an OpenGL context
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-bench-extrude") == 0) {
+            Bench::extrude();
+            exit( EXIT_SUCCESS );
+        }
+    }
+
     if( !glfwInit() )
     {
         fprintf( stderr, "Failed to initialize GLFW\n" );
@@ -268,25 +1112,181 @@ int main(int argc, char *argv[])
     onWindowResize(window, windowWidth, windowHeight);
     glfwSwapInterval( 1 );
 
+    // Parse command-line options
+    int fieldGears = 0, lights = 0;
+    double frameBudget = 0.;
+    bool benchSubmit = false, benchCreate = false, benchLayout = false, benchVisibility = false;
+    bool showStats = false, allowDSA = true, allowProgramCache = true;
+    bool watchShaders = false, allowParallelCompile = true, meshThread = true;
+    const VertexLayout* layout = &PLANAR_LAYOUT;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-gears") == 0 && i + 1 < argc) {
+            fieldGears = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-lights") == 0 && i + 1 < argc) {
+            lights = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-instanced") == 0) {
+            renderPath = PATH_INSTANCED;
+        } else if (strcmp(argv[i], "-indirect") == 0) {
+            renderPath = PATH_INDIRECT;
+        } else if (strcmp(argv[i], "-gpu-cull") == 0) {
+            renderPath = PATH_GPU_CULLED;
+        } else if (strcmp(argv[i], "-occlusion") == 0) {
+            occlusionQueries = true;
+        } else if (strcmp(argv[i], "-soft-occlusion") == 0) {
+            softwareOcclusionCulling = true;
+        } else if (strcmp(argv[i], "-no-ssbo") == 0) {
+            allowSSBO = false;
+        } else if (strcmp(argv[i], "-bench-submit") == 0) {
+            benchSubmit = true;
+        } else if (strcmp(argv[i], "-stats") == 0) {
+            showStats = true;
+        } else if (strcmp(argv[i], "-no-state-cache") == 0) {
+            stateCache = false;
+        } else if (strcmp(argv[i], "-no-dsa") == 0) {
+            allowDSA = false;
+        } else if (strcmp(argv[i], "-bench-create") == 0) {
+            benchCreate = true;
+        } else if (strcmp(argv[i], "-layout") == 0 && i + 1 < argc) {
+            i++;
+            for (const VertexLayout* candidate : {&PLANAR_LAYOUT, &INTERLEAVED_LAYOUT, &MIXED_LAYOUT}) {
+                if (strcmp(argv[i], candidate->name) == 0) layout = candidate;
+            }
+        } else if (strcmp(argv[i], "-bench-layout") == 0) {
+            benchLayout = true;
+        } else if (strcmp(argv[i], "-no-cull") == 0) {
+            frustumCulling = false;
+        } else if (strcmp(argv[i], "-dynamic-resolution") == 0 && i + 1 < argc) {
+            frameBudget = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-no-program-cache") == 0) {
+            allowProgramCache = false;
+        } else if (strcmp(argv[i], "-watch-shaders") == 0) {
+            watchShaders = true;
+        } else if (strcmp(argv[i], "-no-parallel-compile") == 0) {
+            allowParallelCompile = false;
+        } else if (strcmp(argv[i], "-no-mesh-thread") == 0) {
+            meshThread = false;
+        } else if (strcmp(argv[i], "-impostors") == 0) {
+            impostorMode = true;
+        } else if (strcmp(argv[i], "-visibility-buffer") == 0) {
+            visibilityBufferMode = true;
+        } else if (strcmp(argv[i], "-bench-visibility") == 0) {
+            benchVisibility = true;
+        } else if (strcmp(argv[i], "-depth-prepass") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "auto") == 0) {
+                prepassMode = PREPASS_AUTO;
+            } else if (strcmp(argv[i], "always") == 0) {
+                prepassMode = PREPASS_ALWAYS;
+            }
+        }
+    }
+
+    if (stateCache)
+        GLState::install();
+
+    if (renderPath == PATH_GPU_CULLED && !GPUCulling::supported()) {
+        fprintf(stderr, "GPU culling is not supported; drawing with multi-draw indirect instead\n");
+        renderPath = PATH_INDIRECT;
+    }
+
+    if (visibilityBufferMode && renderPath == PATH_OBJECTS) {
+        fprintf(stderr, "The visibility buffer needs instance data; drawing with instancing\n");
+        renderPath = PATH_INSTANCED;
+    }
+
+    if (allowProgramCache) {
+        programCache.reset(new ProgramCache("program-cache"));
+    }
+    parallelCompile = allowParallelCompile && GLAD_GL_KHR_parallel_shader_compile;
+    if (parallelCompile) {
+        // As many threads as the driver likes
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+    }
+    if (watchShaders) {
+        // Where the shaders are read from
+        shaderWatcher.reset(new FileWatcher("."));
+    }
+
+    if (benchCreate) {
+        Bench::meshCreation();
+        releaseRenderers();
+        glfwTerminate();
+        exit( EXIT_SUCCESS );
+    }
+
+    // Declared before the objects, so that the meshes outlive them
+    MeshCache meshes(*layout, allowDSA);
     std::vector<ThreeDimensionalObject> objects;
 
-    // Parse command-line options
-    init(objects);
+    init(objects, meshes, fieldGears, lights);
+    if (frameBudget > 0.) {
+        dynamicResolution.reset(new DynamicResolution(frameBudget));
+    }
+
+    if (benchSubmit) {
+        Bench::submission(pathNames, GPUCulling::supported() ? PATH_COUNT : PATH_GPU_CULLED,
+            preparePath, submit);
+        releaseRenderers();
+        glfwTerminate();
+        exit( EXIT_SUCCESS );
+    }
+    if (benchLayout) {
+        Bench::vertexLayouts(preparePath, submit, PATH_INSTANCED);
+        releaseRenderers();
+        glfwTerminate();
+        exit( EXIT_SUCCESS );
+    }
+    if (benchVisibility) {
+        Bench::visibilityBuffer(preparePath, submit, PATH_INSTANCED, useVisibilityBuffer);
+        releaseRenderers();
+        glfwTerminate();
+        exit( EXIT_SUCCESS );
+    }
+
+    if (meshThread) {
+        // The loader's context comes with a window of its own, which is
+        // never shown
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        GLFWwindow* loaderWindow = glfwCreateWindow(1, 1, "Gears mesh loader", NULL, window);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+        if (loaderWindow) {
+            meshLoader.reset(new MeshLoader(loaderWindow, meshes.getArena()));
+        } else {
+            fprintf(stderr, "No context can be shared with a loader thread; loading meshes on the main thread\n");
+        }
+    }
 
     // Main loop
+    bool startupReported = false;
     while( !glfwWindowShouldClose(window) )
     {
+        if (shaderWatcher)
+            reloadShaders(shaderWatcher->changes());
+        finishPrograms(false);
+        addGears(objects, meshes, fieldGears);
+
         // Draw gears
-        draw(objects);
+        draw(objects, meshes);
+        if (stateCache)
+            GLState::endFrame();
 
         // Update animation
         animate();
 
+        if (showStats)
+            printStats();
+        if (showStats && !startupReported) {
+            printStartup();
+            startupReported = true;
+        }
+
         // Swap buffers
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
 
+    releaseRenderers();
+
     // Terminate GLFW
     glfwTerminate();
 
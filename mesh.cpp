@@ -0,0 +1,331 @@
+#include "mesh.h"
+
+#include "gear.h"
+#include "glad.h"
+#include "meshloader.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+// Initial size of the arena, enough for a few dozen gear shapes
+#define MIN_ARENA_VERTICES 65536
+#define MIN_ARENA_INDICES (MIN_ARENA_VERTICES * 2)
+// Vertex data in a batch after which it is uploaded, and a new one started
+#define MAX_BATCH_BYTES (4 << 20)
+
+GeometryArena::GeometryArena(const VertexLayout& layout, bool allowDSA) :
+    layout(layout), ibo(0), vbo(0), vao(0), positionVao(0),
+    vertexCapacity(0), indexCapacity(0), vertexCount(0), indexCount(0),
+    batching(false), batchFirstVertex(0), batchFirstIndex(0)
+{
+    directStateAccess = allowDSA && GLAD_GL_ARB_direct_state_access;
+    if (directStateAccess) {
+        glCreateVertexArrays(1, &vao);
+        glCreateVertexArrays(1, &positionVao);
+    } else {
+        glGenVertexArrays(1, &vao);
+        glGenVertexArrays(1, &positionVao);
+    }
+}
+
+GeometryArena::~GeometryArena()
+{
+    if (ibo) glDeleteBuffers(1, &ibo);
+    if (vbo) glDeleteBuffers(1, &vbo);
+    if (vao) glDeleteVertexArrays(1, &vao);
+    if (positionVao) glDeleteVertexArrays(1, &positionVao);
+}
+
+// Create an immutable buffer of the given size, where the GL supports it.
+// The arena's buffers are only ever written by copying into them.
+static GLuint createBuffer(bool directStateAccess, GLsizeiptr size)
+{
+    GLuint buffer;
+    if (directStateAccess) {
+        glCreateBuffers(1, &buffer);
+        glNamedBufferStorage(buffer, size, nullptr, 0);
+    } else {
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        if (GLAD_GL_ARB_buffer_storage) {
+            glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, 0);
+        } else {
+            glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STATIC_DRAW);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+    return buffer;
+}
+
+// Copy ranges of one buffer into another. Each range is given as
+// {readOffset, writeOffset, size}.
+static void copyBuffer(bool directStateAccess, GLuint from, GLuint to, const std::size_t ranges[][3], int rangeCount)
+{
+    if (directStateAccess) {
+        for (int i = 0; i < rangeCount; i++) {
+            glCopyNamedBufferSubData(from, to, ranges[i][0], ranges[i][1], ranges[i][2]);
+        }
+        return;
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, from);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, to);
+    for (int i = 0; i < rangeCount; i++) {
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+            ranges[i][0], ranges[i][1], ranges[i][2]);
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void GeometryArena::grow(GLuint minVertices, GLuint minIndices)
+{
+    if (minVertices > vertexCapacity) {
+        GLuint capacity = std::max<GLuint>(
+            std::max<GLuint>(minVertices, vertexCapacity * 2), MIN_ARENA_VERTICES);
+        GLuint newVbo = createBuffer(directStateAccess, capacity * layout.vertexSize());
+        if (vbo) {
+            // Each stream starts at a different place in the new buffer
+            std::size_t ranges[ATTRIB_COUNT][3];
+            for (GLuint stream = 0; stream < layout.streamCount(); stream++) {
+                ranges[stream][0] = layout.streamStart(stream, vertexCapacity);
+                ranges[stream][1] = layout.streamStart(stream, capacity);
+                ranges[stream][2] = vertexCount * layout.stride(stream);
+            }
+            copyBuffer(directStateAccess, vbo, newVbo, ranges, layout.streamCount());
+            glDeleteBuffers(1, &vbo);
+        }
+        vbo = newVbo;
+        vertexCapacity = capacity;
+    }
+    if (minIndices > indexCapacity) {
+        GLuint capacity = std::max<GLuint>(
+            std::max<GLuint>(minIndices, indexCapacity * 2), MIN_ARENA_INDICES);
+        GLuint newIbo = createBuffer(directStateAccess, capacity * sizeof(GLuint));
+        if (ibo) {
+            const std::size_t ranges[][3] = {
+                {0, 0, indexCount * sizeof(GLuint)},
+            };
+            copyBuffer(directStateAccess, ibo, newIbo, ranges, 1);
+            glDeleteBuffers(1, &ibo);
+        }
+        ibo = newIbo;
+        indexCapacity = capacity;
+    }
+    setupAttributes();
+}
+
+void GeometryArena::setupAttributes()
+{
+    if (directStateAccess) {
+        glVertexArrayElementBuffer(vao, ibo);
+        ::setupAttributes(layout, vertexCapacity, vao, vbo);
+        glVertexArrayElementBuffer(positionVao, ibo);
+        ::setupAttributes(layout, vertexCapacity, positionVao, vbo, ATTRIB_POSITION + 1);
+        return;
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+    ::setupAttributes(layout, vertexCapacity);
+    glBindVertexArray(positionVao);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+    ::setupAttributes(layout, vertexCapacity, ATTRIB_POSITION + 1);
+    // Release bindings
+    glBindVertexArray(0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+GLuint GeometryArena::stage(const GearBuffersSeparate& data) const
+{
+    // The staging buffer holds all the indices, then each stream of vertices
+    // in turn, so that each one goes into the arena with one copy.
+    const std::size_t vertices = data.pos.size();
+    const std::size_t indexSize = data.indices.size() * sizeof(GLuint);
+    const std::size_t stagingSize = indexSize + vertices * layout.vertexSize();
+    if (!stagingSize) return 0;
+
+    GLuint staging;
+    char* mapped;
+    const GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT;
+    if (directStateAccess) {
+        glCreateBuffers(1, &staging);
+        glNamedBufferStorage(staging, stagingSize, nullptr, GL_MAP_WRITE_BIT);
+        mapped = (char*) glMapNamedBufferRange(staging, 0, stagingSize, access);
+    } else {
+        glGenBuffers(1, &staging);
+        glBindBuffer(GL_COPY_READ_BUFFER, staging);
+        if (GLAD_GL_ARB_buffer_storage) {
+            glBufferStorage(GL_COPY_READ_BUFFER, stagingSize, nullptr, GL_MAP_WRITE_BIT);
+        } else {
+            glBufferData(GL_COPY_READ_BUFFER, stagingSize, nullptr, GL_STREAM_COPY);
+        }
+        mapped = (char*) glMapBufferRange(GL_COPY_READ_BUFFER, 0, stagingSize, access);
+    }
+    memcpy(mapped, data.indices.data(), indexSize);
+    mapped += indexSize;
+    for (GLuint stream = 0; stream < layout.streamCount(); stream++) {
+        packStream(layout, stream, data, mapped);
+        mapped += vertices * layout.stride(stream);
+    }
+    if (directStateAccess) {
+        glUnmapNamedBuffer(staging);
+    } else {
+        glUnmapBuffer(GL_COPY_READ_BUFFER);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    }
+    return staging;
+}
+
+void GeometryArena::copyStaged(GLuint staging, GLuint vertices, GLuint indices, GLuint firstVertex, GLuint firstIndex)
+{
+    if (!staging) return;
+    // The streams start at offsets which depend on the arena's current
+    // capacity
+    const std::size_t indexSize = indices * sizeof(GLuint);
+    const std::size_t indexRanges[][3] = {
+        {0, firstIndex * sizeof(GLuint), indexSize},
+    };
+    std::size_t vertexRanges[ATTRIB_COUNT][3];
+    std::size_t stagingOffset = indexSize;
+    for (GLuint stream = 0; stream < layout.streamCount(); stream++) {
+        std::size_t size = vertices * layout.stride(stream);
+        vertexRanges[stream][0] = stagingOffset;
+        vertexRanges[stream][1] =
+            layout.streamStart(stream, vertexCapacity) + firstVertex * layout.stride(stream);
+        vertexRanges[stream][2] = size;
+        stagingOffset += size;
+    }
+    copyBuffer(directStateAccess, staging, ibo, indexRanges, 1);
+    copyBuffer(directStateAccess, staging, vbo, vertexRanges, layout.streamCount());
+    // The GL keeps the buffer alive until the copies are done
+    glDeleteBuffers(1, &staging);
+}
+
+void GeometryArena::upload(const GearBuffersSeparate& data, GLuint firstVertex, GLuint firstIndex)
+{
+    copyStaged(stage(data), data.pos.size(), data.indices.size(), firstVertex, firstIndex);
+}
+
+float meshRadius(const GearBuffersSeparate& buffers)
+{
+    float radius = 0;
+    for (const vec3_t& position : buffers.pos) {
+        radius = std::max(radius,
+            position.x * position.x + position.y * position.y + position.z * position.z);
+    }
+    return std::sqrt(radius);
+}
+
+Mesh GeometryArena::allocate(GLuint vertices, GLuint indices)
+{
+    if (vertexCount + vertices > vertexCapacity || indexCount + indices > indexCapacity) {
+        grow(vertexCount + vertices, indexCount + indices);
+    }
+    Mesh mesh;
+    mesh.firstIndex = indexCount;
+    mesh.indexCount = indices;
+    mesh.baseVertex = vertexCount;
+    mesh.id = 0;
+    mesh.radius = 0;
+    return mesh;
+}
+
+Mesh GeometryArena::add(const GearBuffersSeparate& gearBuffers)
+{
+    GLuint vertices = gearBuffers.pos.size();
+    GLuint indices = gearBuffers.indices.size();
+    Mesh mesh = allocate(vertices, indices);
+    mesh.radius = meshRadius(gearBuffers);
+
+    if (batching) {
+        // Append each stream to the batch's
+        pending.pos.insert(pending.pos.end(), gearBuffers.pos.begin(), gearBuffers.pos.end());
+        pending.nrm.insert(pending.nrm.end(), gearBuffers.nrm.begin(), gearBuffers.nrm.end());
+        pending.bary.insert(pending.bary.end(), gearBuffers.bary.begin(), gearBuffers.bary.end());
+        pending.indices.insert(pending.indices.end(), gearBuffers.indices.begin(), gearBuffers.indices.end());
+    } else {
+        upload(gearBuffers, vertexCount, indexCount);
+    }
+
+    vertexCount += vertices;
+    indexCount += indices;
+    if (batching && pending.totalSize() >= MAX_BATCH_BYTES) {
+        // Carry on with a new batch, so that the staging memory stays small
+        endBatch();
+        beginBatch();
+    }
+    return mesh;
+}
+
+Mesh GeometryArena::addStaged(GLuint staging, GLuint vertices, GLuint indices)
+{
+    Mesh mesh = allocate(vertices, indices);
+    copyStaged(staging, vertices, indices, vertexCount, indexCount);
+    vertexCount += vertices;
+    indexCount += indices;
+    return mesh;
+}
+
+void GeometryArena::beginBatch()
+{
+    if (batching) return;
+    batching = true;
+    batchFirstVertex = vertexCount;
+    batchFirstIndex = indexCount;
+}
+
+void GeometryArena::endBatch()
+{
+    if (!batching) return;
+    batching = false;
+    upload(pending, batchFirstVertex, batchFirstIndex);
+    // Keep the memory for the next batch
+    pending.pos.clear();
+    pending.nrm.clear();
+    pending.bary.clear();
+    pending.indices.clear();
+}
+
+const Mesh* MeshCache::get(const GearBlueprint& bp)
+{
+    GearBlueprint shape = bp.canonical();
+    auto found = meshes.find(shape);
+    if (found == meshes.end()) {
+        GearBuffersSeparate buffers = gear(shape);
+        Mesh mesh = arena.add(buffers);
+        mesh.id = meshes.size();
+        mesh.teeth = shape.teeth;
+        mesh.occluder = gearOccluder(buffers);
+        found = meshes.emplace(shape, mesh).first;
+    }
+    return &found->second;
+}
+
+const Mesh* MeshCache::request(const GearBlueprint& bp, MeshLoader& loader)
+{
+    GearBlueprint shape = bp.canonical();
+    auto found = meshes.find(shape);
+    if (found != meshes.end()) return &found->second;
+    if (queued.insert(shape).second) {
+        loader.request(shape);
+    }
+    return nullptr;
+}
+
+std::size_t MeshCache::receive(MeshLoader& loader)
+{
+    std::vector<StagedMesh> ready = loader.finished();
+    for (StagedMesh& staged : ready) {
+        Mesh mesh = arena.addStaged(staged.buffer, staged.vertexCount, staged.indexCount);
+        mesh.id = meshes.size();
+        mesh.radius = staged.radius;
+        mesh.teeth = staged.shape.teeth;
+        mesh.occluder = std::move(staged.occluder);
+        meshes.emplace(staged.shape, mesh);
+        queued.erase(staged.shape);
+    }
+    return ready.size();
+}
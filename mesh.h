@@ -0,0 +1,159 @@
+#pragma once
+
+#include "glad.h"
+#include "gear.h"
+#include "vertexlayout.h"
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+class MeshLoader;
+
+// Location of the geometry for one canonical gear shape within the geometry
+// arena. Many objects can share one mesh, since each object supplies its own
+// position, rotation and scale.
+struct Mesh {
+    // Offset of the first index in the index buffer, in indices
+    GLuint firstIndex;
+    // Used for rendering a complete mesh
+    GLuint indexCount;
+    // Added to each index, since the indices of each mesh start from 0
+    GLint baseVertex;
+    // Number of meshes created before this one; identifies it in sort keys
+    GLuint id;
+    // Distance of the furthest vertex from the origin
+    float radius;
+    // Teeth of the gear shape; turning it by a whole tooth leaves it looking
+    // the same
+    GLint teeth;
+    // Triangles kept for software occlusion culling; see gearOccluder()
+    std::vector<vec3_t> occluder;
+
+    // Byte offset of the first index, for glDrawElements* calls
+    const void* indexOffset() const {
+        return (const void*) (firstIndex * sizeof(GLuint));
+    }
+};
+
+// One vertex buffer and one index buffer, which every mesh is suballocated
+// from, and the vertex arrays which read them: one with every attribute, and
+// one with only positions, for depth-only passes. The vertex buffer is split
+// into the streams of a VertexLayout, each with room for every vertex.
+//
+// Meshes are uploaded through a staging buffer, which all of their streams
+// are written into with a single mapping, and copied from into the arena on
+// the GPU. The staging buffer can also be written by stage() on another
+// thread, whose context shares objects with the arena's, and added with
+// addStaged() once it is done. Between beginBatch() and endBatch(), added meshes are gathered
+// and uploaded together, through one staging buffer per few megabytes.
+//
+// With ARB_direct_state_access (core in GL 4.5), the buffers and vertex array
+// are created and filled through their names, without binding anything.
+// Otherwise, each one is bound to be edited, and unbound again.
+class GeometryArena {
+    private:
+    const VertexLayout& layout;
+    bool directStateAccess;
+    // OpenGL resource handles
+    GLuint ibo;
+    GLuint vbo;
+    GLuint vao;
+    GLuint positionVao;
+    // Allocated and used space, in vertices and indices
+    GLuint vertexCapacity;
+    GLuint indexCapacity;
+    GLuint vertexCount;
+    GLuint indexCount;
+    // Data of the meshes added since beginBatch(), one after another, and
+    // where the first of them goes
+    bool batching;
+    GearBuffersSeparate pending;
+    GLuint batchFirstVertex;
+    GLuint batchFirstIndex;
+
+    // Reallocate the buffers so that they hold at least the given number of
+    // vertices and indices, copying the existing geometry over.
+    void grow(GLuint minVertices, GLuint minIndices);
+    void setupAttributes();
+    // Make room for a mesh, growing the buffers if need be, and say where
+    // it goes
+    Mesh allocate(GLuint vertices, GLuint indices);
+    // Copy one or more meshes, which have space allocated from firstVertex
+    // and firstIndex, into the arena
+    void upload(const GearBuffersSeparate& data, GLuint firstVertex, GLuint firstIndex);
+    // The same, from a buffer written by stage(), which is deleted
+    void copyStaged(GLuint staging, GLuint vertices, GLuint indices, GLuint firstVertex, GLuint firstIndex);
+
+    public:
+    // allowDSA can be turned off to use the GL 3.3 path even where DSA is
+    // supported
+    GeometryArena(const VertexLayout& layout = PLANAR_LAYOUT, bool allowDSA = true);
+
+    // Prevent copying! See: https://www.khronos.org/opengl/wiki/Common_Mistakes#RAII_and_hidden_destructor_calls
+    GeometryArena(GeometryArena& other) = delete;
+    GeometryArena& operator= (GeometryArena& other) = delete;
+
+    ~GeometryArena();
+
+    // Append a mesh to the arena. Its data is uploaded straight away, or at
+    // endBatch() while batching.
+    Mesh add(const GearBuffersSeparate& buffers);
+    // A new buffer holding the given meshes' data, laid out to be copied
+    // into the arena, or 0 if there is none. Only reads the layout, so it
+    // can be called on any thread whose context shares objects with the
+    // arena's; nothing may read the buffer until the GL has written it.
+    GLuint stage(const GearBuffersSeparate& data) const;
+    // Append a mesh from a buffer written by stage(), which is deleted. Its
+    // radius is left at 0.
+    Mesh addStaged(GLuint staging, GLuint vertices, GLuint indices);
+    // Hold back meshes added from now on, and upload them in as few
+    // transfers as possible. Nothing may be drawn from the arena until
+    // endBatch().
+    void beginBatch();
+    void endBatch();
+    // Bind the vertex array, which every mesh is drawn with. With
+    // positionsOnly, the one which reads nothing else is bound instead.
+    void bind(bool positionsOnly = false) const { glBindVertexArray(getVertexArray(positionsOnly)); }
+    GLuint getVertexArray(bool positionsOnly = false) const { return positionsOnly ? positionVao : vao; }
+    // The buffers themselves, for shaders which fetch vertices by hand. The
+    // streams of the vertex buffer are laid out for getVertexCapacity()
+    // vertices.
+    GLuint getVertexBuffer() const { return vbo; }
+    GLuint getIndexBuffer() const { return ibo; }
+    GLuint getVertexCapacity() const { return vertexCapacity; }
+    bool usesDirectStateAccess() const { return directStateAccess; }
+    const VertexLayout& getLayout() const { return layout; }
+};
+
+// Distance of the furthest vertex from the origin
+float meshRadius(const GearBuffersSeparate& buffers);
+
+// Owns all meshes, keyed by canonical blueprint.
+class MeshCache {
+    private:
+    GeometryArena arena;
+    // Pointers to the elements of an unordered_map stay valid when it grows
+    std::unordered_map<GearBlueprint, Mesh, GearBlueprintHash> meshes;
+    // Shapes a MeshLoader is still working on
+    std::unordered_set<GearBlueprint, GearBlueprintHash> queued;
+
+    public:
+    MeshCache(const VertexLayout& layout = PLANAR_LAYOUT, bool allowDSA = true) :
+        arena(layout, allowDSA) {}
+
+    // Get the mesh for the given blueprint, generating and uploading it if no
+    // gear with the same canonical shape has been seen before.
+    const Mesh* get(const GearBlueprint& bp);
+    // The same, without waiting: if there is no mesh yet, it is queued on
+    // loader, to be generated and uploaded in the background, and nullptr
+    // is returned until receive() has added it.
+    const Mesh* request(const GearBlueprint& bp, MeshLoader& loader);
+    // Add the meshes loader has finished uploading, returning how many.
+    // Never waits.
+    std::size_t receive(MeshLoader& loader);
+    std::size_t size() const { return meshes.size(); }
+    // See GeometryArena
+    void beginBatch() { arena.beginBatch(); }
+    void endBatch() { arena.endBatch(); }
+    const GeometryArena& getArena() const { return arena; }
+};
@@ -0,0 +1,100 @@
+#include "meshloader.h"
+
+#include "glad.h"
+#include "glstate.h"
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+#include <chrono>
+#include <utility>
+
+MeshLoader::MeshLoader(GLFWwindow* context, const GeometryArena& arena) :
+    context(context), arena(arena), quit(false), stats()
+{
+    thread = std::thread(&MeshLoader::work, this);
+}
+
+MeshLoader::~MeshLoader()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    wake.notify_one();
+    thread.join();
+    // Uploads which were never received
+    for (StagedMesh& mesh : staged) {
+        glDeleteSync(mesh.fence);
+        glDeleteBuffers(1, &mesh.buffer);
+    }
+    glfwDestroyWindow(context);
+}
+
+void MeshLoader::work()
+{
+    glfwMakeContextCurrent(context);
+    // The state cache only follows the render thread's context
+    GLState::untrackThisThread();
+    for (;;) {
+        GearBlueprint shape;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return quit || !queue.empty(); });
+            if (quit) break;
+            shape = queue.front();
+            queue.pop_front();
+        }
+        auto start = std::chrono::steady_clock::now();
+        GearBuffersSeparate buffers = gear(shape);
+        StagedMesh mesh;
+        mesh.shape = shape;
+        mesh.buffer = arena.stage(buffers);
+        mesh.vertexCount = buffers.pos.size();
+        mesh.indexCount = buffers.indices.size();
+        mesh.radius = meshRadius(buffers);
+        mesh.occluder = gearOccluder(buffers);
+        mesh.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        // A fence can only be signalled once it has been sent to the GPU,
+        // and the render thread can't flush this context for it
+        glFlush();
+        double milliseconds = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        staged.push_back(std::move(mesh));
+        stats.meshes++;
+        stats.milliseconds += milliseconds;
+    }
+    glfwMakeContextCurrent(nullptr);
+}
+
+void MeshLoader::request(const GearBlueprint& shape)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(shape);
+    }
+    wake.notify_one();
+}
+
+std::vector<StagedMesh> MeshLoader::finished()
+{
+    std::vector<StagedMesh> ready;
+    std::lock_guard<std::mutex> lock(mutex);
+    // The fences are signalled in order, so the first one still pending
+    // ends the search
+    std::size_t count = 0;
+    for (; count < staged.size(); count++) {
+        GLenum status = glClientWaitSync(staged[count].fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) break;
+        glDeleteSync(staged[count].fence);
+        ready.push_back(std::move(staged[count]));
+    }
+    staged.erase(staged.begin(), staged.begin() + count);
+    return ready;
+}
+
+MeshLoaderStats MeshLoader::totals()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "glad.h"
+#include "gear.h"
+#include "mesh.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct GLFWwindow;
+
+// A mesh generated and uploaded by the loader thread
+struct StagedMesh {
+    // The canonical shape it was generated from
+    GearBlueprint shape;
+    // Written by GeometryArena::stage()
+    GLuint buffer;
+    GLuint vertexCount;
+    GLuint indexCount;
+    float radius;
+    std::vector<vec3_t> occluder;
+    // Signalled once the GPU has written the buffer
+    GLsync fence;
+};
+
+struct MeshLoaderStats {
+    // Meshes generated and uploaded by the loader thread, and the time it
+    // took over them, in milliseconds
+    unsigned int meshes;
+    double milliseconds;
+};
+
+// Generates and uploads meshes on a thread of its own, so that gears of
+// shapes which haven't been seen before can be added without holding up the
+// frame.
+//
+// The thread makes a context current which shares objects with the render
+// thread's. It writes each mesh into a staging buffer of its own, with
+// GeometryArena::stage(), and puts a fence after it. The render thread
+// polls the fences, and only copies a mesh into the arena once its fence is
+// signalled, which takes a few copies on the GPU. Vertex arrays aren't
+// shared between contexts, so the arena's stay with the render thread, and
+// so do its buffers, which are replaced whenever it grows.
+class MeshLoader {
+    private:
+    GLFWwindow* context;
+    const GeometryArena& arena;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    // Shapes waiting to be generated, and meshes whose fences haven't been
+    // seen signalled yet, oldest first
+    std::deque<GearBlueprint> queue;
+    std::vector<StagedMesh> staged;
+    bool quit;
+    MeshLoaderStats stats;
+
+    void work();
+
+    public:
+    // context is a hidden window, whose context shares objects with the
+    // arena's; the loader makes it current on its thread, and destroys it.
+    // Call on the main thread, as GLFW's windows have to be.
+    MeshLoader(GLFWwindow* context, const GeometryArena& arena);
+
+    // Not copyable, since the thread points back at it
+    MeshLoader(MeshLoader& other) = delete;
+    MeshLoader& operator= (MeshLoader& other) = delete;
+
+    // Stops the thread once it has finished the mesh it is working on. The
+    // render thread's context must be current.
+    ~MeshLoader();
+
+    // Queue a canonical shape to be generated and uploaded
+    void request(const GearBlueprint& shape);
+    // The meshes whose uploads the GPU has finished, in the order they were
+    // requested. Their buffers go to the caller. Never waits.
+    std::vector<StagedMesh> finished();
+
+    MeshLoaderStats totals();
+};
@@ -0,0 +1,162 @@
+#include "occlusion.h"
+
+#include "culling.h"
+#include "glad.h"
+#include "uniforms.h"
+#include <cmath>
+
+// Width of the grid cells objects are clustered by, in world units. Each
+// holds about four gears of the gear field.
+#define CLUSTER_SIZE 9.f
+// Visible clusters are queried again every this many frames. Their queries
+// are spread over the frames, rather than all coming at once.
+#define VISIBLE_QUERY_INTERVAL 8
+// A box this close to the camera may be cut by the near plane, which could
+// hide it from its own query
+#define NEAR_MARGIN .125f
+
+// Vertices in the box drawn by bounds.vert
+#define BOX_VERTICES 36
+
+OcclusionCulling::OcclusionCulling() :
+    program(0), boxMinLocation(-1), boxMaxLocation(-1), vertexArray(0), frame(0), stats()
+{
+    glGenVertexArrays(1, &vertexArray);
+}
+
+OcclusionCulling::~OcclusionCulling()
+{
+    deleteQueries();
+    if (vertexArray) glDeleteVertexArrays(1, &vertexArray);
+    if (program) glDeleteProgram(program);
+}
+
+void OcclusionCulling::setProgram(GLuint newProgram)
+{
+    if (program) glDeleteProgram(program);
+    program = newProgram;
+    boxMinLocation = glGetUniformLocation(program, "boxMin");
+    boxMaxLocation = glGetUniformLocation(program, "boxMax");
+    UniformBuffers::bindBlocks(program);
+}
+
+void OcclusionCulling::deleteQueries()
+{
+    for (Cluster& cluster : clusters) {
+        glDeleteQueries(1, &cluster.query);
+    }
+}
+
+void OcclusionCulling::update(const std::vector<ThreeDimensionalObject>& objects, std::size_t first)
+{
+    if (first == 0) {
+        deleteQueries();
+        clusters.clear();
+        cells.clear();
+    }
+    objectClusters.resize(objects.size());
+    objectTriangles.resize(objects.size());
+
+    for (std::size_t i = first; i < objects.size(); i++) {
+        const ThreeDimensionalObject& object = objects[i];
+        glm::vec3 position(object.position.x, object.position.y, object.position.z);
+        uint64_t key = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            int cell = (int) std::floor(position[axis] / CLUSTER_SIZE);
+            key = key << 21 | (cell & 0x1fffff);
+        }
+        auto found = cells.find(key);
+        if (found == cells.end()) {
+            found = cells.emplace(key, (GLuint) clusters.size()).first;
+            Cluster cluster;
+            cluster.min = glm::vec3(INFINITY);
+            cluster.max = glm::vec3(-INFINITY);
+            glGenQueries(1, &cluster.query);
+            cluster.pending = false;
+            cluster.occluded = false;
+            cluster.inFrustum = false;
+            clusters.push_back(cluster);
+        }
+        Cluster& cluster = clusters[found->second];
+        // The box around the object's bounding sphere, which holds it
+        // however it turns
+        float radius = boundingRadius(object);
+        cluster.min = glm::min(cluster.min, position - radius);
+        cluster.max = glm::max(cluster.max, position + radius);
+        // The new object may well be in sight, whatever hid the rest
+        cluster.occluded = false;
+        objectClusters[i] = found->second;
+        objectTriangles[i] = object.getMesh()->indexCount / 3;
+    }
+}
+
+void OcclusionCulling::cull(std::vector<GLuint>& visible, const glm::vec3& eye)
+{
+    stats = OcclusionStats();
+    frame++;
+
+    for (Cluster& cluster : clusters) {
+        if (cluster.pending) {
+            GLuint available = GL_FALSE;
+            glGetQueryObjectuiv(cluster.query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available) {
+                GLuint samplesPassed;
+                glGetQueryObjectuiv(cluster.query, GL_QUERY_RESULT, &samplesPassed);
+                cluster.occluded = !samplesPassed;
+                cluster.pending = false;
+            }
+        }
+        cluster.inFrustum = false;
+    }
+    for (GLuint object : visible) {
+        clusters[objectClusters[object]].inFrustum = true;
+    }
+    for (Cluster& cluster : clusters) {
+        bool nearEye = true;
+        for (int axis = 0; axis < 3; axis++) {
+            nearEye = nearEye &&
+                eye[axis] > cluster.min[axis] - NEAR_MARGIN &&
+                eye[axis] < cluster.max[axis] + NEAR_MARGIN;
+        }
+        // Clusters coming into view, or around the camera, are drawn until
+        // a query says otherwise
+        if (!cluster.inFrustum || nearEye) {
+            cluster.occluded = false;
+        }
+        if (cluster.occluded) stats.clustersCulled++;
+    }
+
+    std::size_t kept = 0;
+    for (GLuint object : visible) {
+        if (!clusters[objectClusters[object]].occluded) {
+            visible[kept++] = object;
+        } else {
+            stats.objectsCulled++;
+            stats.trianglesCulled += objectTriangles[object];
+        }
+    }
+    visible.resize(kept);
+}
+
+void OcclusionCulling::query()
+{
+    if (!program) return;
+    glUseProgram(program);
+    glBindVertexArray(vertexArray);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    for (std::size_t i = 0; i < clusters.size(); i++) {
+        Cluster& cluster = clusters[i];
+        if (!cluster.inFrustum || cluster.pending) continue;
+        if (!cluster.occluded && (frame + i) % VISIBLE_QUERY_INTERVAL != 0) continue;
+        glUniform3fv(boxMinLocation, 1, &cluster.min.x);
+        glUniform3fv(boxMaxLocation, 1, &cluster.max.x);
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, cluster.query);
+        glDrawArrays(GL_TRIANGLES, 0, BOX_VERTICES);
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+        cluster.pending = true;
+        stats.queries++;
+    }
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDepthMask(GL_TRUE);
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "glad.h"
+#include "3dobject.h"
+#include <glm/glm.hpp>
+#include <unordered_map>
+#include <vector>
+
+struct OcclusionStats {
+    // Queries issued this frame
+    unsigned int queries;
+    // Clusters, objects and triangles in the frustum which were left out
+    // as occluded
+    unsigned int clustersCulled;
+    unsigned int objectsCulled;
+    unsigned int trianglesCulled;
+};
+
+// Occlusion culling with GL_ANY_SAMPLES_PASSED queries on the bounding
+// boxes of clusters of nearby objects.
+//
+// The queries are drawn after the frame, against its depth buffer, and
+// their results are only collected once the GPU has them, so the CPU never
+// waits for them. Until then, each cluster keeps the result it had
+// before, which is close enough from one frame to the next. Clusters which
+// were visible are only queried again every few frames, while occluded ones
+// are queried every frame, so that they reappear quickly.
+class OcclusionCulling {
+    private:
+    struct Cluster {
+        glm::vec3 min, max;
+        GLuint query;
+        bool pending;
+        bool occluded;
+        // Whether any of its objects are in the frustum this frame
+        bool inFrustum;
+    };
+    std::vector<Cluster> clusters;
+    // Cluster index of each grid cell, keyed by its packed coordinates
+    std::unordered_map<uint64_t, GLuint> cells;
+    // Index of each object's cluster
+    std::vector<GLuint> objectClusters;
+    std::vector<unsigned int> objectTriangles;
+    // bounds.vert, and its uniforms
+    GLuint program;
+    GLint boxMinLocation;
+    GLint boxMaxLocation;
+    // The queries don't read any attributes, but something has to be bound
+    GLuint vertexArray;
+    unsigned int frame;
+    OcclusionStats stats;
+
+    void deleteQueries();
+
+    public:
+    // Culls nothing until it is given a program
+    OcclusionCulling();
+
+    // Prevent copying! See: https://www.khronos.org/opengl/wiki/Common_Mistakes#RAII_and_hidden_destructor_calls
+    OcclusionCulling(OcclusionCulling& other) = delete;
+    OcclusionCulling& operator= (OcclusionCulling& other) = delete;
+
+    ~OcclusionCulling();
+
+    // Draw the bounding boxes with program, which is bounds.vert, linked,
+    // from now on. Deletes the program before it.
+    void setProgram(GLuint program);
+
+    // Group the objects from first on into clusters. Only needs to be called
+    // again when objects are added, removed or moved. When they are only
+    // added, first can skip the ones grouped before, which keeps the
+    // clusters' queries and their results.
+    void update(const std::vector<ThreeDimensionalObject>& objects, std::size_t first = 0);
+    // Collect the query results which are ready, and remove the objects of
+    // occluded clusters from visible, which holds the indices of the objects
+    // in the frustum. eye is the camera's position.
+    void cull(std::vector<GLuint>& visible, const glm::vec3& eye);
+    // Query the clusters which are due, against the depth buffer of the
+    // objects drawn since cull()
+    void query();
+
+    const OcclusionStats& lastFrame() const { return stats; }
+};
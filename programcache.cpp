@@ -0,0 +1,151 @@
+#include "programcache.h"
+
+#include "glad.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#ifdef _WIN32
+ #include <direct.h>
+#else
+ #include <sys/stat.h>
+#endif
+
+// Written at the start of every file, followed by the binary
+struct ProgramFileHeader {
+    char magic[8];
+    uint64_t key;
+    GLenum format;
+    GLsizei length;
+};
+static const char PROGRAM_FILE_MAGIC[8] = {'G', 'E', 'A', 'R', 'S', 'P', 'R', '1'};
+
+// 64-bit FNV-1a, continuing from hash
+static uint64_t fnv1a(const char* data, size_t length, uint64_t hash = 14695981039346656037ULL)
+{
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char) data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+ProgramCache::ProgramCache(const char* directory) :
+    directory(directory), enabled(supported()), stats()
+{
+    for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+        const char* string = (const char*) glGetString(name);
+        driver += string ? string : "";
+        // Keeps the strings apart, so that no two sets run together the same
+        driver += '\n';
+    }
+    if (!enabled) return;
+#ifdef _WIN32
+    int result = _mkdir(directory);
+#else
+    int result = mkdir(directory, 0755);
+#endif
+    if (result != 0 && errno != EEXIST) {
+        fprintf(stderr, "Program cache directory %s cannot be created: %s\n", directory, strerror(errno));
+        enabled = false;
+    }
+}
+
+bool ProgramCache::supported()
+{
+    if (!GLAD_GL_ARB_get_program_binary) return false;
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+}
+
+uint64_t ProgramCache::key(const std::string& sources) const
+{
+    return fnv1a(sources.data(), sources.size(), fnv1a(driver.data(), driver.size()));
+}
+
+std::string ProgramCache::path(uint64_t key) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long) key);
+    return directory + name;
+}
+
+GLuint ProgramCache::load(const std::string& sources)
+{
+    if (!enabled) return 0;
+    uint64_t programKey = key(sources);
+    FILE* file = fopen(path(programKey).c_str(), "rb");
+    if (!file) return 0;
+    ProgramFileHeader header;
+    std::vector<char> binary;
+    bool valid = fread(&header, sizeof(header), 1, file) == 1 &&
+        memcmp(header.magic, PROGRAM_FILE_MAGIC, sizeof(header.magic)) == 0 &&
+        header.key == programKey && header.length > 0;
+    if (valid) {
+        binary.resize(header.length);
+        valid = fread(binary.data(), 1, binary.size(), file) == binary.size();
+    }
+    fclose(file);
+    if (!valid) {
+        // Truncated, or from something else; it is overwritten once the
+        // program is compiled
+        stats.rejected++;
+        return 0;
+    }
+
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, header.format, binary.data(), header.length);
+    GLint linkStatus = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
+    if (linkStatus == GL_FALSE) {
+        glDeleteProgram(program);
+        stats.rejected++;
+        return 0;
+    }
+    stats.loaded++;
+    return program;
+}
+
+void ProgramCache::prepare(GLuint program)
+{
+    if (enabled) {
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+}
+
+void ProgramCache::save(GLuint program, const std::string& sources)
+{
+    stats.compiled++;
+    if (!enabled) return;
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) return;
+    ProgramFileHeader header;
+    memcpy(header.magic, PROGRAM_FILE_MAGIC, sizeof(header.magic));
+    header.key = key(sources);
+    std::vector<char> binary(length);
+    glGetProgramBinary(program, length, &header.length, &header.format, binary.data());
+    if (header.length <= 0) return;
+
+    // Written to another name first, so that a run which stops halfway, or
+    // another one loading the same program, never sees half a file
+    std::string finalPath = path(header.key);
+    std::string partialPath = finalPath + ".part";
+    FILE* file = fopen(partialPath.c_str(), "wb");
+    if (!file) {
+        fprintf(stderr, "%s cannot be written: %s\n", partialPath.c_str(), strerror(errno));
+        return;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(binary.data(), 1, header.length, file) == (size_t) header.length;
+    written = fclose(file) == 0 && written;
+#ifdef _WIN32
+    // rename() won't replace a file there
+    remove(finalPath.c_str());
+#endif
+    if (!written || rename(partialPath.c_str(), finalPath.c_str()) != 0) {
+        fprintf(stderr, "%s cannot be written\n", finalPath.c_str());
+        remove(partialPath.c_str());
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "glad.h"
+#include <cstdint>
+#include <string>
+
+struct ProgramCacheStats {
+    // Programs loaded from the cache, linked from source, and loaded but
+    // turned down by the driver, then linked from source
+    unsigned int loaded;
+    unsigned int compiled;
+    unsigned int rejected;
+    // Time the main thread spent loading and compiling programs, in
+    // milliseconds, leaving out any compiling done by the driver's threads
+    double milliseconds;
+};
+
+// Keeps linked programs on disk, with glGetProgramBinary, so that later runs
+// can load them with glProgramBinary instead of compiling their shaders.
+//
+// Each program is stored in a file of its own, named after a hash of its
+// shaders' source, with the defines they were loaded with, and of the
+// driver's vendor, renderer and version strings. Updating the driver or
+// editing a shader therefore picks another file. A binary the driver turns
+// down anyway, which it may do for reasons of its own, is compiled again
+// and the file is replaced.
+//
+// A binary doesn't keep the uniform block bindings or sampler units set
+// after linking, so they have to be set again either way.
+class ProgramCache {
+    private:
+    std::string directory;
+    // Driver identification, which is part of every key
+    std::string driver;
+    bool enabled;
+    ProgramCacheStats stats;
+
+    uint64_t key(const std::string& sources) const;
+    std::string path(uint64_t key) const;
+
+    public:
+    // Stores the programs in the given directory, which is created if it
+    // doesn't exist. Needs a current context.
+    ProgramCache(const char* directory);
+
+    // Whether the driver can return program binaries at all
+    static bool supported();
+
+    // A new program loaded from the binary stored for sources, which are
+    // all of the program's shaders' source, or 0 if there is none or the
+    // driver rejects it
+    GLuint load(const std::string& sources);
+    // Prepare a new program, before linking, so that its binary can be saved
+    void prepare(GLuint program);
+    // Store the binary of a linked program, built from sources
+    void save(GLuint program, const std::string& sources);
+    // Add the time taken to load or compile a program
+    void addTime(double milliseconds) { stats.milliseconds += milliseconds; }
+
+    // Whether programs are stored at all; not if the driver can't return
+    // their binaries, or the directory can't be created
+    bool isEnabled() const { return enabled; }
+    const ProgramCacheStats& totals() const { return stats; }
+};
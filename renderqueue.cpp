@@ -0,0 +1,112 @@
+#include "renderqueue.h"
+
+#include "glad.h"
+#include <cstring>
+#include <utility>
+
+// The sort keys are sorted one byte at a time
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_PASSES (64 / RADIX_BITS)
+
+RenderQueue::RenderQueue()
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+uint64_t RenderQueue::makeKey(GLuint program, unsigned int material, float depth)
+{
+    // The bits of a non-negative float sort in the same order as its value
+    uint32_t depthBits = 0;
+    if (depth > 0) memcpy(&depthBits, &depth, sizeof(depthBits));
+    return (uint64_t) (program & 0xff) << 56
+        | (uint64_t) (material & 0xff) << 48
+        | (uint64_t) depthBits << 16;
+}
+
+void RenderQueue::clear()
+{
+    items.clear();
+    entries.clear();
+}
+
+void RenderQueue::push(uint64_t key, const RenderItem& item)
+{
+    entries.push_back({key, (uint32_t) items.size()});
+    items.push_back(item);
+}
+
+void RenderQueue::sort()
+{
+    std::size_t count = entries.size();
+    if (count < 2) return;
+    scratch.resize(count);
+
+    // Count every digit of every key in one go
+    static unsigned int histograms[RADIX_PASSES][RADIX_BUCKETS];
+    memset(histograms, 0, sizeof(histograms));
+    for (const SortEntry& entry : entries) {
+        for (int pass = 0; pass < RADIX_PASSES; pass++) {
+            histograms[pass][(entry.key >> (pass * RADIX_BITS)) & (RADIX_BUCKETS - 1)]++;
+        }
+    }
+
+    SortEntry* source = entries.data();
+    SortEntry* destination = scratch.data();
+    for (int pass = 0; pass < RADIX_PASSES; pass++) {
+        unsigned int* histogram = histograms[pass];
+        int shift = pass * RADIX_BITS;
+        // Most of the high digits are the same for every key, since there
+        // are few programs and materials, and the low ones are unused. Skip
+        // those passes.
+        if (histogram[(source[0].key >> shift) & (RADIX_BUCKETS - 1)] == count) continue;
+
+        // Turn the counts into the position of each bucket
+        unsigned int offset = 0;
+        for (int bucket = 0; bucket < RADIX_BUCKETS; bucket++) {
+            unsigned int bucketCount = histogram[bucket];
+            histogram[bucket] = offset;
+            offset += bucketCount;
+        }
+        for (std::size_t i = 0; i < count; i++) {
+            destination[histogram[(source[i].key >> shift) & (RADIX_BUCKETS - 1)]++] = source[i];
+        }
+        std::swap(source, destination);
+    }
+    if (source != entries.data()) {
+        entries.swap(scratch);
+    }
+}
+
+void RenderQueue::submit(const UniformBuffers& uniforms)
+{
+    memset(&stats, 0, sizeof(stats));
+    // The binds the draws would take in the order they were pushed
+    unsigned int unsortedBinds = 0;
+    for (std::size_t i = 0; i < items.size(); i++) {
+        if (i == 0 || items[i].program != items[i - 1].program) unsortedBinds++;
+        if (i == 0 || items[i].vertexArray != items[i - 1].vertexArray) unsortedBinds++;
+    }
+
+    GLuint program = 0, vertexArray = 0;
+    bool first = true;
+    for (const SortEntry& entry : entries) {
+        const RenderItem& item = items[entry.item];
+        if (first || item.program != program) {
+            glUseProgram(item.program);
+            program = item.program;
+            stats.binds++;
+        }
+        if (first || item.vertexArray != vertexArray) {
+            glBindVertexArray(item.vertexArray);
+            vertexArray = item.vertexArray;
+            stats.binds++;
+        }
+        first = false;
+        // Every object has its own block, so this bind is never redundant
+        uniforms.bindObject(item.block);
+        item.object->draw();
+        stats.draws++;
+    }
+    stats.bindsSaved = unsortedBinds > stats.binds ? unsortedBinds - stats.binds : 0;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "glad.h"
+#include "3dobject.h"
+#include "uniforms.h"
+#include <cstdint>
+#include <vector>
+
+// One draw call waiting in the render queue, and the state it needs
+struct RenderItem {
+    GLuint program;
+    GLuint vertexArray;
+    const ThreeDimensionalObject* object;
+    // Index of the object's block in the uniform buffers
+    GLuint block;
+};
+
+// Counts for the last frame submitted through a render queue
+struct RenderQueueStats {
+    unsigned int draws;
+    // Program and vertex array binds issued, and how many fewer they were
+    // than submitting the draws in the order they were pushed would take
+    unsigned int binds;
+    unsigned int bindsSaved;
+};
+
+// Collects a frame's draws, sorts them by a 64-bit key, and submits them in
+// that order, skipping binds of state which is already bound. From the most
+// significant bits down, the key holds:
+//
+//   program  (8 bits)
+//   material (8 bits)
+//   depth    (32 bits)
+//   unused   (16 bits)
+//
+// so that draws sharing state end up next to each other, and draws sharing
+// all of it go front to back, which lets early depth testing reject more of
+// what is behind them. Meshes aren't in the key: they all live in the
+// geometry arena and are drawn from its one vertex array, so grouping them
+// would save nothing, and would only order each mesh's draws by depth.
+class RenderQueue {
+    private:
+    struct SortEntry {
+        uint64_t key;
+        uint32_t item;
+    };
+    std::vector<RenderItem> items;
+    std::vector<SortEntry> entries;
+    // Second buffer for the radix sort
+    std::vector<SortEntry> scratch;
+    RenderQueueStats stats;
+
+    public:
+    RenderQueue();
+
+    // Build a sort key. program is the program's name, of which the low 8
+    // bits are kept; programs which share them are still bound correctly,
+    // only not kept apart. depth is the view space distance in front of the
+    // camera; anything behind it counts as 0.
+    static uint64_t makeKey(GLuint program, unsigned int material, float depth);
+
+    // Remove every draw, ready for the next frame
+    void clear();
+    void push(uint64_t key, const RenderItem& item);
+    // Sort the draws by key, with a least significant digit radix sort
+    void sort();
+    // Issue the draws in sorted order
+    void submit(const UniformBuffers& uniforms);
+
+    std::size_t size() const { return items.size(); }
+    const RenderQueueStats& lastFrame() const { return stats; }
+};
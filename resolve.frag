@@ -0,0 +1,204 @@
+#version 330 core
+// INSTANCES_SSBO, CLUSTERED_LIGHTS, and one of LIT or WIREFRAME, may be
+// defined by the program when it loads this shader, as for default.frag.
+#ifdef INSTANCES_SSBO
+#extension GL_ARB_shader_storage_buffer_object : require
+#endif
+
+// Shades the visibility buffer, once per pixel. The geometry pass only wrote
+// which instance and triangle cover each pixel; this fetches that triangle's
+// vertices, transforms and lights them as default.vert does, interpolates
+// the results at the pixel, and shades it as default.frag does.
+
+// Laid out as the structs in uniforms.h
+layout(std140) uniform Frame {
+	mat4 projView;
+	vec3 lightPos;
+	float zoom;
+	float time;
+};
+
+// The instance data the geometry pass was drawn with, as in default.vert.
+// scale.w holds the mesh.
+#ifdef INSTANCES_SSBO
+struct Instance {
+	vec4 positionAngleMultiply;
+	vec4 colourAngleAdd;
+	vec4 scale;
+};
+layout(std430) readonly buffer Instances {
+	Instance instances[];
+};
+#else
+uniform samplerBuffer instances;
+#endif
+
+// The instance plus one, and the triangle, of each pixel; 0 where nothing
+// was drawn
+uniform usampler2D ids;
+uniform sampler2D depth;
+// Every float of the geometry arena's vertex buffer, and every index
+uniform samplerBuffer vertexData;
+uniform usamplerBuffer indexData;
+// First index and base vertex of each mesh, by Mesh::id
+uniform isamplerBuffer meshes;
+// Where the stream of each attribute starts in vertexData, and the distance
+// between its vertices, in floats
+uniform ivec2 positionStream;
+uniform ivec2 normalStream;
+uniform ivec2 baryStream;
+
+out vec4 FragColor;
+
+#if defined(LIT) && defined(CLUSTERED_LIGHTS)
+// As in default.frag, apart from taking the view depth, which gl_FragCoord
+// doesn't hold here
+layout(std140) uniform Lights {
+	vec4 clusterScale;
+	ivec4 clusterCount;
+};
+uniform samplerBuffer lightData;
+uniform usamplerBuffer clusters;
+uniform usamplerBuffer lightIndices;
+
+vec3 pointLights(vec3 position, vec3 normal, float viewDepth) {
+	vec3 coord = vec3(gl_FragCoord.xy * clusterScale.xy, log(viewDepth) * clusterScale.z + clusterScale.w);
+	ivec3 cluster = clamp(ivec3(coord), ivec3(0), clusterCount.xyz - 1);
+	uvec2 list = texelFetch(clusters, (cluster.z * clusterCount.y + cluster.y) * clusterCount.x + cluster.x).xy;
+	vec3 total = vec3(0.);
+	for (uint i = 0u; i < list.y; i++) {
+		int light = int(texelFetch(lightIndices, int(list.x + i)).r);
+		vec4 positionRadius = texelFetch(lightData, light * 2);
+		vec3 toLight = positionRadius.xyz - position;
+		float distance = length(toLight);
+		float falloff = clamp(1. - distance / positionRadius.w, 0., 1.);
+		float intensity = max(0., dot(normal, toLight / distance)) * falloff * falloff;
+		total += texelFetch(lightData, light * 2 + 1).rgb * intensity;
+	}
+	return total;
+}
+#endif
+
+// As in default.frag, but with the screen-space derivatives of the
+// barycentric coordinates passed in. fwidth() would mix in whichever
+// triangles the neighbouring pixels are on.
+float gridFactor (vec2 vBC, vec3 d, float width, float feather) {
+	float w1 = width - feather * 0.5;
+	vec3 bary = vec3(vBC.x, vBC.y, 1.0 - vBC.x - vBC.y);
+	vec3 a3 = smoothstep(d * w1, d * (w1 + feather), bary);
+	return min(min(a3.x, a3.y), a3.z);
+}
+
+vec3 fetchVec3(ivec2 stream, int vertex) {
+	int first = stream.x + vertex * stream.y;
+	return vec3(texelFetch(vertexData, first).r, texelFetch(vertexData, first + 1).r,
+		texelFetch(vertexData, first + 2).r);
+}
+
+vec2 fetchVec2(ivec2 stream, int vertex) {
+	int first = stream.x + vertex * stream.y;
+	return vec2(texelFetch(vertexData, first).r, texelFetch(vertexData, first + 1).r);
+}
+
+float cross2(vec2 a, vec2 b) {
+	return a.x * b.y - a.y * b.x;
+}
+
+// Perspective-correct barycentric coordinates of a point on the screen, in
+// normalized device coordinates, within the triangle with the given corners
+// in clip space
+vec3 barycentrics(vec4 corners[3], vec2 point) {
+	vec3 inverseW = 1. / vec3(corners[0].w, corners[1].w, corners[2].w);
+	vec2 a = corners[0].xy * inverseW.x;
+	vec2 b = corners[1].xy * inverseW.y;
+	vec2 c = corners[2].xy * inverseW.z;
+	// On the screen, each weight is the area of the triangle the point makes
+	// with the other two corners
+	vec3 weights = vec3(cross2(b - point, c - point), cross2(c - point, a - point),
+		cross2(a - point, b - point)) / cross2(b - a, c - a);
+	weights *= inverseW;
+	return weights / (weights.x + weights.y + weights.z);
+}
+
+void main() {
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	uvec2 id = texelFetch(ids, pixel, 0).xy;
+	if (id.x == 0u) discard;
+	int instance = int(id.x - 1u);
+	int triangle = int(id.y);
+
+#ifdef INSTANCES_SSBO
+	vec4 positionAngleMultiply = instances[instance].positionAngleMultiply;
+	vec4 colourAngleAdd = instances[instance].colourAngleAdd;
+	vec4 scaleMesh = instances[instance].scale;
+#else
+	vec4 positionAngleMultiply = texelFetch(instances, instance * 3);
+	vec4 colourAngleAdd = texelFetch(instances, instance * 3 + 1);
+	vec4 scaleMesh = texelFetch(instances, instance * 3 + 2);
+#endif
+	vec3 scale = scaleMesh.xyz;
+	float angle = radians(positionAngleMultiply.w * time * 100. + colourAngleAdd.w);
+	float c = cos(angle), s = sin(angle);
+	mat4 model = mat4(
+		c, s, 0., 0.,
+		-s, c, 0., 0.,
+		0., 0., 1., 0.,
+		positionAngleMultiply.xyz, 1.);
+	mat3 rotation = mat3(model);
+	ivec2 mesh = texelFetch(meshes, int(scaleMesh.w)).xy;
+
+	// The outputs of default.vert at each corner of the triangle which this
+	// variant uses
+	vec4 corners[3];
+#if defined(WIREFRAME)
+	mat3x2 barys;
+#elif defined(LIT)
+	mat3 positions, normals;
+	vec3 lightIntensities;
+#endif
+	for (int i = 0; i < 3; i++) {
+		int vertex = int(texelFetch(indexData, mesh.x + triangle * 3 + i).r) + mesh.y;
+		vec4 scaledPos = vec4(fetchVec3(positionStream, vertex) * scale, 1.);
+#if defined(WIREFRAME)
+		barys[i] = fetchVec2(baryStream, vertex);
+#elif defined(LIT)
+		positions[i] = (model * scaledPos).xyz;
+		normals[i] = normalize(rotation * (fetchVec3(normalStream, vertex) / scale));
+		lightIntensities[i] = max(0, dot(normalize(lightPos - positions[i]), normals[i]));
+#endif
+		corners[i] = projView * model * scaledPos;
+		corners[i].w *= zoom;
+	}
+
+	// Interpolated at the pixel
+	vec2 pixelSize = 2. / vec2(textureSize(ids, 0));
+	vec2 point = gl_FragCoord.xy * pixelSize - 1.;
+	vec3 weights = barycentrics(corners, point);
+	gl_FragDepth = texelFetch(depth, pixel, 0).r;
+#if defined(WIREFRAME)
+	vec2 vBary = barys * weights;
+	// Interpolated at the neighbouring pixels across and up too, for the
+	// derivatives
+	vec2 baryX = barys * barycentrics(corners, point + vec2(pixelSize.x, 0.));
+	vec2 baryY = barys * barycentrics(corners, point + vec2(0., pixelSize.y));
+	vec3 d = abs(vec3(baryX - vBary, vBary.x + vBary.y - baryX.x - baryX.y)) +
+		abs(vec3(baryY - vBary, vBary.x + vBary.y - baryY.x - baryY.y));
+	FragColor = vec4(0.);
+	FragColor.rg = vBary * step(0.75, max(vBary.x, vBary.y));
+	FragColor.rgb += 1.0 - gridFactor(vBary, d, 0.5, 0.5);
+#else
+	vec4 diffuse = vec4(colourAngleAdd.rgb, 1.);
+#if defined(LIT)
+	vec4 lightColour = vec4(vec3(dot(lightIntensities, weights)), 1.);
+#ifdef CLUSTERED_LIGHTS
+	float viewDepth = dot(vec3(corners[0].w, corners[1].w, corners[2].w), weights);
+	lightColour.rgb += pointLights(positions * weights, normalize(normals * weights), viewDepth);
+#endif
+	FragColor = lightColour * diffuse;
+#else
+	float distanceFromCamera = dot(vec3(corners[0].z, corners[1].z, corners[2].z), weights);
+	vec4 grayShade = vec4(vec3(distanceFromCamera / 50.) + .25, 1.);
+	FragColor = grayShade * diffuse;
+#endif
+#endif
+}
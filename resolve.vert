@@ -0,0 +1,8 @@
+#version 330 core
+// One triangle which covers the whole screen, made from gl_VertexID, so that
+// no vertex buffer is needed. resolve.frag runs once for every pixel of it.
+
+void main() {
+	vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 4. - 1.;
+	gl_Position = vec4(corner, 0., 1.);
+}
@@ -0,0 +1,330 @@
+#include "softocclusion.h"
+
+#include "culling.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <utility>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define SOFTWARE_SSE
+#include <xmmintrin.h>
+#endif
+
+// Size of the depth buffer, whatever the size of the window
+#define BUFFER_WIDTH 256
+#define BUFFER_HEIGHT 128
+// Size of a tile, in pixels, each way
+#define TILE_SIZE 8
+#define TILES_X (BUFFER_WIDTH / TILE_SIZE)
+// At most this many of the largest gears in view are occluders
+#define MAX_OCCLUDERS 32
+// Bands of rows rasterized in parallel. Each is a whole number of tiles.
+#define MAX_BANDS 8
+// Triangles and bounds with a corner closer to the camera than this, in
+// clip space w, are cut by the near plane, and left alone
+#define MIN_W 1e-3f
+
+SoftwareOcclusion::SoftwareOcclusion() :
+    depth(BUFFER_WIDTH * BUFFER_HEIGHT, 1.f),
+    tileDepth(TILES_X * (BUFFER_HEIGHT / TILE_SIZE), 1.f),
+    generation(0), busy(0), quit(false), stats()
+{
+    unsigned int cores = std::thread::hardware_concurrency();
+    bands = 1;
+    while (bands * 2 <= MAX_BANDS && (unsigned int) bands * 2 <= cores) {
+        bands *= 2;
+    }
+    for (int band = 1; band < bands; band++) {
+        workers.emplace_back(&SoftwareOcclusion::work, this, band);
+    }
+}
+
+SoftwareOcclusion::~SoftwareOcclusion()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    start.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+void SoftwareOcclusion::work(int band)
+{
+    unsigned int finished = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            start.wait(lock, [&] { return quit || generation != finished; });
+            if (quit) return;
+            finished = generation;
+        }
+        rasterizeBand(band);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            busy--;
+        }
+        done.notify_one();
+    }
+}
+
+// Fill the pixels from x0 to x1 of a row, whose centres are inside the
+// triangle, with the nearer of their depth and the triangle's. x0 is a
+// multiple of 4, and the row is padded to a multiple of 4.
+static void rasterizeRow(float* row, int x0, int x1, float y, const float* edges, const float* depthPlane, float maxDepth)
+{
+    // edges holds a, b, c of each edge; depthPlane a, b, c
+#ifdef SOFTWARE_SSE
+    const __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, .5f);
+    __m128 px = _mm_add_ps(_mm_set1_ps((float) x0), offsets);
+    const __m128 step = _mm_set1_ps(4.f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 far = _mm_set1_ps(maxDepth);
+    __m128 a[3], rowC[3];
+    for (int i = 0; i < 3; i++) {
+        a[i] = _mm_set1_ps(edges[i * 3]);
+        rowC[i] = _mm_set1_ps(edges[i * 3 + 1] * y + edges[i * 3 + 2]);
+    }
+    const __m128 depthA = _mm_set1_ps(depthPlane[0]);
+    const __m128 depthRowC = _mm_set1_ps(depthPlane[1] * y + depthPlane[2]);
+    for (int x = x0; x <= x1; x += 4) {
+        __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a[0], px), rowC[0]), zero);
+        inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a[1], px), rowC[1]), zero));
+        inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a[2], px), rowC[2]), zero));
+        if (_mm_movemask_ps(inside)) {
+            __m128 z = _mm_min_ps(_mm_add_ps(_mm_mul_ps(depthA, px), depthRowC), far);
+            __m128 old = _mm_loadu_ps(row + x);
+            __m128 nearer = _mm_min_ps(old, z);
+            _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+        }
+        px = _mm_add_ps(px, step);
+    }
+#else
+    for (int x = x0; x <= x1; x++) {
+        float px = x + .5f;
+        bool inside = true;
+        for (int i = 0; i < 3; i++) {
+            inside = inside && edges[i * 3] * px + edges[i * 3 + 1] * y + edges[i * 3 + 2] >= 0.f;
+        }
+        if (!inside) continue;
+        float z = std::min(depthPlane[0] * px + depthPlane[1] * y + depthPlane[2], maxDepth);
+        row[x] = std::min(row[x], z);
+    }
+#endif
+}
+
+void SoftwareOcclusion::rasterizeBand(int band)
+{
+    int rows = BUFFER_HEIGHT / bands;
+    int bandMinY = band * rows;
+    int bandMaxY = bandMinY + rows - 1;
+    std::fill(depth.begin() + bandMinY * BUFFER_WIDTH, depth.begin() + (bandMaxY + 1) * BUFFER_WIDTH, 1.f);
+
+    for (const Triangle& triangle : triangles) {
+        int minY = std::max(triangle.minY, bandMinY);
+        int maxY = std::min(triangle.maxY, bandMaxY);
+        float edges[9];
+        for (int i = 0; i < 3; i++) {
+            edges[i * 3] = triangle.edgeA[i];
+            edges[i * 3 + 1] = triangle.edgeB[i];
+            edges[i * 3 + 2] = triangle.edgeC[i];
+        }
+        const float depthPlane[3] = {triangle.depthA, triangle.depthB, triangle.depthC};
+        for (int y = minY; y <= maxY; y++) {
+            rasterizeRow(
+                &depth[y * BUFFER_WIDTH], triangle.minX & ~3, triangle.maxX, y + .5f,
+                edges, depthPlane, triangle.maxDepth);
+        }
+    }
+
+    for (int tileY = bandMinY / TILE_SIZE; tileY <= bandMaxY / TILE_SIZE; tileY++) {
+        for (int tileX = 0; tileX < TILES_X; tileX++) {
+            float furthest = -1.f;
+            for (int y = tileY * TILE_SIZE; y < (tileY + 1) * TILE_SIZE; y++) {
+                const float* row = &depth[y * BUFFER_WIDTH + tileX * TILE_SIZE];
+                furthest = std::max(furthest, *std::max_element(row, row + TILE_SIZE));
+            }
+            tileDepth[tileY * TILES_X + tileX] = furthest;
+        }
+    }
+}
+
+// Transform a point to buffer coordinates: x and y in pixels, z as depth in
+// normalized device coordinates. Returns false if it is too close to the
+// camera.
+static bool toBuffer(const glm::mat4& projView, float x, float y, float z, float* out)
+{
+    float clip[4];
+    for (int row = 0; row < 4; row++) {
+        clip[row] = projView[0][row] * x + projView[1][row] * y + projView[2][row] * z + projView[3][row];
+    }
+    if (clip[3] < MIN_W) return false;
+    out[0] = (clip[0] / clip[3] * .5f + .5f) * BUFFER_WIDTH;
+    out[1] = (clip[1] / clip[3] * .5f + .5f) * BUFFER_HEIGHT;
+    out[2] = clip[2] / clip[3];
+    return true;
+}
+
+void SoftwareOcclusion::addOccluder(const ThreeDimensionalObject& object, const glm::mat4& projView, float time)
+{
+    // Turn the gear as default.vert does
+    float angle = glm::radians(object.angleMultiply * time * 100.f + object.angleAdd);
+    float c = std::cos(angle), s = std::sin(angle);
+    const std::vector<vec3_t>& occluder = object.getMesh()->occluder;
+    for (std::size_t i = 0; i + 2 < occluder.size(); i += 3) {
+        float v[3][3];
+        bool inFront = true;
+        for (int corner = 0; corner < 3; corner++) {
+            const vec3_t& p = occluder[i + corner];
+            float x = p.x * object.scale.x, y = p.y * object.scale.y;
+            inFront = inFront && toBuffer(projView,
+                c * x - s * y + object.position.x,
+                s * x + c * y + object.position.y,
+                p.z * object.scale.z + object.position.z, v[corner]);
+        }
+        if (!inFront) continue;
+
+        // Counter-clockwise triangles face the camera
+        float area = (v[1][0] - v[0][0]) * (v[2][1] - v[0][1]) - (v[2][0] - v[0][0]) * (v[1][1] - v[0][1]);
+        if (area <= 0.f) continue;
+
+        Triangle triangle;
+        for (int edge = 0; edge < 3; edge++) {
+            const float* from = v[edge];
+            const float* to = v[(edge + 1) % 3];
+            float a = from[1] - to[1];
+            float b = to[0] - from[0];
+            // Pixels are covered when their centre is. Requiring the whole
+            // pixel leaves almost nothing of the thin triangles gears are
+            // made of.
+            triangle.edgeA[edge] = a;
+            triangle.edgeB[edge] = b;
+            triangle.edgeC[edge] = -a * from[0] - b * from[1];
+        }
+        float dz1 = v[1][2] - v[0][2], dz2 = v[2][2] - v[0][2];
+        triangle.depthA = (dz1 * (v[2][1] - v[0][1]) - dz2 * (v[1][1] - v[0][1])) / area;
+        triangle.depthB = (dz2 * (v[1][0] - v[0][0]) - dz1 * (v[2][0] - v[0][0])) / area;
+        // The furthest depth within each pixel
+        triangle.depthC = v[0][2] - triangle.depthA * v[0][0] - triangle.depthB * v[0][1] +
+            .5f * (std::fabs(triangle.depthA) + std::fabs(triangle.depthB));
+        triangle.maxDepth = std::max(v[0][2], std::max(v[1][2], v[2][2]));
+        triangle.minX = std::max(0, (int) std::floor(std::min(v[0][0], std::min(v[1][0], v[2][0]))));
+        triangle.maxX = std::min(BUFFER_WIDTH - 1, (int) std::floor(std::max(v[0][0], std::max(v[1][0], v[2][0]))));
+        triangle.minY = std::max(0, (int) std::floor(std::min(v[0][1], std::min(v[1][1], v[2][1]))));
+        triangle.maxY = std::min(BUFFER_HEIGHT - 1, (int) std::floor(std::max(v[0][1], std::max(v[1][1], v[2][1]))));
+        if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY) continue;
+        triangles.push_back(triangle);
+    }
+}
+
+bool SoftwareOcclusion::occluded(const glm::mat4& projView, const glm::vec3& centre, float radius) const
+{
+    // Screen bounds and nearest depth of the box around the sphere
+    float minX = INFINITY, maxX = -INFINITY, minY = INFINITY, maxY = -INFINITY;
+    float nearest = INFINITY;
+    for (int corner = 0; corner < 8; corner++) {
+        float p[3];
+        if (!toBuffer(projView,
+                centre.x + (corner & 1 ? radius : -radius),
+                centre.y + (corner & 2 ? radius : -radius),
+                centre.z + (corner & 4 ? radius : -radius), p)) {
+            return false;
+        }
+        minX = std::min(minX, p[0]);
+        maxX = std::max(maxX, p[0]);
+        minY = std::min(minY, p[1]);
+        maxY = std::max(maxY, p[1]);
+        nearest = std::min(nearest, p[2]);
+    }
+    int x0 = std::max(0, (int) std::floor(minX));
+    int x1 = std::min(BUFFER_WIDTH - 1, (int) std::floor(maxX));
+    int y0 = std::max(0, (int) std::floor(minY));
+    int y1 = std::min(BUFFER_HEIGHT - 1, (int) std::floor(maxY));
+    if (x0 > x1 || y0 > y1) return false;
+
+    for (int tileY = y0 / TILE_SIZE; tileY <= y1 / TILE_SIZE; tileY++) {
+        for (int tileX = x0 / TILE_SIZE; tileX <= x1 / TILE_SIZE; tileX++) {
+            // Most tiles are decided by their furthest depth
+            if (tileDepth[tileY * TILES_X + tileX] < nearest) continue;
+            int tileX0 = std::max(x0, tileX * TILE_SIZE), tileX1 = std::min(x1, tileX * TILE_SIZE + TILE_SIZE - 1);
+            int tileY0 = std::max(y0, tileY * TILE_SIZE), tileY1 = std::min(y1, tileY * TILE_SIZE + TILE_SIZE - 1);
+            for (int y = tileY0; y <= tileY1; y++) {
+                for (int x = tileX0; x <= tileX1; x++) {
+                    if (depth[y * BUFFER_WIDTH + x] >= nearest) return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+void SoftwareOcclusion::cull(
+    const std::vector<ThreeDimensionalObject>& objects,
+    std::vector<GLuint>& visible,
+    const glm::mat4& projView,
+    float time)
+{
+    auto startTime = std::chrono::steady_clock::now();
+    stats = SoftwareOcclusionStats();
+
+    // The gears which look the largest, by radius over distance
+    std::vector<std::pair<float, GLuint>> candidates;
+    candidates.reserve(visible.size());
+    for (GLuint i : visible) {
+        const ThreeDimensionalObject& object = objects[i];
+        if (object.getMesh()->occluder.empty()) continue;
+        float w = projView[0][3] * object.position.x + projView[1][3] * object.position.y +
+            projView[2][3] * object.position.z + projView[3][3];
+        candidates.emplace_back(boundingRadius(object) / std::max(w, MIN_W), i);
+    }
+    std::size_t occluders = std::min(candidates.size(), (std::size_t) MAX_OCCLUDERS);
+    std::partial_sort(candidates.begin(), candidates.begin() + occluders, candidates.end(),
+        [](const std::pair<float, GLuint>& a, const std::pair<float, GLuint>& b) {
+            return a.first > b.first;
+        });
+    triangles.clear();
+    for (std::size_t i = 0; i < occluders; i++) {
+        addOccluder(objects[candidates[i].second], projView, time);
+    }
+    stats.occluders = occluders;
+    stats.triangles = triangles.size();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        generation++;
+        busy = bands - 1;
+    }
+    start.notify_all();
+    rasterizeBand(0);
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&] { return busy == 0; });
+    }
+
+    std::size_t kept = 0;
+    for (GLuint i : visible) {
+        const ThreeDimensionalObject& object = objects[i];
+        glm::vec3 centre(object.position.x, object.position.y, object.position.z);
+        if (!occluded(projView, centre, boundingRadius(object))) {
+            visible[kept++] = i;
+        }
+    }
+    stats.objectsTested = visible.size();
+    stats.objectsCulled = visible.size() - kept;
+    visible.resize(kept);
+
+    stats.milliseconds = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - startTime).count();
+}
+
+const char* SoftwareOcclusion::instructionSet()
+{
+#ifdef SOFTWARE_SSE
+    return "SSE";
+#else
+    return "scalar";
+#endif
+}
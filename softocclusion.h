@@ -0,0 +1,88 @@
+#pragma once
+
+#include "glad.h"
+#include "3dobject.h"
+#include <glm/glm.hpp>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct SoftwareOcclusionStats {
+    unsigned int occluders;
+    // Occluder triangles rasterized, not counting back faces
+    unsigned int triangles;
+    unsigned int objectsTested;
+    unsigned int objectsCulled;
+    // Time taken by cull(), in milliseconds
+    double milliseconds;
+};
+
+// Occlusion culling on the CPU, without waiting for the GPU. The largest
+// gears in view are rasterized into a small depth buffer, and the bounding
+// box of every other gear is tested against it.
+//
+// Occluders are written at the furthest depth they have in each pixel, so
+// that nothing is culled in front of them. As with the GPU's own
+// rasterization, a pixel is covered when its centre is. The buffer is split into bands of rows, which are rasterized in
+// parallel, four pixels at a time with SSE. Each band also keeps the
+// furthest depth of each of its tiles, which most tests are decided by.
+class SoftwareOcclusion {
+    private:
+    // An occluder triangle, set up for rasterizing. Edge functions and depth
+    // are linear in buffer coordinates: a * x + b * y + c.
+    struct Triangle {
+        float edgeA[3], edgeB[3], edgeC[3];
+        float depthA, depthB, depthC;
+        // Depth of the furthest corner, which no pixel is beyond
+        float maxDepth;
+        int minX, maxX, minY, maxY;
+    };
+    // Depth in normalized device coordinates, from the bottom row up
+    std::vector<float> depth;
+    // Furthest depth in each tile
+    std::vector<float> tileDepth;
+    std::vector<Triangle> triangles;
+
+    // Band 0 is rasterized by the thread calling cull(), and each of the
+    // others by a worker
+    int bands;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable start;
+    std::condition_variable done;
+    // Incremented to start the workers on a frame
+    unsigned int generation;
+    int busy;
+    bool quit;
+
+    SoftwareOcclusionStats stats;
+
+    void work(int band);
+    void rasterizeBand(int band);
+    void addOccluder(const ThreeDimensionalObject& object, const glm::mat4& projView, float time);
+    bool occluded(const glm::mat4& projView, const glm::vec3& centre, float radius) const;
+
+    public:
+    SoftwareOcclusion();
+
+    // Not copyable, since the workers point back at it
+    SoftwareOcclusion(SoftwareOcclusion& other) = delete;
+    SoftwareOcclusion& operator= (SoftwareOcclusion& other) = delete;
+
+    ~SoftwareOcclusion();
+
+    // Remove the objects hidden behind the largest ones from visible, which
+    // holds the indices of the objects in the frustum. time is the animation
+    // time, which turns the gears.
+    void cull(
+        const std::vector<ThreeDimensionalObject>& objects,
+        std::vector<GLuint>& visible,
+        const glm::mat4& projView,
+        float time
+    );
+
+    const SoftwareOcclusionStats& lastFrame() const { return stats; }
+    int threadCount() const { return bands; }
+    static const char* instructionSet();
+};
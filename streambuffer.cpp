@@ -0,0 +1,136 @@
+#include "streambuffer.h"
+
+#include "glad.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+StreamBuffer::StreamBuffer(GLsizeiptr regionSize) :
+    buffer(0), mapped(nullptr), regionSize(regionSize), region(0),
+    used(0), flushed(0), stalls(0), stallTime(0)
+{
+    persistent = GLAD_GL_ARB_buffer_storage;
+    for (int i = 0; i < STREAM_FRAMES; i++) {
+        fences[i] = nullptr;
+    }
+    create();
+}
+
+StreamBuffer::~StreamBuffer()
+{
+    waitAll();
+    destroy();
+}
+
+void StreamBuffer::create()
+{
+    GLsizeiptr size = regionSize * STREAM_FRAMES;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    if (persistent) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, flags);
+        mapped = (char*) glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags);
+    } else {
+        glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        staging.resize(regionSize);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void StreamBuffer::destroy()
+{
+    if (mapped) {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        mapped = nullptr;
+    }
+    if (buffer) glDeleteBuffers(1, &buffer);
+    buffer = 0;
+}
+
+void StreamBuffer::waitAll()
+{
+    for (int i = 0; i < STREAM_FRAMES; i++) {
+        if (fences[i]) {
+            glClientWaitSync(fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            glDeleteSync(fences[i]);
+            fences[i] = nullptr;
+        }
+    }
+}
+
+void StreamBuffer::reserve(GLsizeiptr bytes)
+{
+    if (bytes <= regionSize) return;
+    waitAll();
+    destroy();
+    regionSize = std::max(bytes, regionSize * 2);
+    region = 0;
+    used = flushed = 0;
+    create();
+}
+
+void StreamBuffer::beginFrame()
+{
+    region = (region + 1) % STREAM_FRAMES;
+    used = flushed = 0;
+    GLsync fence = fences[region];
+    if (!fence) return;
+    fences[region] = nullptr;
+
+    GLenum status = glClientWaitSync(fence, 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED) {
+        // The GPU is still reading this region; wait for it
+        auto start = std::chrono::steady_clock::now();
+        do {
+            status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        } while (status == GL_TIMEOUT_EXPIRED);
+        stalls++;
+        stallTime += std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+    }
+    glDeleteSync(fence);
+}
+
+void StreamBuffer::endFrame()
+{
+    flush();
+    fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void* StreamBuffer::allocate(GLsizeiptr bytes, GLsizeiptr alignment, GLintptr& offset)
+{
+    // Regions may be any size, so align the offset in the whole buffer, not
+    // just in the region
+    GLintptr base = region * regionSize;
+    GLsizeiptr start = (base + used + alignment - 1) / alignment * alignment - base;
+    if (start + bytes > regionSize) {
+        fprintf(stderr, "Stream buffer region of %ld bytes is full!\n", (long) regionSize);
+        return nullptr;
+    }
+    used = start + bytes;
+    offset = base + start;
+    return persistent ? mapped + offset : &staging[start];
+}
+
+void StreamBuffer::flush()
+{
+    // Persistent mappings are coherent, so there is nothing to do
+    if (persistent || used == flushed) return;
+    // The fence on this region guarantees that the GPU isn't using it, so
+    // the mapping doesn't have to be synchronized.
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    void* destination = glMapBufferRange(
+        GL_COPY_WRITE_BUFFER,
+        region * regionSize + flushed,
+        used - flushed,
+        GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT
+    );
+    memcpy(destination, &staging[flushed], used - flushed);
+    glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    flushed = used;
+}
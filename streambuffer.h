@@ -0,0 +1,74 @@
+#pragma once
+
+#include "glad.h"
+#include <vector>
+
+// Number of frames whose streamed data can be in use at once
+#define STREAM_FRAMES 3
+
+// Ring allocator for data written by the CPU every frame, such as uniform
+// blocks and draw commands. The buffer is split into one region per frame in
+// flight, and a fence placed at the end of each frame guards its region, so
+// writing never has to wait for the GPU unless it falls STREAM_FRAMES frames
+// behind.
+//
+// With ARB_buffer_storage, the buffer is mapped persistently and allocations
+// point straight into it. Otherwise, allocations are staged in memory, and
+// flush() copies them into the buffer through an unsynchronized mapping.
+class StreamBuffer {
+    private:
+    GLuint buffer;
+    // Persistent mapping of the whole buffer, or nullptr
+    char* mapped;
+    // Staging memory for one region, without ARB_buffer_storage
+    std::vector<char> staging;
+    GLsizeiptr regionSize;
+    int region;
+    // Allocated, and flushed, bytes in the current region
+    GLsizeiptr used;
+    GLsizeiptr flushed;
+    GLsync fences[STREAM_FRAMES];
+    bool persistent;
+    // Number of times, and total milliseconds, the CPU had to wait for a
+    // region to be released by the GPU
+    unsigned int stalls;
+    double stallTime;
+
+    void create();
+    void destroy();
+    // Wait for every region to be released by the GPU
+    void waitAll();
+
+    public:
+    StreamBuffer(GLsizeiptr regionSize);
+
+    // Prevent copying! See: https://www.khronos.org/opengl/wiki/Common_Mistakes#RAII_and_hidden_destructor_calls
+    StreamBuffer(StreamBuffer& other) = delete;
+    StreamBuffer& operator= (StreamBuffer& other) = delete;
+
+    ~StreamBuffer();
+
+    // Make each region hold at least the given number of bytes. May have to
+    // wait for the GPU, so call it while setting up, not every frame. Each
+    // region at least doubles, so that growing it a little at a time, as
+    // objects are added, only rarely waits.
+    void reserve(GLsizeiptr bytes);
+
+    // Move on to the next region, waiting until the GPU is done with it
+    void beginFrame();
+    // Fence the current region
+    void endFrame();
+
+    // Allocate bytes in the current region. Returns where to write the data,
+    // and sets offset to where it will be in the buffer. Returns nullptr if
+    // the region is full.
+    void* allocate(GLsizeiptr bytes, GLsizeiptr alignment, GLintptr& offset);
+    // Make everything allocated so far visible to the GPU. Call before any
+    // draw call which reads it.
+    void flush();
+
+    GLuint getBuffer() const { return buffer; }
+    bool isPersistent() const { return persistent; }
+    unsigned int stallCount() const { return stalls; }
+    double stallMilliseconds() const { return stallTime; }
+};
@@ -0,0 +1,777 @@
+#include "triangulate.h"
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <limits>
+#include <vector>
+
+// The polygon is kept as a circular doubly linked list of vertices. Vertices
+// are additionally sorted by their position on a Z-order curve, so that only
+// vertices near a candidate ear have to be checked to see whether they lie
+// inside of it.
+struct PolyNode {
+    // Index of the vertex in the input
+    unsigned int i;
+    double x;
+    double y;
+    // Previous and next vertex in the polygon
+    PolyNode* prev;
+    PolyNode* next;
+    // Z-order curve value, and position in TriangulateState::sorted
+    unsigned int z;
+    unsigned int zIndex;
+    // Indicates whether this is a lone point in a "hole" of its own
+    bool steiner;
+    // Ear clipping work list state
+    bool queued;
+    bool skip;
+    bool removed;
+};
+
+struct ZEntry {
+    unsigned int z;
+    PolyNode* node;
+};
+
+struct TriangulateState {
+    // Nodes are allocated from blocks which are never resized once reserved,
+    // so pointers to nodes stay valid.
+    std::vector<std::vector<PolyNode>> nodeBlocks;
+    std::vector<unsigned int> triangles;
+    // Nodes sorted in Z-order, and how many of them have been clipped since
+    std::vector<ZEntry> sorted;
+    std::size_t sortedRemoved;
+    // Used to calculate the Z-order curve values
+    double minX;
+    double minY;
+    double invSize;
+};
+
+// Below this many points, checking every vertex is faster than hashing.
+#define HASH_THRESHOLD 80
+// Points in a row outside of an ear's bounding box before skipping ahead
+#define SKIP_AFTER 16
+// Size of the node blocks allocated after the first one
+#define NODE_BLOCK_SIZE 1024
+
+static PolyNode* newNode(TriangulateState& st, unsigned int i, double x, double y)
+{
+    if (st.nodeBlocks.empty() || st.nodeBlocks.back().size() == st.nodeBlocks.back().capacity()) {
+        st.nodeBlocks.emplace_back();
+        st.nodeBlocks.back().reserve(NODE_BLOCK_SIZE);
+    }
+    std::vector<PolyNode>& block = st.nodeBlocks.back();
+    block.push_back(PolyNode {i, x, y, nullptr, nullptr, 0, 0, false, false, false, false});
+    return &block.back();
+}
+
+static PolyNode* insertNode(TriangulateState& st, unsigned int i, double x, double y, PolyNode* last)
+{
+    PolyNode* p = newNode(st, i, x, y);
+    if (!last) {
+        p->prev = p;
+        p->next = p;
+    } else {
+        p->next = last->next;
+        p->prev = last;
+        last->next->prev = p;
+        last->next = p;
+    }
+    return p;
+}
+
+static void removeNode(PolyNode* p)
+{
+    p->removed = true;
+    p->next->prev = p->prev;
+    p->prev->next = p->next;
+}
+
+// Twice the signed area of a triangle. Negative for convex corners, given
+// the orientation the rings are linked in.
+static double area(const PolyNode* p, const PolyNode* q, const PolyNode* r)
+{
+    return (q->y - p->y) * (r->x - q->x) - (q->x - p->x) * (r->y - q->y);
+}
+
+static bool equals(const PolyNode* a, const PolyNode* b)
+{
+    return a->x == b->x && a->y == b->y;
+}
+
+static int sign(double v)
+{
+    return (v > 0) - (v < 0);
+}
+
+static bool pointInTriangle(
+    double ax, double ay, double bx, double by, double cx, double cy,
+    double px, double py)
+{
+    return
+        (cx - px) * (ay - py) >= (ax - px) * (cy - py) &&
+        (ax - px) * (by - py) >= (bx - px) * (ay - py) &&
+        (bx - px) * (cy - py) >= (cx - px) * (by - py);
+}
+
+// For collinear points p, q, r, check if q lies on segment pr
+static bool onSegment(const PolyNode* p, const PolyNode* q, const PolyNode* r)
+{
+    return
+        q->x <= std::max(p->x, r->x) && q->x >= std::min(p->x, r->x) &&
+        q->y <= std::max(p->y, r->y) && q->y >= std::min(p->y, r->y);
+}
+
+static bool intersects(const PolyNode* p1, const PolyNode* q1, const PolyNode* p2, const PolyNode* q2)
+{
+    int o1 = sign(area(p1, q1, p2));
+    int o2 = sign(area(p1, q1, q2));
+    int o3 = sign(area(p2, q2, p1));
+    int o4 = sign(area(p2, q2, q1));
+
+    if (o1 != o2 && o3 != o4) return true;
+    if (o1 == 0 && onSegment(p1, p2, q1)) return true;
+    if (o2 == 0 && onSegment(p1, q2, q1)) return true;
+    if (o3 == 0 && onSegment(p2, p1, q2)) return true;
+    if (o4 == 0 && onSegment(p2, q1, q2)) return true;
+    return false;
+}
+
+// Check if a polygon diagonal intersects any polygon segments
+static bool intersectsPolygon(const PolyNode* a, const PolyNode* b)
+{
+    const PolyNode* p = a;
+    do {
+        if (p->i != a->i && p->next->i != a->i && p->i != b->i && p->next->i != b->i &&
+            intersects(p, p->next, a, b)) return true;
+        p = p->next;
+    } while (p != a);
+    return false;
+}
+
+// Check if a polygon diagonal is locally inside the polygon
+static bool locallyInside(const PolyNode* a, const PolyNode* b)
+{
+    return area(a->prev, a, a->next) < 0 ?
+        area(a, b, a->next) >= 0 && area(a, a->prev, b) >= 0 :
+        area(a, b, a->prev) < 0 || area(a, a->next, b) < 0;
+}
+
+// Check if the middle point of a polygon diagonal is inside the polygon
+static bool middleInside(const PolyNode* a, const PolyNode* b)
+{
+    const PolyNode* p = a;
+    bool inside = false;
+    double px = (a->x + b->x) / 2;
+    double py = (a->y + b->y) / 2;
+    do {
+        if (((p->y > py) != (p->next->y > py)) && p->next->y != p->y &&
+            (px < (p->next->x - p->x) * (py - p->y) / (p->next->y - p->y) + p->x))
+            inside = !inside;
+        p = p->next;
+    } while (p != a);
+    return inside;
+}
+
+// Check if a diagonal between two polygon nodes is valid (lies in the
+// polygon interior)
+static bool isValidDiagonal(const PolyNode* a, const PolyNode* b)
+{
+    return a->next->i != b->i && a->prev->i != b->i && !intersectsPolygon(a, b) &&
+        ((locallyInside(a, b) && locallyInside(b, a) && middleInside(a, b) &&
+            (area(a->prev, a, b->prev) != 0 || area(a, b->prev, b) != 0)) ||
+        (equals(a, b) && area(a->prev, a, a->next) > 0 && area(b->prev, b, b->next) > 0));
+}
+
+// Link two polygon vertices with a bridge. If the vertices belong to the same
+// ring, the polygon is split in two; if they belong to different rings, the
+// rings are merged into one.
+static PolyNode* splitPolygon(TriangulateState& st, PolyNode* a, PolyNode* b)
+{
+    PolyNode* a2 = newNode(st, a->i, a->x, a->y);
+    PolyNode* b2 = newNode(st, b->i, b->x, b->y);
+    PolyNode* an = a->next;
+    PolyNode* bp = b->prev;
+
+    a->next = b;
+    b->prev = a;
+
+    a2->next = an;
+    an->prev = a2;
+
+    b2->next = a2;
+    a2->prev = b2;
+
+    bp->next = b2;
+    b2->prev = bp;
+
+    return b2;
+}
+
+// Create a circular linked list from a ring of points, in the given winding
+static PolyNode* linkedList(
+    TriangulateState& st, const std::vector<vec2_t>& points,
+    unsigned int start, unsigned int end, bool clockwise)
+{
+    double sum = 0;
+    for (unsigned int i = start, j = end - 1; i < end; j = i++) {
+        sum += ((double) points[j].x - points[i].x) * ((double) points[i].y + points[j].y);
+    }
+
+    PolyNode* last = nullptr;
+    if (clockwise == (sum > 0)) {
+        for (unsigned int i = start; i < end; i++)
+            last = insertNode(st, i, points[i].x, points[i].y, last);
+    } else {
+        for (unsigned int i = end; i-- > start;)
+            last = insertNode(st, i, points[i].x, points[i].y, last);
+    }
+
+    if (last && equals(last, last->next)) {
+        removeNode(last);
+        last = last->next;
+    }
+    return last;
+}
+
+// Eliminate colinear or duplicate points
+static PolyNode* filterPoints(PolyNode* start, PolyNode* end = nullptr)
+{
+    if (!start) return start;
+    if (!end) end = start;
+
+    PolyNode* p = start;
+    bool again;
+    do {
+        again = false;
+        if (!p->steiner && (equals(p, p->next) || area(p->prev, p, p->next) == 0)) {
+            removeNode(p);
+            p = end = p->prev;
+            if (p == p->next) break;
+            again = true;
+        } else {
+            p = p->next;
+        }
+    } while (again || p != end);
+
+    return end;
+}
+
+// Z-order of a point given coords and inverse of the longer side of the data
+// bounding box
+static unsigned int zOrder(const TriangulateState& st, double px, double py)
+{
+    unsigned int x = (unsigned int) ((px - st.minX) * st.invSize);
+    unsigned int y = (unsigned int) ((py - st.minY) * st.invSize);
+
+    x = (x | (x << 8)) & 0x00FF00FF;
+    x = (x | (x << 4)) & 0x0F0F0F0F;
+    x = (x | (x << 2)) & 0x33333333;
+    x = (x | (x << 1)) & 0x55555555;
+
+    y = (y | (y << 8)) & 0x00FF00FF;
+    y = (y | (y << 4)) & 0x0F0F0F0F;
+    y = (y | (y << 2)) & 0x33333333;
+    y = (y | (y << 1)) & 0x55555555;
+
+    return x | (y << 1);
+}
+
+// Sort the polygon's nodes in Z-order
+static void indexCurve(TriangulateState& st, PolyNode* start)
+{
+    std::vector<ZEntry>& order = st.sorted;
+    order.clear();
+    PolyNode* p = start;
+    do {
+        if (p->z == 0) p->z = zOrder(st, p->x, p->y);
+        order.push_back(ZEntry {p->z, p});
+        p = p->next;
+    } while (p != start);
+
+    std::sort(order.begin(), order.end(), [](const ZEntry& a, const ZEntry& b) {
+        return a.z < b.z;
+    });
+    for (std::size_t i = 0; i < order.size(); i++) order[i].node->zIndex = i;
+    st.sortedRemoved = 0;
+}
+
+// Drop clipped nodes from the Z-order index once they make up half of it
+static void compactCurve(TriangulateState& st)
+{
+    if (st.sortedRemoved * 2 < st.sorted.size()) return;
+    st.sorted.erase(
+        std::remove_if(st.sorted.begin(), st.sorted.end(), [](const ZEntry& e) {
+            return e.node->removed;
+        }),
+        st.sorted.end());
+    for (std::size_t i = 0; i < st.sorted.size(); i++) st.sorted[i].node->zIndex = i;
+    st.sortedRemoved = 0;
+}
+
+static bool compareZ(const ZEntry& e, unsigned int z)
+{
+    return e.z < z;
+}
+
+// Index of the first entry at or after from with a Z value of at least z.
+// Searches exponentially outwards from the start, since the entry is usually
+// close by.
+static std::size_t seekForward(const std::vector<ZEntry>& order, std::size_t from, unsigned int z)
+{
+    std::size_t lo = from, hi = from, step = 1;
+    while (hi < order.size() && order[hi].z < z) {
+        lo = hi + 1;
+        hi += step;
+        step *= 2;
+    }
+    hi = std::min(hi, order.size());
+    return std::lower_bound(order.begin() + lo, order.begin() + hi, z, compareZ) - order.begin();
+}
+
+// Same as seekForward, but searching backwards from an entry whose Z value
+// is at least z.
+static std::size_t seekBackward(const std::vector<ZEntry>& order, std::size_t from, unsigned int z)
+{
+    std::size_t lo = from, hi = from, step = 1;
+    while (lo > 0 && order[lo - 1].z >= z) {
+        hi = lo - 1;
+        lo = hi >= step ? hi - step : 0;
+        step *= 2;
+    }
+    return std::lower_bound(order.begin() + lo, order.begin() + hi, z, compareZ) - order.begin();
+}
+
+// Undo the bit interleaving of zOrder for one axis
+static unsigned int deinterleave(unsigned int v)
+{
+    v &= 0x55555555;
+    v = (v | (v >> 1)) & 0x33333333;
+    v = (v | (v >> 2)) & 0x0F0F0F0F;
+    v = (v | (v >> 4)) & 0x00FF00FF;
+    v = (v | (v >> 8)) & 0x0000FFFF;
+    return v;
+}
+
+// Smallest Z value greater than z which lies inside the box spanned by minZ
+// and maxZ (Tropf and Herzog's BIGMIN). z must lie outside of the box.
+static unsigned int bigMin(unsigned int z, unsigned int minZ, unsigned int maxZ)
+{
+    unsigned int result = maxZ;
+    for (int bit = 31; bit >= 0; bit--) {
+        unsigned int mask = 1u << bit;
+        // Bits of the same axis as this bit, from this bit downwards
+        unsigned int axis = (bit & 1 ? 0xAAAAAAAAu : 0x55555555u) & (mask | (mask - 1));
+        unsigned int below = axis & ~mask;
+        bool zb = z & mask, minb = minZ & mask, maxb = maxZ & mask;
+        if (!zb && !minb && maxb) {
+            // The answer lies either in the upper half of the box, or in the
+            // lower half if there is anything above z in there
+            result = (minZ & ~axis) | mask;
+            maxZ = (maxZ & ~axis) | below;
+        } else if (!zb && minb && maxb) {
+            return minZ;
+        } else if (zb && !minb && !maxb) {
+            return result;
+        } else if (zb && !minb && maxb) {
+            minZ = (minZ & ~axis) | mask;
+        }
+    }
+    return result;
+}
+
+// Check whether a polygon node forms a valid ear with adjacent nodes
+static bool isEar(const PolyNode* ear)
+{
+    const PolyNode* a = ear->prev;
+    const PolyNode* b = ear;
+    const PolyNode* c = ear->next;
+
+    // Reflex, can't be an ear
+    if (area(a, b, c) >= 0) return false;
+
+    // Make sure no other point of the polygon is inside the ear
+    const PolyNode* p = ear->next->next;
+    while (p != ear->prev) {
+        if (pointInTriangle(a->x, a->y, b->x, b->y, c->x, c->y, p->x, p->y) &&
+            area(p->prev, p, p->next) >= 0) return false;
+        p = p->next;
+    }
+    return true;
+}
+
+// Check whether a polygon node forms a valid ear, only looking at the nodes
+// close to it in Z-order
+static bool isEarHashed(const TriangulateState& st, const PolyNode* ear)
+{
+    const PolyNode* a = ear->prev;
+    const PolyNode* b = ear;
+    const PolyNode* c = ear->next;
+
+    // Reflex, can't be an ear
+    if (area(a, b, c) >= 0) return false;
+
+    // Triangle bounding box
+    double minTX = std::min(a->x, std::min(b->x, c->x));
+    double minTY = std::min(a->y, std::min(b->y, c->y));
+    double maxTX = std::max(a->x, std::max(b->x, c->x));
+    double maxTY = std::max(a->y, std::max(b->y, c->y));
+
+    // Z-order range for the current triangle bounding box
+    unsigned int minZ = zOrder(st, minTX, minTY);
+    unsigned int maxZ = zOrder(st, maxTX, maxTY);
+    unsigned int minQX = deinterleave(minZ), minQY = deinterleave(minZ >> 1);
+    unsigned int maxQX = deinterleave(maxZ), maxQY = deinterleave(maxZ >> 1);
+
+    // The ear itself lies inside the range, so search outwards from there
+    const std::vector<ZEntry>& order = st.sorted;
+    std::size_t i = seekBackward(order, ear->zIndex, minZ);
+
+    unsigned int outside = 0;
+    while (i < order.size() && order[i].z <= maxZ) {
+        unsigned int z = order[i].z;
+        unsigned int qx = deinterleave(z), qy = deinterleave(z >> 1);
+        if (qx < minQX || qx > maxQX || qy < minQY || qy > maxQY) {
+            // Part of the Z-order range lies outside of the bounding box.
+            // After a few points outside of it, skip ahead to where the curve
+            // enters the box again.
+            if (++outside < SKIP_AFTER) {
+                i++;
+            } else {
+                outside = 0;
+                i = seekForward(order, i + 1, bigMin(z, minZ, maxZ));
+            }
+            continue;
+        }
+        outside = 0;
+        const PolyNode* p = order[i].node;
+        if (!p->removed && p != a && p != b && p != c &&
+            p->x >= minTX && p->x <= maxTX && p->y >= minTY && p->y <= maxTY &&
+            pointInTriangle(a->x, a->y, b->x, b->y, c->x, c->y, p->x, p->y) &&
+            area(p->prev, p, p->next) >= 0) return false;
+        i++;
+    }
+
+    return true;
+}
+
+static void addTriangle(TriangulateState& st, const PolyNode* a, const PolyNode* b, const PolyNode* c)
+{
+    st.triangles.push_back(a->i);
+    st.triangles.push_back(b->i);
+    st.triangles.push_back(c->i);
+}
+
+// Go through all polygon nodes and cure small local self-intersections
+static PolyNode* cureLocalIntersections(TriangulateState& st, PolyNode* start)
+{
+    PolyNode* p = start;
+    do {
+        PolyNode* a = p->prev;
+        PolyNode* b = p->next->next;
+
+        if (!equals(a, b) && intersects(a, p, p->next, b) &&
+            locallyInside(a, b) && locallyInside(b, a)) {
+            addTriangle(st, a, p, b);
+
+            // Remove two nodes involved
+            removeNode(p);
+            removeNode(p->next);
+
+            p = start = b;
+        }
+        p = p->next;
+    } while (p != start);
+
+    return filterPoints(p);
+}
+
+static void earcutLinked(TriangulateState& st, PolyNode* ear, int pass);
+
+// Try splitting the polygon into two and triangulate them independently
+static void splitEarcut(TriangulateState& st, PolyNode* start)
+{
+    // Look for a valid diagonal that divides the polygon into two
+    PolyNode* a = start;
+    do {
+        PolyNode* b = a->next->next;
+        while (b != a->prev) {
+            if (a->i != b->i && isValidDiagonal(a, b)) {
+                // Split the polygon in two by the diagonal
+                PolyNode* c = splitPolygon(st, a, b);
+
+                // Filter colinear points around the cuts
+                a = filterPoints(a, a->next);
+                c = filterPoints(c, c->next);
+
+                // Run earcut on each half
+                earcutLinked(st, a, 0);
+                earcutLinked(st, c, 0);
+                return;
+            }
+            b = b->next;
+        }
+        a = a->next;
+    } while (a != start);
+}
+
+// Main ear slicing loop which triangulates a polygon (given as a linked list)
+//
+// Rather than walking around the whole polygon looking for ears, vertices to
+// test are kept in a work list. A vertex only needs to be tested again once
+// one of its neighbours has been clipped, so long runs of reflex vertices
+// (such as the inside of a hole) aren't visited over and over again.
+static void earcutLinked(TriangulateState& st, PolyNode* ear, int pass)
+{
+    if (!ear) return;
+
+    // Interlink polygon nodes in Z-order
+    if (!pass && st.invSize) indexCurve(st, ear);
+
+    std::deque<PolyNode*> queue;
+    auto enqueue = [&queue](PolyNode* p) {
+        if (p->queued) return;
+        p->queued = true;
+        queue.push_back(p);
+    };
+    auto enqueueAll = [&](PolyNode* start) {
+        PolyNode* p = start;
+        do {
+            p->skip = false;
+            enqueue(p);
+            p = p->next;
+        } while (p != start);
+    };
+
+    enqueueAll(ear);
+    // Whether any ears were cut since the work list was last filled
+    bool clipped = false;
+
+    while (ear->prev != ear->next) {
+        if (queue.empty()) {
+            // A vertex can also become an ear when a vertex inside of its
+            // triangle is clipped, so go around once more before giving up.
+            if (clipped) {
+                clipped = false;
+                enqueueAll(ear);
+                continue;
+            }
+            // No more ears could be found in the remaining polygon
+            if (!pass) {
+                // Try filtering points and slicing again
+                earcutLinked(st, filterPoints(ear), 1);
+            } else if (pass == 1) {
+                // If this didn't work, try curing all small self-intersections
+                // locally
+                ear = cureLocalIntersections(st, filterPoints(ear));
+                earcutLinked(st, ear, 2);
+            } else if (pass == 2) {
+                // As a last resort, try splitting the remaining polygon into
+                // two
+                splitEarcut(st, ear);
+            }
+            break;
+        }
+
+        PolyNode* p = queue.front();
+        queue.pop_front();
+        p->queued = false;
+        if (p->removed) continue;
+        if (p->skip) {
+            p->skip = false;
+            enqueue(p);
+            continue;
+        }
+        ear = p;
+
+        PolyNode* prev = ear->prev;
+        PolyNode* next = ear->next;
+
+        if (st.invSize ? isEarHashed(st, ear) : isEar(ear)) {
+            // Cut off the triangle
+            addTriangle(st, prev, ear, next);
+
+            removeNode(ear);
+            clipped = true;
+            ear = next;
+            if (st.invSize) {
+                st.sortedRemoved++;
+                compactCurve(st);
+            }
+
+            // Both neighbours have a new corner now
+            enqueue(prev);
+            // Skipping the next vertex leads to less sliver triangles
+            next->skip = true;
+            enqueue(next);
+        }
+    }
+}
+
+// Find the leftmost node of a polygon ring
+static PolyNode* getLeftmost(PolyNode* start)
+{
+    PolyNode* p = start;
+    PolyNode* leftmost = start;
+    do {
+        if (p->x < leftmost->x || (p->x == leftmost->x && p->y < leftmost->y))
+            leftmost = p;
+        p = p->next;
+    } while (p != start);
+    return leftmost;
+}
+
+// Whether sector in vertex m contains sector in vertex p in the same
+// coordinates
+static bool sectorContainsSector(const PolyNode* m, const PolyNode* p)
+{
+    return area(m->prev, m, p->prev) < 0 && area(p->next, m, m->next) < 0;
+}
+
+// David Eberly's algorithm for finding a bridge between a hole and the outer
+// polygon
+static PolyNode* findHoleBridge(PolyNode* hole, PolyNode* outerNode)
+{
+    PolyNode* p = outerNode;
+    double hx = hole->x;
+    double hy = hole->y;
+    double qx = -std::numeric_limits<double>::infinity();
+    PolyNode* m = nullptr;
+
+    // Find a segment intersected by a ray from the hole's leftmost point to
+    // the left; the segment's endpoint with lesser x will be the potential
+    // connection point
+    do {
+        if (hy <= p->y && hy >= p->next->y && p->next->y != p->y) {
+            double x = p->x + (hy - p->y) * (p->next->x - p->x) / (p->next->y - p->y);
+            if (x <= hx && x > qx) {
+                qx = x;
+                m = p->x < p->next->x ? p : p->next;
+                // Hole touches outer segment; pick leftmost endpoint
+                if (x == hx) return m;
+            }
+        }
+        p = p->next;
+    } while (p != outerNode);
+
+    if (!m) return nullptr;
+
+    // Look for points inside the triangle of hole point, segment
+    // intersection and endpoint. If there are no points found, we have a
+    // valid connection; otherwise choose the point of the minimum angle with
+    // the ray as connection point
+    const PolyNode* stop = m;
+    double mx = m->x;
+    double my = m->y;
+    double tanMin = std::numeric_limits<double>::infinity();
+
+    p = m;
+    do {
+        if (hx >= p->x && p->x >= mx && hx != p->x &&
+            pointInTriangle(hy < my ? hx : qx, hy, mx, my, hy < my ? qx : hx, hy, p->x, p->y)) {
+
+            double tan = std::fabs(hy - p->y) / (hx - p->x);
+
+            if (locallyInside(p, hole) &&
+                (tan < tanMin || (tan == tanMin &&
+                    (p->x > m->x || (p->x == m->x && sectorContainsSector(m, p)))))) {
+                m = p;
+                tanMin = tan;
+            }
+        }
+        p = p->next;
+    } while (p != stop);
+
+    return m;
+}
+
+// Find a bridge between vertices that connects the hole with the outer ring
+// and link it
+static PolyNode* eliminateHole(TriangulateState& st, PolyNode* hole, PolyNode* outerNode)
+{
+    PolyNode* bridge = findHoleBridge(hole, outerNode);
+    if (!bridge) return outerNode;
+
+    PolyNode* bridgeReverse = splitPolygon(st, bridge, hole);
+
+    // Filter colinear points around the cuts
+    filterPoints(bridgeReverse, bridgeReverse->next);
+    return filterPoints(bridge, bridge->next);
+}
+
+// Link every hole into the outer loop, producing a single-ring polygon
+// without holes
+static PolyNode* eliminateHoles(
+    TriangulateState& st, const std::vector<vec2_t>& points,
+    const std::vector<unsigned int>& holeStarts, PolyNode* outerNode)
+{
+    std::vector<PolyNode*> queue;
+
+    for (std::size_t i = 0; i < holeStarts.size(); i++) {
+        unsigned int start = holeStarts[i];
+        unsigned int end = i < holeStarts.size() - 1 ? holeStarts[i + 1] : points.size();
+        PolyNode* list = linkedList(st, points, start, end, false);
+        if (!list) continue;
+        if (list == list->next) list->steiner = true;
+        queue.push_back(getLeftmost(list));
+    }
+
+    std::sort(queue.begin(), queue.end(), [](const PolyNode* a, const PolyNode* b) {
+        return a->x < b->x;
+    });
+
+    // Process holes from left to right
+    for (PolyNode* hole : queue) {
+        outerNode = eliminateHole(st, hole, outerNode);
+    }
+
+    return outerNode;
+}
+
+std::vector<unsigned int> triangulate(
+    const std::vector<vec2_t>& points,
+    const std::vector<unsigned int>& holeStarts)
+{
+    TriangulateState st;
+    st.minX = st.minY = st.invSize = 0;
+    st.sortedRemoved = 0;
+    // Every point gets a node, plus two for each hole bridge
+    st.nodeBlocks.emplace_back();
+    st.nodeBlocks.back().reserve(points.size() + 2 * holeStarts.size());
+
+    unsigned int outerLen = holeStarts.empty() ? points.size() : holeStarts[0];
+    PolyNode* outerNode = linkedList(st, points, 0, outerLen, true);
+
+    if (!outerNode || outerNode->next == outerNode->prev) return st.triangles;
+
+    st.triangles.reserve((points.size() + 2 * holeStarts.size()) * 3);
+
+    if (!holeStarts.empty()) outerNode = eliminateHoles(st, points, holeStarts, outerNode);
+
+    // If the shape is not too simple, we'll use Z-order curve hash later;
+    // calculate polygon bbox
+    if (points.size() > HASH_THRESHOLD) {
+        double maxX, maxY;
+        st.minX = maxX = points[0].x;
+        st.minY = maxY = points[0].y;
+
+        for (unsigned int i = 1; i < outerLen; i++) {
+            double x = points[i].x;
+            double y = points[i].y;
+            if (x < st.minX) st.minX = x;
+            if (y < st.minY) st.minY = y;
+            if (x > maxX) maxX = x;
+            if (y > maxY) maxY = y;
+        }
+
+        // minX, minY and invSize are later used to transform coords into
+        // integers for Z-order calculation
+        st.invSize = std::max(maxX - st.minX, maxY - st.minY);
+        st.invSize = st.invSize != 0 ? 32767 / st.invSize : 0;
+    }
+
+    earcutLinked(st, outerNode, 0);
+
+    return st.triangles;
+}
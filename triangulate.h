@@ -0,0 +1,22 @@
+#pragma once
+#include "vector.h"
+#include <vector>
+
+/**
+    Triangulate a simple polygon with holes, using ear clipping. Ears are
+    looked up through a Z-order curve hash once the polygon has more than a
+    handful of points, so large outlines (100k+ points) still triangulate in
+    milliseconds.
+
+    Input:  points - all the points of the polygon; the outer ring first,
+                     followed by each of the holes
+            holeStarts - index into points of the first point of each hole
+                         (empty if there are no holes)
+
+    Returns indices into points, three per triangle. Winding of the output
+    triangles is unspecified.
+ **/
+std::vector<unsigned int> triangulate(
+    const std::vector<vec2_t>& points,
+    const std::vector<unsigned int>& holeStarts
+);
@@ -0,0 +1,67 @@
+#include "uniforms.h"
+
+#include "glad.h"
+#include "instances.h"
+#include <cstring>
+
+// Round size up to a multiple of alignment
+static GLint alignUp(GLint size, GLint alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+UniformBuffers::UniformBuffers(StreamBuffer& stream) :
+    stream(stream)
+{
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    objectStride = alignUp(sizeof(InstanceData), alignment);
+}
+
+void UniformBuffers::bindBlocks(GLuint program)
+{
+    const struct {
+        const char* name;
+        UniformBinding binding;
+    } blocks[] = {
+        {"Frame", FRAME_BINDING},
+        {"Object", OBJECT_BINDING},
+        {"Lights", LIGHTS_BINDING},
+    };
+    for (const auto& block : blocks) {
+        // Not every variant of the shaders uses every block
+        GLuint index = glGetUniformBlockIndex(program, block.name);
+        if (index != GL_INVALID_INDEX) {
+            glUniformBlockBinding(program, index, block.binding);
+        }
+    }
+}
+
+void UniformBuffers::update(const FrameUniforms& frame)
+{
+    GLintptr frameOffset;
+    void* frameData = stream.allocate(sizeof(frame), alignment, frameOffset);
+    if (!frameData) return;
+    memcpy(frameData, &frame, sizeof(frame));
+    stream.flush();
+
+    glBindBufferRange(
+        GL_UNIFORM_BUFFER, FRAME_BINDING, stream.getBuffer(),
+        frameOffset, sizeof(FrameUniforms)
+    );
+}
+
+GLsizeiptr UniformBuffers::streamBytes() const
+{
+    // Allow for padding in front of the block
+    return sizeof(FrameUniforms) + alignment;
+}
+
+void UniformBuffers::uploadObjects(const std::vector<ThreeDimensionalObject>& objects, std::size_t first)
+{
+    std::vector<char> data((objects.size() - first) * objectStride);
+    for (std::size_t i = first; i < objects.size(); i++) {
+        InstanceData block = InstanceData::fromObject(objects[i]);
+        memcpy(&data[(i - first) * objectStride], &block, sizeof(block));
+    }
+    objectBuffer.write(first * objectStride, data.size(), data.data());
+}
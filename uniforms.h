@@ -0,0 +1,67 @@
+#pragma once
+
+#include "glad.h"
+#include "3dobject.h"
+#include "instances.h"
+#include "streambuffer.h"
+#include <vector>
+
+// Binding points of the uniform blocks. They are the same in every shader
+// program, so one set of buffers serves all of them.
+enum UniformBinding {
+    FRAME_BINDING = 0,
+    OBJECT_BINDING = 1,
+    // The Lights block of clustered lighting; see lights.h
+    LIGHTS_BINDING = 2
+};
+
+// std140 layout of the Frame block in default.vert
+struct FrameUniforms {
+    GLfloat projView[16];
+    GLfloat lightPos[3];
+    GLfloat zoom;
+    GLfloat time;
+    GLfloat padding[3];
+};
+
+// The Object block in default.vert has the same layout as InstanceData.
+
+// Uniform buffers for the frame and object blocks. The frame block is
+// written into the stream buffer every frame. The object
+// buffer holds every object's block, each at an offset the object can be
+// bound at.
+class UniformBuffers {
+    private:
+    StreamBuffer& stream;
+    GrowableBuffer objectBuffer;
+    // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+    GLint alignment;
+    // Distance between objects' blocks in objectBuffer
+    GLint objectStride;
+
+    public:
+    UniformBuffers(StreamBuffer& stream);
+
+    // Prevent copying! See: https://www.khronos.org/opengl/wiki/Common_Mistakes#RAII_and_hidden_destructor_calls
+    UniformBuffers(UniformBuffers& other) = delete;
+    UniformBuffers& operator= (UniformBuffers& other) = delete;
+
+    // Point the uniform blocks of a linked program at their binding points
+    static void bindBlocks(GLuint program);
+
+    // Write the frame block, and bind it
+    void update(const FrameUniforms& frame);
+    // Space needed in the stream buffer per frame
+    GLsizeiptr streamBytes() const;
+    // Upload the blocks of the objects from first on. Only needs to be called
+    // again when objects are added, removed or modified; when they are only
+    // added, first can skip the ones uploaded before.
+    void uploadObjects(const std::vector<ThreeDimensionalObject>& objects, std::size_t first = 0);
+    // Bind the block of the object with the given index
+    void bindObject(std::size_t index) const {
+        glBindBufferRange(
+            GL_UNIFORM_BUFFER, OBJECT_BINDING, objectBuffer.getBuffer(),
+            index * objectStride, objectStride
+        );
+    }
+};
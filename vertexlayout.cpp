@@ -0,0 +1,66 @@
+#include "vertexlayout.h"
+
+#include "glad.h"
+#include <cstring>
+
+// Source of each attribute's data
+static const GLfloat* attributeData(const GearBuffersSeparate& buffers, int attribute)
+{
+    switch (attribute) {
+    case ATTRIB_POSITION: return &buffers.pos[0].x;
+    case ATTRIB_NORMAL: return &buffers.nrm[0].x;
+    default: return &buffers.bary[0].x;
+    }
+}
+
+void packStream(const VertexLayout& layout, GLuint stream, const GearBuffersSeparate& buffers, char* out)
+{
+    std::size_t vertices = buffers.pos.size();
+    if (!vertices) return;
+    GLuint stride = layout.stride(stream);
+    for (int attribute = 0; attribute < ATTRIB_COUNT; attribute++) {
+        if (layout.attributes[attribute].stream != stream) continue;
+        const char* in = (const char*) attributeData(buffers, attribute);
+        GLuint size = layout.attributeSize(attribute);
+        if (size == stride) {
+            // The attribute has the stream to itself
+            memcpy(out, in, vertices * size);
+            return;
+        }
+        char* to = out + layout.offset(attribute);
+        for (std::size_t v = 0; v < vertices; v++) {
+            memcpy(to, in, size);
+            to += stride;
+            in += size;
+        }
+    }
+}
+
+void setupAttributes(const VertexLayout& layout, GLuint capacity, int attributes)
+{
+    for (int attribute = 0; attribute < attributes; attribute++) {
+        GLuint stream = layout.attributes[attribute].stream;
+        GLintptr offset = layout.streamStart(stream, capacity) + layout.offset(attribute);
+        glVertexAttribPointer(
+            attribute, layout.attributes[attribute].components, GL_FLOAT, GL_FALSE,
+            layout.stride(stream), (const void*) offset);
+        glEnableVertexAttribArray(attribute);
+    }
+}
+
+void setupAttributes(const VertexLayout& layout, GLuint capacity, GLuint vertexArray, GLuint buffer,
+    int attributes)
+{
+    for (GLuint stream = 0; stream < layout.streamCount(); stream++) {
+        glVertexArrayVertexBuffer(
+            vertexArray, stream, buffer,
+            layout.streamStart(stream, capacity), layout.stride(stream));
+    }
+    for (int attribute = 0; attribute < attributes; attribute++) {
+        glVertexArrayAttribFormat(
+            vertexArray, attribute, layout.attributes[attribute].components,
+            GL_FLOAT, GL_FALSE, layout.offset(attribute));
+        glVertexArrayAttribBinding(vertexArray, attribute, layout.attributes[attribute].stream);
+        glEnableVertexArrayAttrib(vertexArray, attribute);
+    }
+}
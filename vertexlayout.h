@@ -0,0 +1,97 @@
+#pragma once
+
+#include "glad.h"
+#include "gear.h"
+
+// Vertex attributes of a gear mesh. Each one's value is also its location in
+// default.vert.
+enum VertexAttribute {
+    ATTRIB_POSITION = 0,
+    ATTRIB_NORMAL = 1,
+    ATTRIB_BARYCENTRIC = 2,
+    ATTRIB_COUNT
+};
+
+// Where one attribute is stored: which stream, that is, which array of
+// vertices, and how many floats it has. Attributes sharing a stream are
+// interleaved, in the order of their locations.
+struct AttributeFormat {
+    GLuint stream;
+    GLint components;
+};
+
+// Describes how vertex data is packed into streams. The arena puts each
+// stream in its own part of one vertex buffer, so that a planar layout has
+// one stream per attribute, and an interleaved one has a single stream.
+//
+// Everything is constexpr, so that the layouts can be checked at compile
+// time.
+struct VertexLayout {
+    const char* name;
+    AttributeFormat attributes[ATTRIB_COUNT];
+
+    // Size of one attribute, in bytes
+    constexpr GLuint attributeSize(int attribute) const {
+        return attributes[attribute].components * sizeof(GLfloat);
+    }
+    // Size of one vertex within a stream, in bytes
+    constexpr GLuint stride(GLuint stream, int attribute = 0) const {
+        return attribute == ATTRIB_COUNT ? 0 :
+            (attributes[attribute].stream == stream ? attributeSize(attribute) : 0) +
+            stride(stream, attribute + 1);
+    }
+    // Offset of an attribute within a vertex of its stream, in bytes
+    constexpr GLuint offset(int attribute, int before = 0) const {
+        return before == attribute ? 0 :
+            (attributes[before].stream == attributes[attribute].stream ? attributeSize(before) : 0) +
+            offset(attribute, before + 1);
+    }
+    constexpr GLuint streamCount(int attribute = 0) const {
+        return attribute == ATTRIB_COUNT ? 0 :
+            (attributes[attribute].stream + 1 > streamCount(attribute + 1) ?
+                attributes[attribute].stream + 1 : streamCount(attribute + 1));
+    }
+    // Size of one vertex, across all streams
+    constexpr GLuint vertexSize(int attribute = 0) const {
+        return attribute == ATTRIB_COUNT ? 0 :
+            attributeSize(attribute) + vertexSize(attribute + 1);
+    }
+    // Where a stream starts in a buffer with room for capacity vertices
+    constexpr GLintptr streamStart(GLuint stream, GLuint capacity) const {
+        return stream == 0 ? 0 :
+            streamStart(stream - 1, capacity) + (GLintptr) capacity * stride(stream - 1);
+    }
+};
+
+// One stream per attribute. Passes which only need positions read nothing
+// else.
+constexpr VertexLayout PLANAR_LAYOUT = {"planar", {{0, 3}, {1, 3}, {2, 2}}};
+// Every attribute of a vertex next to each other
+constexpr VertexLayout INTERLEAVED_LAYOUT = {"interleaved", {{0, 3}, {0, 3}, {0, 2}}};
+// Positions on their own, and the attributes which are only needed for
+// shading interleaved in a second stream
+constexpr VertexLayout MIXED_LAYOUT = {"mixed", {{0, 3}, {1, 3}, {1, 2}}};
+
+static_assert(PLANAR_LAYOUT.streamCount() == 3 && PLANAR_LAYOUT.stride(1) == 12,
+    "planar layout has one tightly packed stream per attribute");
+static_assert(INTERLEAVED_LAYOUT.streamCount() == 1 && INTERLEAVED_LAYOUT.stride(0) == 32 &&
+    INTERLEAVED_LAYOUT.offset(ATTRIB_BARYCENTRIC) == 24,
+    "interleaved layout packs a whole vertex into 32 bytes");
+static_assert(MIXED_LAYOUT.streamCount() == 2 && MIXED_LAYOUT.offset(ATTRIB_BARYCENTRIC) == 12,
+    "mixed layout interleaves normals and barycentrics");
+static_assert(PLANAR_LAYOUT.vertexSize() == INTERLEAVED_LAYOUT.vertexSize() &&
+    MIXED_LAYOUT.vertexSize() == INTERLEAVED_LAYOUT.vertexSize(),
+    "no layout has padding");
+
+// Write one stream of a mesh's vertices, as described by layout, to out
+void packStream(const VertexLayout& layout, GLuint stream, const GearBuffersSeparate& buffers, char* out);
+
+// Point the attributes of the bound vertex array at the streams in the bound
+// GL_ARRAY_BUFFER, which has room for capacity vertices. Only the first
+// attributes are set up, so that a vertex array for depth-only passes can
+// read nothing but positions.
+void setupAttributes(const VertexLayout& layout, GLuint capacity, int attributes = ATTRIB_COUNT);
+// The same, for the given vertex array and buffer, with direct state access.
+// Each stream gets the buffer binding index with the same number.
+void setupAttributes(const VertexLayout& layout, GLuint capacity, GLuint vertexArray, GLuint buffer,
+    int attributes = ATTRIB_COUNT);
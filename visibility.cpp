@@ -0,0 +1,161 @@
+#include "visibility.h"
+
+#include "glad.h"
+#include <cstdio>
+
+// Texture units of the resolve pass. Unit 0 is left to the instance data,
+// and 1 to 3 to clustered lighting.
+#define ID_UNIT 4
+#define DEPTH_UNIT 5
+#define VERTEX_UNIT 6
+#define INDEX_UNIT 7
+#define MESH_UNIT 8
+
+VisibilityBuffer::VisibilityBuffer() :
+    width(0), height(0), target(0)
+{
+    GLuint textures[5];
+    glGenTextures(5, textures);
+    idTexture = textures[0];
+    depthTexture = textures[1];
+    vertexTexture = textures[2];
+    indexTexture = textures[3];
+    meshTexture = textures[4];
+    glGenFramebuffers(1, &framebuffer);
+    glGenBuffers(1, &meshBuffer);
+    glGenVertexArrays(1, &vertexArray);
+}
+
+VisibilityBuffer::~VisibilityBuffer()
+{
+    GLuint textures[5] = {idTexture, depthTexture, vertexTexture, indexTexture, meshTexture};
+    glDeleteTextures(5, textures);
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteBuffers(1, &meshBuffer);
+    glDeleteVertexArrays(1, &vertexArray);
+}
+
+void VisibilityBuffer::update(const std::vector<ThreeDimensionalObject>& objects, std::size_t first)
+{
+    if (first == 0) meshData.clear();
+    for (std::size_t i = first; i < objects.size(); i++) {
+        const Mesh* mesh = objects[i].getMesh();
+        if (meshData.size() < (mesh->id + 1) * 2) {
+            meshData.resize((mesh->id + 1) * 2);
+        }
+        meshData[mesh->id * 2] = mesh->firstIndex;
+        meshData[mesh->id * 2 + 1] = mesh->baseVertex;
+    }
+    // Only as big as the number of meshes, so it is uploaded whole
+    glBindBuffer(GL_TEXTURE_BUFFER, meshBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, meshData.size() * sizeof(GLint), meshData.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_BUFFER, meshTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32I, meshBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+void VisibilityBuffer::resize(GLint newWidth, GLint newHeight)
+{
+    width = newWidth;
+    height = newHeight;
+    // The same depth precision as the framebuffer which is resolved into,
+    // which is bound, so that the depth tests come out the same
+    GLint depthBits = 24;
+    glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, target ? GL_DEPTH_ATTACHMENT : GL_DEPTH,
+        GL_FRAMEBUFFER_ATTACHMENT_DEPTH_SIZE, &depthBits);
+
+    glBindTexture(GL_TEXTURE_2D, idTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32UI, width, height, 0, GL_RG_INTEGER, GL_UNSIGNED_INT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, depthTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, depthBits <= 16 ? GL_DEPTH_COMPONENT16 : GL_DEPTH_COMPONENT24,
+        width, height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, idTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "Visibility buffer is incomplete: 0x%x\n", status);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, target);
+}
+
+void VisibilityBuffer::beginGeometryPass(GLint viewportWidth, GLint viewportHeight)
+{
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &target);
+    if (viewportWidth != width || viewportHeight != height) {
+        resize(viewportWidth, viewportHeight);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    const GLuint noObject[4] = {0, 0, 0, 0};
+    const GLfloat farthest = 1.f;
+    glClearBufferuiv(GL_COLOR, 0, noObject);
+    glClearBufferfv(GL_DEPTH, 0, &farthest);
+}
+
+void VisibilityBuffer::resolve(GLuint program, const GeometryArena& arena)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, target);
+
+    glActiveTexture(GL_TEXTURE0 + ID_UNIT);
+    glBindTexture(GL_TEXTURE_2D, idTexture);
+    glActiveTexture(GL_TEXTURE0 + DEPTH_UNIT);
+    glBindTexture(GL_TEXTURE_2D, depthTexture);
+    // The arena's buffers are replaced whenever it grows, so the views are
+    // pointed at them again every frame
+    glActiveTexture(GL_TEXTURE0 + VERTEX_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, vertexTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32F, arena.getVertexBuffer());
+    glActiveTexture(GL_TEXTURE0 + INDEX_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, indexTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, arena.getIndexBuffer());
+    glActiveTexture(GL_TEXTURE0 + MESH_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, meshTexture);
+    glActiveTexture(GL_TEXTURE0);
+
+    glUseProgram(program);
+    const struct {
+        const char* name;
+        int attribute;
+    } streams[] = {
+        {"positionStream", ATTRIB_POSITION},
+        {"normalStream", ATTRIB_NORMAL},
+        {"baryStream", ATTRIB_BARYCENTRIC},
+    };
+    const VertexLayout& layout = arena.getLayout();
+    for (const auto& stream : streams) {
+        GLuint index = layout.attributes[stream.attribute].stream;
+        GLintptr start = layout.streamStart(index, arena.getVertexCapacity()) + layout.offset(stream.attribute);
+        glUniform2i(glGetUniformLocation(program, stream.name),
+            start / sizeof(GLfloat), layout.stride(index) / sizeof(GLfloat));
+    }
+    glBindVertexArray(vertexArray);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+}
+
+void VisibilityBuffer::bindSamplers(GLuint program)
+{
+    const struct {
+        const char* name;
+        GLint unit;
+    } samplers[] = {
+        {"ids", ID_UNIT},
+        {"depth", DEPTH_UNIT},
+        {"vertexData", VERTEX_UNIT},
+        {"indexData", INDEX_UNIT},
+        {"meshes", MESH_UNIT},
+    };
+    glUseProgram(program);
+    for (const auto& sampler : samplers) {
+        GLint location = glGetUniformLocation(program, sampler.name);
+        if (location >= 0) {
+            glUniform1i(location, sampler.unit);
+        }
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "glad.h"
+#include "3dobject.h"
+#include "mesh.h"
+#include <vector>
+
+// Visibility buffer rendering. The geometry pass draws the scene into a
+// framebuffer of its own, writing nothing but depth and, to an integer
+// target, the instance and triangle which cover each pixel. The resolve pass
+// then draws one full-screen triangle, and for each pixel, fetches the
+// vertices of its triangle from the geometry arena, and shades it.
+//
+// Every pixel is shaded exactly once, however small the triangles are.
+// Small triangles still waste most of the 2x2 quads of pixels they are
+// rasterized in, but only in the geometry pass, whose fragments do next to
+// nothing.
+//
+// The resolve pass reads the instance data the geometry pass was drawn
+// with, so the render path has to have some; the per-object path doesn't.
+class VisibilityBuffer {
+    private:
+    GLuint framebuffer;
+    // RG32UI instance and triangle, and the depth
+    GLuint idTexture;
+    GLuint depthTexture;
+    GLint width, height;
+    // Texture buffer views of the geometry arena's buffers
+    GLuint vertexTexture;
+    GLuint indexTexture;
+    // First index and base vertex of each mesh, by Mesh::id
+    std::vector<GLint> meshData;
+    GLuint meshBuffer;
+    GLuint meshTexture;
+    // Nothing is read from it, but the resolve pass needs one bound
+    GLuint vertexArray;
+    // The framebuffer bound before the geometry pass, which is resolved into
+    GLint target;
+
+    void resize(GLint newWidth, GLint newHeight);
+
+    public:
+    VisibilityBuffer();
+
+    // Prevent copying! See: https://www.khronos.org/opengl/wiki/Common_Mistakes#RAII_and_hidden_destructor_calls
+    VisibilityBuffer(VisibilityBuffer& other) = delete;
+    VisibilityBuffer& operator= (VisibilityBuffer& other) = delete;
+
+    ~VisibilityBuffer();
+
+    // Upload where the meshes of the objects from first on are in the
+    // geometry arena, along with the ones uploaded before, unless first is
+    // 0. Only needs to be called again when meshes are added.
+    void update(const std::vector<ThreeDimensionalObject>& objects, std::size_t first = 0);
+    // Bind and clear the framebuffer of the geometry pass, which is
+    // (re)allocated to the given size, in pixels
+    void beginGeometryPass(GLint viewportWidth, GLint viewportHeight);
+    // Shade every pixel the geometry pass covered into the framebuffer which
+    // was bound before it, with program, which is resolve.vert and resolve.frag,
+    // linked. Depth is copied over as well.
+    void resolve(GLuint program, const GeometryArena& arena);
+
+    // Point the samplers of a linked resolve program at the units resolve()
+    // binds the textures to
+    static void bindSamplers(GLuint program);
+};